@@ -199,6 +199,33 @@ AC_DEFUN([AC_PACKAGE_GLOBALS],
     AC_SUBST(pkg_platform)
   ])
 
+AC_DEFUN([AC_PACKAGE_WANT_IO_URING],
+  [ AC_MSG_CHECKING([for io_uring xattr operations])
+    AC_TRY_COMPILE([
+#include <sys/syscall.h>
+#include <linux/io_uring.h>],
+    [ struct io_uring_sqe sqe;
+      sqe.addr3 = 0;
+      sqe.xattr_flags = 0;
+      return __NR_io_uring_setup + IORING_OP_GETXATTR + IORING_OP_SETXATTR; ],
+    [ have_io_uring=yes ], [ have_io_uring=no ])
+    AC_MSG_RESULT($have_io_uring)
+    AC_SUBST(have_io_uring)
+  ])
+
+AC_DEFUN([AC_PACKAGE_WANT_SYS_SDT_H],
+  [ if test "$enable_sdt" = "yes"; then
+        AC_CHECK_HEADERS([sys/sdt.h])
+        if test "$ac_cv_header_sys_sdt_h" != "yes"; then
+            echo
+            echo 'FATAL ERROR: sys/sdt.h does not exist.'
+            echo 'Install the systemtap SDT development package, or'
+            echo 'configure with --enable-sdt=no.'
+            exit 1
+        fi
+    fi
+  ])
+
 #
 # Check for specified utility (env var) - if unset, fail.
 #
@@ -0,0 +1,372 @@
+/*
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; either version 2, or (at your option) any
+  later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along
+  with this library; if not, write to the Free Software Foundation, Inc.,
+  59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+/*
+ * Benchmark driver for librichacl.  All results are written to standard
+ * output as a single JSON object so that runs can be archived and compared
+ * by scripts; progress and errors go to standard error.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+#include <sys/utsname.h>
+
+#include "richacl.h"
+#include "bench.h"
+
+/* Also used by auto_inherit(). */
+const char *progname;
+
+struct bench_options bench_options = {
+	.min_time_ms = 200,
+	.repeat = 5,
+	.max_aces = 1024,
+	.seed = 0x5eed5eed5eed5eedULL,
+	.filter = NULL,
+	.tmpdir = NULL,
+	.backend = "emulated",
+};
+
+uint64_t bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * Count heap allocations by interposing the allocator entry points.  The
+ * library is linked dynamically, so its calls to malloc() resolve to the
+ * definitions below as well.
+ */
+static __thread unsigned long n_allocations;
+
+unsigned long bench_allocations(void)
+{
+	return n_allocations;
+}
+
+#ifdef __GLIBC__
+extern void *__libc_malloc(size_t);
+extern void *__libc_calloc(size_t, size_t);
+extern void *__libc_realloc(void *, size_t);
+
+void *malloc(size_t size)
+{
+	n_allocations++;
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+	n_allocations++;
+	return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	n_allocations++;
+	return __libc_realloc(ptr, size);
+}
+#endif
+
+static void json_indent(struct json_writer *json)
+{
+	int n;
+
+	if (json->need_comma)
+		fputc(',', json->file);
+	fputc('\n', json->file);
+	for (n = 0; n < json->depth; n++)
+		fputs("  ", json->file);
+}
+
+static void json_key(struct json_writer *json, const char *key)
+{
+	json_indent(json);
+	if (key)
+		fprintf(json->file, "\"%s\": ", key);
+}
+
+void json_begin_object(struct json_writer *json, const char *key)
+{
+	if (json->depth || json->need_comma)
+		json_key(json, key);
+	fputc('{', json->file);
+	json->depth++;
+	json->need_comma = 0;
+}
+
+void json_end_object(struct json_writer *json)
+{
+	json->depth--;
+	json->need_comma = 0;
+	json_indent(json);
+	fputc('}', json->file);
+	json->need_comma = 1;
+	if (!json->depth)
+		fputc('\n', json->file);
+}
+
+void json_begin_array(struct json_writer *json, const char *key)
+{
+	json_key(json, key);
+	fputc('[', json->file);
+	json->depth++;
+	json->need_comma = 0;
+}
+
+void json_end_array(struct json_writer *json)
+{
+	json->depth--;
+	json->need_comma = 0;
+	json_indent(json);
+	fputc(']', json->file);
+	json->need_comma = 1;
+}
+
+void json_string(struct json_writer *json, const char *key, const char *str)
+{
+	json_key(json, key);
+	fputc('"', json->file);
+	for (; *str; str++) {
+		if (*str == '"' || *str == '\\')
+			fprintf(json->file, "\\%c", *str);
+		else if ((unsigned char)*str < 0x20)
+			fprintf(json->file, "\\u%04x", *str);
+		else
+			fputc(*str, json->file);
+	}
+	fputc('"', json->file);
+	json->need_comma = 1;
+}
+
+void json_uint(struct json_writer *json, const char *key,
+	       unsigned long long value)
+{
+	json_key(json, key);
+	fprintf(json->file, "%llu", value);
+	json->need_comma = 1;
+}
+
+void json_double(struct json_writer *json, const char *key, double value)
+{
+	json_key(json, key);
+	fprintf(json->file, "%.2f", value);
+	json->need_comma = 1;
+}
+
+static struct option long_options[] = {
+	{"min-time",		1, 0, 't'},
+	{"repeat",		1, 0, 'r'},
+	{"max-aces",		1, 0, 'n'},
+	{"seed",		1, 0, 's'},
+	{"filter",		1, 0, 'f'},
+	{"tmpdir",		1, 0, 'd'},
+	{"backend",		1, 0, 'b'},
+	{"fanout",		1, 0, 1},
+	{"depth",		1, 0, 2},
+	{"files",		1, 0, 3},
+	{"aces",		1, 0, 4},
+	{"explicit",		1, 0, 5},
+	{"protected",		1, 0, 6},
+	{"keep",		0, 0, 7},
+	{"threads",		1, 0, 8},
+	{"help",		0, 0, 'h'},
+	{ NULL,			0, 0,  0 }
+};
+
+static void synopsis(int help)
+{
+	FILE *file = help ? stdout : stderr;
+
+	fprintf(file, "SYNOPSIS: %s [options] [micro|tree|threads]\n", basename(progname));
+	if (!help) {
+		fprintf(file, "Try `%s --help' for more information.\n",
+			basename(progname));
+		exit(1);
+	}
+	fprintf(file,
+"\n"
+"Modes:\n"
+"  micro       Time the hot librichacl functions on generated ACLs of\n"
+"              1 to --max-aces entries (default).\n"
+"  tree        Generate a directory tree in --tmpdir, and time Automatic\n"
+"              Inheritance propagation, recursive retrieval, and access\n"
+"              checks on it.  Use a tmpfs directory such as /dev/shm to\n"
+"              measure the library rather than the disk.\n"
+"  threads     Call librichacl functions from 1, 2, 4, ... --threads\n"
+"              threads at once, check that all results agree with a\n"
+"              single-threaded run, and report how the throughput\n"
+"              scales.\n"
+"\n"
+"Options:\n"
+"  --min-time=MS, -t MS\n"
+"              Measure each sample for at least MS milliseconds (200).\n"
+"  --repeat=N, -r N\n"
+"              Take N samples per case and report the median (5).\n"
+"  --max-aces=N, -n N\n"
+"              Size of the largest generated ACL (1024).\n"
+"  --seed=N, -s N\n"
+"              Seed for the corpus generator.\n"
+"  --filter=STRING, -f STRING\n"
+"              Only run cases whose name contains STRING.\n"
+"  --tmpdir=DIR, -d DIR\n"
+"              Directory for temporary files ($TMPDIR or /tmp).\n"
+"  --backend=NAME, -b NAME\n"
+"              Store ACLs in the xattr, user, or emulated[:latency]\n"
+"              backend (emulated).  See richacl --help.\n"
+"  --help, -h  This help text.\n"
+"\n"
+"Tree options:\n"
+"  --fanout=N  Subdirectories per directory (4).\n"
+"  --depth=N   Levels of directories (4).\n"
+"  --files=N   Files per directory (16).\n"
+"  --aces=N    Entries in the root ACL (8).\n"
+"  --explicit=PERCENT\n"
+"              Files which get an explicit entry in addition to the\n"
+"              inherited ones (10).\n"
+"  --protected=PERCENT\n"
+"              Files with a protected ACL (1).\n"
+"  --keep      Do not remove the tree when done.\n"
+"\n"
+"Threads options:\n"
+"  --threads=N Largest number of threads (one per cpu).\n"
+"\n"
+"Results are written to standard output in JSON format.\n");
+	exit(0);
+}
+
+int main(int argc, char *argv[])
+{
+	struct json_writer json = { .file = stdout };
+	struct richacl_backend *backend;
+	struct utsname uts;
+	const char *mode = "micro";
+	int status;
+	int c;
+
+	progname = argv[0];
+
+	while ((c = getopt_long(argc, argv, "t:r:n:s:f:d:b:h",
+				long_options, NULL)) != -1) {
+		switch(c) {
+			case 't':
+				bench_options.min_time_ms = strtoul(optarg, NULL, 0);
+				break;
+			case 'r':
+				bench_options.repeat = strtoul(optarg, NULL, 0);
+				if (!bench_options.repeat)
+					bench_options.repeat = 1;
+				break;
+			case 'n':
+				bench_options.max_aces = strtoul(optarg, NULL, 0);
+				break;
+			case 's':
+				bench_options.seed = strtoull(optarg, NULL, 0);
+				break;
+			case 'f':
+				bench_options.filter = optarg;
+				break;
+			case 'd':
+				bench_options.tmpdir = optarg;
+				break;
+			case 'b':
+				bench_options.backend = optarg;
+				break;
+			case 1:  /* --fanout */
+				tree_options.fanout = strtoul(optarg, NULL, 0);
+				break;
+			case 2:  /* --depth */
+				tree_options.depth = strtoul(optarg, NULL, 0);
+				break;
+			case 3:  /* --files */
+				tree_options.files = strtoul(optarg, NULL, 0);
+				break;
+			case 4:  /* --aces */
+				tree_options.aces = strtoul(optarg, NULL, 0);
+				break;
+			case 5:  /* --explicit */
+				tree_options.explicit_percent =
+					strtoul(optarg, NULL, 0);
+				break;
+			case 6:  /* --protected */
+				tree_options.protected_percent =
+					strtoul(optarg, NULL, 0);
+				break;
+			case 7:  /* --keep */
+				tree_options.keep = 1;
+				break;
+			case 8:  /* --threads */
+				bench_options.threads = strtoul(optarg, NULL, 0);
+				break;
+			case 'h':
+				synopsis(1);
+				break;
+			default:
+				synopsis(0);
+				break;
+		}
+	}
+	if (optind < argc)
+		mode = argv[optind++];
+	if (optind != argc)
+		synopsis(0);
+	if (!bench_options.tmpdir) {
+		bench_options.tmpdir = getenv("TMPDIR");
+		if (!bench_options.tmpdir)
+			bench_options.tmpdir = "/tmp";
+	}
+	backend = richacl_backend_by_name(bench_options.backend);
+	if (!backend) {
+		fprintf(stderr, "%s: unknown backend `%s'\n",
+			basename(progname), bench_options.backend);
+		exit(1);
+	}
+	richacl_set_backend(backend);
+
+	json_begin_object(&json, NULL);
+	json_string(&json, "mode", mode);
+	json_string(&json, "version", VERSION);
+	if (uname(&uts) == 0) {
+		json_string(&json, "machine", uts.machine);
+		json_string(&json, "kernel", uts.release);
+	}
+	json_uint(&json, "seed", bench_options.seed);
+	json_uint(&json, "min_time_ms", bench_options.min_time_ms);
+	json_uint(&json, "repeat", bench_options.repeat);
+	json_string(&json, "backend", bench_options.backend);
+
+	if (!strcmp(mode, "micro"))
+		status = run_micro(&json);
+	else if (!strcmp(mode, "tree"))
+		status = run_tree(&json);
+	else if (!strcmp(mode, "threads"))
+		status = run_threads(&json);
+	else {
+		fprintf(stderr, "%s: unknown mode `%s'\n",
+			basename(progname), mode);
+		exit(1);
+	}
+
+	json_end_object(&json);
+	richacl_free_backend(backend);
+	return status ? 1 : 0;
+}
@@ -0,0 +1,91 @@
+/*
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; either version 2, or (at your option) any
+  later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along
+  with this library; if not, write to the Free Software Foundation, Inc.,
+  59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+#ifndef __BENCH_H
+#define __BENCH_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+struct richacl;
+
+/* Corpus kinds */
+enum corpus_kind {
+	CORPUS_REALISTIC,
+	CORPUS_WORST_CASE,
+};
+
+extern const char *corpus_name(enum corpus_kind);
+extern struct richacl *corpus_generate(enum corpus_kind, unsigned int count,
+				       uint64_t *seed);
+
+/* Options shared by all benchmark modes */
+struct bench_options {
+	unsigned int min_time_ms;	/* minimum measuring time per sample */
+	unsigned int repeat;		/* number of samples per case */
+	unsigned int max_aces;		/* largest corpus to generate */
+	uint64_t seed;
+	const char *filter;		/* only run cases containing this */
+	const char *tmpdir;
+	const char *backend;		/* see richacl_backend_by_name() */
+	unsigned int threads;		/* most threads, 0 for one per cpu */
+};
+
+extern struct bench_options bench_options;
+
+/* Monotonic time in nanoseconds */
+extern uint64_t bench_now(void);
+
+/* Number of malloc/calloc/realloc calls made so far */
+extern unsigned long bench_allocations(void);
+
+/*
+ * Simple streaming JSON writer: one top-level object, which contains
+ * a "results" array of flat objects.
+ */
+struct json_writer {
+	FILE *file;
+	int depth;
+	int need_comma;
+};
+
+extern void json_begin_object(struct json_writer *, const char *key);
+extern void json_end_object(struct json_writer *);
+extern void json_begin_array(struct json_writer *, const char *key);
+extern void json_end_array(struct json_writer *);
+extern void json_string(struct json_writer *, const char *key, const char *);
+extern void json_uint(struct json_writer *, const char *key,
+		      unsigned long long);
+extern void json_double(struct json_writer *, const char *key, double);
+
+/* Options of the tree benchmark */
+struct tree_options {
+	unsigned int fanout;		/* subdirectories per directory */
+	unsigned int depth;		/* levels of directories */
+	unsigned int files;		/* files per directory */
+	unsigned int aces;		/* entries in the root acl */
+	unsigned int explicit_percent;	/* files with an explicit entry */
+	unsigned int protected_percent;	/* files with a protected acl */
+	int keep;			/* do not remove the tree */
+};
+
+extern struct tree_options tree_options;
+
+extern int run_micro(struct json_writer *);
+extern int run_tree(struct json_writer *);
+extern int run_threads(struct json_writer *);
+
+#endif  /* __BENCH_H */
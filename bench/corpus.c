@@ -0,0 +1,178 @@
+/*
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; either version 2, or (at your option) any
+  later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along
+  with this library; if not, write to the Free Software Foundation, Inc.,
+  59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+/*
+ * Deterministic ACL generators.  The same seed always produces the same
+ * corpus so that timings of different builds can be compared.
+ */
+
+#include <stdlib.h>
+#include "richacl.h"
+#include "bench.h"
+
+#define READ_SET (ACE4_READ_DATA | ACE4_EXECUTE | ACE4_READ_ATTRIBUTES | \
+		  ACE4_READ_NAMED_ATTRS | ACE4_READ_ACL | ACE4_SYNCHRONIZE)
+#define MODIFY_SET (READ_SET | ACE4_WRITE_DATA | ACE4_APPEND_DATA | \
+		    ACE4_WRITE_ATTRIBUTES | ACE4_WRITE_NAMED_ATTRS | \
+		    ACE4_DELETE)
+#define FULL_SET (MODIFY_SET | ACE4_DELETE_CHILD | ACE4_WRITE_ACL | \
+		  ACE4_WRITE_OWNER)
+#define WRITE_SET (ACE4_WRITE_DATA | ACE4_APPEND_DATA | ACE4_DELETE_CHILD)
+
+/* Identifiers in generated acls start here; see run_micro(). */
+#define FIRST_ID 10000
+
+static uint64_t next_random(uint64_t *state)
+{
+	/* xorshift64* */
+	*state ^= *state >> 12;
+	*state ^= *state << 25;
+	*state ^= *state >> 27;
+	return *state * 2685821657736338717ULL;
+}
+
+static void set_who(struct richace *ace, uint64_t *seed)
+{
+	uint64_t r = next_random(seed);
+
+	if (r & 1)
+		richace_set_gid(ace, FIRST_ID + (r >> 1) % 50000);
+	else
+		richace_set_uid(ace, FIRST_ID + (r >> 1) % 50000);
+}
+
+static void set_special(struct richace *ace, const char *who,
+			unsigned int mask)
+{
+	ace->e_type = ACE4_ACCESS_ALLOWED_ACE_TYPE;
+	richace_set_who(ace, who);
+	ace->e_mask = mask;
+}
+
+const char *corpus_name(enum corpus_kind kind)
+{
+	return kind == CORPUS_REALISTIC ? "realistic" : "worst-case";
+}
+
+/*
+ * A realistic acl: a few explicit deny entries, explicit and inherited
+ * user and group allow entries, and the usual owner@, group@, and
+ * everyone@ entries at the end, with a group and other mask that
+ * remove write access the way a chmod to 0755 would.
+ */
+static void generate_realistic(struct richacl *acl, uint64_t *seed)
+{
+	static const unsigned int masks[] = { READ_SET, MODIFY_SET, FULL_SET };
+	unsigned int count = acl->a_count, n_special = 0, n_deny, n;
+	struct richace *ace;
+
+	if (count >= 3)
+		n_special = 3;
+	else if (count == 1)
+		n_special = 1;
+	n_deny = (count - n_special) / 8;
+
+	acl->a_flags = ACL4_AUTO_INHERIT;
+	for (n = 0; n < count - n_special; n++) {
+		ace = acl->a_entries + n;
+		set_who(ace, seed);
+		if (n < n_deny) {
+			ace->e_type = ACE4_ACCESS_DENIED_ACE_TYPE;
+			ace->e_mask = WRITE_SET;
+		} else {
+			ace->e_type = ACE4_ACCESS_ALLOWED_ACE_TYPE;
+			ace->e_mask = masks[next_random(seed) % 3];
+		}
+		if (next_random(seed) & 1)
+			ace->e_flags |= ACE4_FILE_INHERIT_ACE |
+					ACE4_DIRECTORY_INHERIT_ACE;
+		if (n >= n_deny + (count - n_special - n_deny) * 3 / 4)
+			ace->e_flags |= ACE4_INHERITED_ACE;
+	}
+	ace = acl->a_entries + n;
+	if (n_special == 1)
+		set_special(ace, "EVERYONE@", READ_SET);
+	else if (n_special == 3) {
+		set_special(ace++, "OWNER@", FULL_SET);
+		set_special(ace++, "GROUP@", MODIFY_SET);
+		set_special(ace, "EVERYONE@", READ_SET);
+	}
+
+	richacl_compute_max_masks(acl);
+	acl->a_group_mask &= ~WRITE_SET;
+	acl->a_other_mask &= ~WRITE_SET;
+	acl->a_flags |= ACL4_MASKED;
+}
+
+/*
+ * A pathological acl: alternating deny and allow entries for distinct
+ * identifiers with random masks and inheritance flags, interleaved
+ * everyone@ entries, and restrictive file masks.  No entry matches the
+ * user that richacl_access() is benchmarked with, so every check scans
+ * the entire acl, and richacl_apply_masks() has to propagate and
+ * isolate permissions for every identifier.
+ */
+static void generate_worst_case(struct richacl *acl, uint64_t *seed)
+{
+	static const unsigned short inherit_flags[] = {
+		ACE4_FILE_INHERIT_ACE | ACE4_DIRECTORY_INHERIT_ACE,
+		ACE4_FILE_INHERIT_ACE,
+		ACE4_DIRECTORY_INHERIT_ACE | ACE4_NO_PROPAGATE_INHERIT_ACE,
+		ACE4_FILE_INHERIT_ACE | ACE4_INHERIT_ONLY_ACE,
+	};
+	struct richace *ace;
+	unsigned int n = 0;
+
+	acl->a_flags = ACL4_AUTO_INHERIT;
+	richacl_for_each_entry(ace, acl) {
+		if (n == acl->a_count - 1) {
+			set_special(ace, "EVERYONE@", FULL_SET);
+			break;
+		}
+		if (n % 16 == 15) {
+			richace_set_who(ace, "EVERYONE@");
+			ace->e_mask = next_random(seed) & ACE4_VALID_MASK;
+		} else {
+			set_who(ace, seed);
+			ace->e_mask = next_random(seed) & ACE4_VALID_MASK;
+		}
+		ace->e_type = (n & 1) ? ACE4_ACCESS_ALLOWED_ACE_TYPE :
+					ACE4_ACCESS_DENIED_ACE_TYPE;
+		ace->e_flags |= inherit_flags[next_random(seed) % 4];
+		n++;
+	}
+
+	richacl_compute_max_masks(acl);
+	acl->a_owner_mask &= ~ACE4_WRITE_OWNER;
+	acl->a_group_mask &= READ_SET;
+	acl->a_other_mask &= ACE4_READ_DATA;
+	acl->a_flags |= ACL4_MASKED;
+}
+
+struct richacl *corpus_generate(enum corpus_kind kind, unsigned int count,
+				uint64_t *seed)
+{
+	struct richacl *acl;
+
+	acl = richacl_alloc(count);
+	if (!acl)
+		return NULL;
+	if (kind == CORPUS_REALISTIC)
+		generate_realistic(acl, seed);
+	else
+		generate_worst_case(acl, seed);
+	return acl;
+}
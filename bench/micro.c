@@ -0,0 +1,425 @@
+/*
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; either version 2, or (at your option) any
+  later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along
+  with this library; if not, write to the Free Software Foundation, Inc.,
+  59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+/*
+ * Micro-benchmarks: time individual librichacl functions on generated
+ * acls of increasing size.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "richacl.h"
+#include "bench.h"
+
+/* Not contained in any generated acl; see corpus.c. */
+#define BENCH_UID 999999
+#define BENCH_GID 999999
+
+#define TEXT_FORMAT (RICHACL_TEXT_SIMPLIFY | RICHACL_TEXT_ALIGN | \
+		     RICHACL_TEXT_NUMERIC_IDS | RICHACL_TEXT_FILE_CONTEXT)
+
+struct micro_arg {
+	struct richacl *acl;
+	struct richacl *inherited;
+	void *xattr;
+	size_t xattr_size;
+	void *buffer;
+	char *text;
+	char *path;
+	struct stat st;
+};
+
+struct micro_case {
+	const char *function;
+	const char *variant;
+	/* Returns 0, or an explanation why the case cannot run. */
+	const char *(*setup)(struct micro_arg *);
+	int (*op)(struct micro_arg *);
+};
+
+static const char *setup_xattr(struct micro_arg *arg)
+{
+	arg->xattr_size = richacl_xattr_size(arg->acl);
+	arg->xattr = malloc(arg->xattr_size);
+	arg->buffer = malloc(arg->xattr_size);
+	if (!arg->xattr || !arg->buffer)
+		return strerror(errno);
+	richacl_to_xattr(arg->acl, arg->xattr);
+	return NULL;
+}
+
+static int op_from_xattr(struct micro_arg *arg)
+{
+	struct richacl *acl;
+
+	acl = richacl_from_xattr(arg->xattr, arg->xattr_size);
+	if (!acl)
+		return -1;
+	richacl_free(acl);
+	return 0;
+}
+
+static int op_to_xattr(struct micro_arg *arg)
+{
+	richacl_to_xattr(arg->acl, arg->buffer);
+	return 0;
+}
+
+static const char *setup_access(struct micro_arg *arg)
+{
+	int fd;
+
+	if (asprintf(&arg->path, "%s/richacl-bench.XXXXXX",
+		     bench_options.tmpdir) < 0)
+		return strerror(errno);
+	fd = mkstemp(arg->path);
+	if (fd < 0) {
+		free(arg->path);
+		arg->path = NULL;
+		return strerror(errno);
+	}
+	close(fd);
+	if (richacl_set_file(arg->path, arg->acl) ||
+	    stat(arg->path, &arg->st))
+		return strerror(errno);
+	return NULL;
+}
+
+static int op_access(struct micro_arg *arg)
+{
+	gid_t groups[] = { BENCH_GID };
+
+	return richacl_access(arg->path, &arg->st, BENCH_UID, groups, 1) < 0 ?
+	       -1 : 0;
+}
+
+static int op_compute_max_masks(struct micro_arg *arg)
+{
+	richacl_compute_max_masks(arg->acl);
+	return 0;
+}
+
+static int op_clone(struct micro_arg *arg)
+{
+	struct richacl *acl;
+
+	acl = richacl_clone(arg->acl);
+	if (!acl)
+		return -1;
+	richacl_free(acl);
+	return 0;
+}
+
+/* Includes the cost of richacl_clone(), which is benchmarked separately. */
+static int op_apply_masks(struct micro_arg *arg)
+{
+	struct richacl *acl;
+	int ret;
+
+	acl = richacl_clone(arg->acl);
+	if (!acl)
+		return -1;
+	ret = richacl_apply_masks(&acl);
+	richacl_free(acl);
+	return ret;
+}
+
+/* Includes the cost of richacl_clone(), which is benchmarked separately. */
+static int op_canonicalize(struct micro_arg *arg)
+{
+	struct richacl *acl;
+	int ret;
+
+	acl = richacl_clone(arg->acl);
+	if (!acl)
+		return -1;
+	ret = richacl_canonicalize(acl);
+	richacl_free(acl);
+	return ret < 0 ? -1 : 0;
+}
+
+/* Keeps the compiler from optimizing richacl_hash() away. */
+static volatile uint64_t hash_sink;
+
+static int op_hash(struct micro_arg *arg)
+{
+	hash_sink = richacl_hash(arg->acl);
+	return 0;
+}
+
+static int op_inherit(struct micro_arg *arg, int isdir)
+{
+	struct richacl *acl;
+
+	errno = 0;
+	acl = richacl_inherit(arg->acl, isdir);
+	if (!acl && errno)
+		return -1;
+	richacl_free(acl);
+	return 0;
+}
+
+static int op_inherit_file(struct micro_arg *arg)
+{
+	return op_inherit(arg, 0);
+}
+
+static int op_inherit_dir(struct micro_arg *arg)
+{
+	return op_inherit(arg, 1);
+}
+
+static int op_inherit_both(struct micro_arg *arg)
+{
+	struct richacl *file_acl, *dir_acl;
+
+	if (richacl_inherit_both(arg->acl, &file_acl, &dir_acl))
+		return -1;
+	richacl_free(file_acl);
+	return 0;
+}
+
+static const char *setup_auto_inherit(struct micro_arg *arg)
+{
+	arg->inherited = richacl_inherit(arg->acl, 1);
+	if (!arg->inherited)
+		arg->inherited = richacl_alloc(0);
+	if (!arg->inherited)
+		return strerror(errno);
+	return NULL;
+}
+
+static int op_auto_inherit(struct micro_arg *arg)
+{
+	struct richacl *acl;
+
+	acl = richacl_auto_inherit(arg->acl, arg->inherited);
+	if (!acl)
+		return -1;
+	richacl_free(acl);
+	return 0;
+}
+
+static int op_to_text(struct micro_arg *arg)
+{
+	char *text;
+
+	text = richacl_to_text(arg->acl, TEXT_FORMAT);
+	if (!text)
+		return -1;
+	free(text);
+	return 0;
+}
+
+static int discard_text(void *arg, const char *str, size_t len)
+{
+	return 0;
+}
+
+static int op_write_text(struct micro_arg *arg)
+{
+	return richacl_write_text(arg->acl, TEXT_FORMAT, discard_text, NULL);
+}
+
+static const char *setup_from_text(struct micro_arg *arg)
+{
+	arg->text = richacl_to_text(arg->acl, RICHACL_TEXT_SHOW_MASKS |
+					      RICHACL_TEXT_NUMERIC_IDS);
+	if (!arg->text)
+		return strerror(errno);
+	return NULL;
+}
+
+static void ignore_error(const char *fmt, ...)
+{
+}
+
+static int op_from_text(struct micro_arg *arg)
+{
+	struct richacl *acl;
+
+	acl = richacl_from_text(arg->text, NULL, ignore_error);
+	if (!acl)
+		return -1;
+	richacl_free(acl);
+	return 0;
+}
+
+static struct micro_case micro_cases[] = {
+	{ "richacl_from_xattr", NULL, setup_xattr, op_from_xattr },
+	{ "richacl_to_xattr", NULL, setup_xattr, op_to_xattr },
+	{ "richacl_access", NULL, setup_access, op_access },
+	{ "richacl_compute_max_masks", NULL, NULL, op_compute_max_masks },
+	{ "richacl_clone", NULL, NULL, op_clone },
+	{ "richacl_apply_masks", NULL, NULL, op_apply_masks },
+	{ "richacl_canonicalize", NULL, NULL, op_canonicalize },
+	{ "richacl_hash", NULL, NULL, op_hash },
+	{ "richacl_inherit", "file", NULL, op_inherit_file },
+	{ "richacl_inherit", "dir", NULL, op_inherit_dir },
+	{ "richacl_inherit_both", NULL, NULL, op_inherit_both },
+	{ "richacl_auto_inherit", NULL, setup_auto_inherit, op_auto_inherit },
+	{ "richacl_to_text", NULL, NULL, op_to_text },
+	{ "richacl_write_text", NULL, NULL, op_write_text },
+	{ "richacl_from_text", NULL, setup_from_text, op_from_text },
+};
+
+static void cleanup_arg(struct micro_arg *arg)
+{
+	if (arg->path) {
+		unlink(arg->path);
+		free(arg->path);
+	}
+	free(arg->text);
+	free(arg->buffer);
+	free(arg->xattr);
+	richacl_free(arg->inherited);
+	richacl_free(arg->acl);
+}
+
+static int run_iterations(struct micro_case *mc, struct micro_arg *arg,
+			  unsigned long iterations, uint64_t *elapsed)
+{
+	uint64_t start = bench_now();
+	unsigned long n;
+
+	for (n = 0; n < iterations; n++) {
+		if (mc->op(arg))
+			return -1;
+	}
+	*elapsed = bench_now() - start;
+	return 0;
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+	const uint64_t *x = a, *y = b;
+
+	return (*x > *y) - (*x < *y);
+}
+
+/*
+ * Find an iteration count that runs for at least --min-time, then take
+ * --repeat samples with that count and report the median.
+ */
+static int measure(struct micro_case *mc, struct micro_arg *arg,
+		   struct json_writer *json)
+{
+	uint64_t min_time = bench_options.min_time_ms * 1000000ULL;
+	unsigned long iterations = 1, counted, allocations;
+	uint64_t elapsed, unused, *samples;
+	unsigned int n;
+
+	for (;;) {
+		if (run_iterations(mc, arg, iterations, &elapsed))
+			return -1;
+		if (elapsed >= min_time)
+			break;
+		if (elapsed < min_time / 100)
+			iterations *= 10;
+		else
+			iterations = iterations * min_time / elapsed + 1;
+	}
+
+	samples = malloc(sizeof(*samples) * bench_options.repeat);
+	if (!samples)
+		return -1;
+	for (n = 0; n < bench_options.repeat; n++) {
+		if (run_iterations(mc, arg, iterations, samples + n)) {
+			free(samples);
+			return -1;
+		}
+	}
+	qsort(samples, bench_options.repeat, sizeof(*samples), compare_u64);
+	elapsed = samples[bench_options.repeat / 2];
+	free(samples);
+
+	counted = iterations;
+	/* Allocation counts do not vary between runs; a short run suffices. */
+	if (iterations > 1000)
+		counted = 1000;
+	allocations = bench_allocations();
+	if (run_iterations(mc, arg, counted, &unused))
+		return -1;
+	allocations = bench_allocations() - allocations;
+
+	json_uint(json, "iterations", iterations);
+	json_double(json, "ns_per_op", (double)elapsed / iterations);
+	json_double(json, "allocs_per_op", (double)allocations / counted);
+	return 0;
+}
+
+int run_micro(struct json_writer *json)
+{
+	static const enum corpus_kind kinds[] = {
+		CORPUS_REALISTIC, CORPUS_WORST_CASE
+	};
+	int status = 0, k, i;
+	unsigned int count;
+
+	json_begin_array(json, "results");
+	for (k = 0; k < sizeof(kinds) / sizeof(kinds[0]); k++) {
+		for (count = 1; count <= bench_options.max_aces; count *= 2) {
+			for (i = 0; i < sizeof(micro_cases) /
+					sizeof(micro_cases[0]); i++) {
+				struct micro_case *mc = micro_cases + i;
+				struct micro_arg arg = { };
+				uint64_t seed = bench_options.seed + count;
+				const char *skipped = NULL;
+				char name[128];
+
+				snprintf(name, sizeof(name), "%s%s%s/%s/%u",
+					 mc->function, mc->variant ? "/" : "",
+					 mc->variant ? mc->variant : "",
+					 corpus_name(kinds[k]), count);
+				if (bench_options.filter &&
+				    !strstr(name, bench_options.filter))
+					continue;
+				fprintf(stderr, "%s\n", name);
+
+				arg.acl = corpus_generate(kinds[k], count, &seed);
+				if (!arg.acl) {
+					perror(name);
+					return -1;
+				}
+				if (mc->setup)
+					skipped = mc->setup(&arg);
+
+				json_begin_object(json, NULL);
+				json_string(json, "name", name);
+				json_string(json, "function", mc->function);
+				if (mc->variant)
+					json_string(json, "variant", mc->variant);
+				json_string(json, "corpus", corpus_name(kinds[k]));
+				json_uint(json, "aces", count);
+				if (skipped)
+					json_string(json, "skipped", skipped);
+				else if (measure(mc, &arg, json)) {
+					json_string(json, "error", strerror(errno));
+					status = -1;
+				}
+				json_end_object(json);
+				cleanup_arg(&arg);
+			}
+		}
+	}
+	json_end_array(json);
+	return status;
+}
@@ -0,0 +1,355 @@
+/*
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; either version 2, or (at your option) any
+  later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along
+  with this library; if not, write to the Free Software Foundation, Inc.,
+  59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+/*
+ * Concurrency benchmark: call librichacl functions from several threads at
+ * once, check that each call returns the same result as in a
+ * single-threaded run, and report how the throughput scales with the
+ * number of threads.  All threads share the same acl; functions which
+ * modify acls work on a copy.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "richacl.h"
+#include "bench.h"
+
+#define BENCH_UID 999999
+#define BENCH_GID 999999
+
+/* Without RICHACL_TEXT_NUMERIC_IDS, so that user and group names are
+   looked up. */
+#define TEXT_FORMAT (RICHACL_TEXT_ALIGN | RICHACL_TEXT_SHOW_MASKS | \
+		     RICHACL_TEXT_FILE_CONTEXT)
+
+struct threads_arg {
+	const struct richacl *acl;
+	const char *text;
+	struct stat st;
+};
+
+struct threads_case {
+	const char *function;
+	/* Returns 0 and a summary of the result, or -1 with errno set. */
+	int (*op)(const struct threads_arg *, uint64_t *);
+};
+
+static uint64_t hash_string(const char *str)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;  /* FNV-1a */
+
+	for (; *str; str++)
+		hash = (hash ^ (unsigned char)*str) * 0x100000001b3ULL;
+	return hash;
+}
+
+static int op_to_text(const struct threads_arg *arg, uint64_t *result)
+{
+	char *text;
+
+	text = richacl_to_text(arg->acl, TEXT_FORMAT);
+	if (!text)
+		return -1;
+	*result = hash_string(text);
+	free(text);
+	return 0;
+}
+
+static void ignore_error(const char *fmt, ...)
+{
+}
+
+static int op_from_text(const struct threads_arg *arg, uint64_t *result)
+{
+	struct richacl *acl;
+
+	acl = richacl_from_text(arg->text, NULL, ignore_error);
+	if (!acl)
+		return -1;
+	*result = richacl_hash(acl);
+	richacl_free(acl);
+	return 0;
+}
+
+static int op_permission(const struct threads_arg *arg, uint64_t *result)
+{
+	gid_t groups[] = { BENCH_GID };
+	int mask;
+
+	mask = richacl_permission(arg->acl, &arg->st, BENCH_UID, groups, 1);
+	if (mask < 0)
+		return -1;
+	*result = mask;
+	return 0;
+}
+
+static int op_inherit(const struct threads_arg *arg, uint64_t *result)
+{
+	struct richacl *file_acl, *dir_acl;
+
+	if (richacl_inherit_both(arg->acl, &file_acl, &dir_acl))
+		return -1;
+	*result = richacl_hash(file_acl) * 31 + richacl_hash(dir_acl);
+	richacl_free(file_acl);
+	return 0;
+}
+
+static int op_apply_masks(const struct threads_arg *arg, uint64_t *result)
+{
+	struct richacl *acl;
+
+	acl = richacl_clone(arg->acl);
+	if (!acl)
+		return -1;
+	if (richacl_apply_masks(&acl)) {
+		richacl_free(acl);
+		return -1;
+	}
+	*result = richacl_hash(acl);
+	richacl_free(acl);
+	return 0;
+}
+
+static struct threads_case threads_cases[] = {
+	{ "richacl_to_text", op_to_text },
+	{ "richacl_from_text", op_from_text },
+	{ "richacl_permission", op_permission },
+	{ "richacl_inherit_both", op_inherit },
+	{ "richacl_apply_masks", op_apply_masks },
+};
+
+struct worker {
+	pthread_t thread;
+	const struct threads_case *tc;
+	const struct threads_arg *arg;
+	uint64_t expected;
+	pthread_barrier_t *barrier;
+	int *stop;
+	unsigned long ops;
+	int error;		/* errno, or -1 for a wrong result */
+};
+
+static void *worker_thread(void *data)
+{
+	struct worker *w = data;
+	uint64_t result;
+
+	pthread_barrier_wait(w->barrier);
+	while (!__atomic_load_n(w->stop, __ATOMIC_RELAXED)) {
+		if (w->tc->op(w->arg, &result)) {
+			w->error = errno;
+			break;
+		}
+		if (result != w->expected) {
+			w->error = -1;
+			break;
+		}
+		w->ops++;
+	}
+	return NULL;
+}
+
+/*
+ * Run @tc in @n_threads threads for --min-time.  Returns the number of
+ * operations per second, or -1 with the error in *error.
+ */
+static double run_threads_once(const struct threads_case *tc,
+			       const struct threads_arg *arg,
+			       uint64_t expected, unsigned int n_threads,
+			       int *error)
+{
+	struct worker *workers;
+	pthread_barrier_t barrier;
+	int stop = 0;
+	unsigned long ops = 0;
+	uint64_t start, elapsed;
+	unsigned int n;
+
+	workers = calloc(n_threads, sizeof(*workers));
+	if (!workers) {
+		*error = errno;
+		return -1;
+	}
+	pthread_barrier_init(&barrier, NULL, n_threads + 1);
+	for (n = 0; n < n_threads; n++) {
+		struct worker *w = workers + n;
+		int err;
+
+		w->tc = tc;
+		w->arg = arg;
+		w->expected = expected;
+		w->barrier = &barrier;
+		w->stop = &stop;
+		err = pthread_create(&w->thread, NULL, worker_thread, w);
+		if (err) {
+			/* The threads already started would wait forever. */
+			fprintf(stderr, "pthread_create: %s\n", strerror(err));
+			exit(1);
+		}
+	}
+	pthread_barrier_wait(&barrier);
+	start = bench_now();
+	usleep(bench_options.min_time_ms * 1000);
+	__atomic_store_n(&stop, 1, __ATOMIC_RELAXED);
+	*error = 0;
+	for (n = 0; n < n_threads; n++) {
+		pthread_join(workers[n].thread, NULL);
+		ops += workers[n].ops;
+		if (workers[n].error)
+			*error = workers[n].error;
+	}
+	elapsed = bench_now() - start;
+	pthread_barrier_destroy(&barrier);
+	free(workers);
+	if (*error)
+		return -1;
+	return ops * 1e9 / elapsed;
+}
+
+static int compare_double(const void *a, const void *b)
+{
+	const double *x = a, *y = b;
+
+	return (*x > *y) - (*x < *y);
+}
+
+/* Take --repeat samples and report the median. */
+static int measure_threads(const struct threads_case *tc,
+			   const struct threads_arg *arg,
+			   unsigned int n_threads, double *base,
+			   struct json_writer *json)
+{
+	uint64_t expected;
+	double *samples, rate;
+	unsigned int n;
+	int error;
+
+	if (tc->op(arg, &expected)) {
+		json_string(json, "error", strerror(errno));
+		return -1;
+	}
+	samples = malloc(sizeof(*samples) * bench_options.repeat);
+	if (!samples) {
+		json_string(json, "error", strerror(errno));
+		return -1;
+	}
+	for (n = 0; n < bench_options.repeat; n++) {
+		samples[n] = run_threads_once(tc, arg, expected, n_threads,
+					      &error);
+		if (samples[n] < 0) {
+			json_string(json, "error", error > 0 ?
+				    strerror(error) :
+				    "result differs from single-threaded run");
+			free(samples);
+			return -1;
+		}
+	}
+	qsort(samples, bench_options.repeat, sizeof(*samples), compare_double);
+	rate = samples[bench_options.repeat / 2];
+	free(samples);
+
+	if (n_threads == 1)
+		*base = rate;
+	json_double(json, "ops_per_sec", rate);
+	json_double(json, "ops_per_sec_per_thread", rate / n_threads);
+	if (*base > 0)
+		json_double(json, "speedup", rate / *base);
+	return 0;
+}
+
+int run_threads(struct json_writer *json)
+{
+	static const unsigned int counts[] = { 8, 64 };
+	unsigned int max_threads = bench_options.threads;
+	int status = 0, k, i;
+
+	if (!max_threads) {
+		long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+		max_threads = n > 0 ? n : 1;
+	}
+	json_uint(json, "max_threads", max_threads);
+	json_begin_array(json, "results");
+	for (k = 0; k < sizeof(counts) / sizeof(counts[0]); k++) {
+		unsigned int count = counts[k];
+		struct threads_arg arg = { };
+		uint64_t seed = bench_options.seed + count;
+		struct richacl *acl;
+		char *text;
+
+		if (count > bench_options.max_aces)
+			continue;
+		acl = corpus_generate(CORPUS_REALISTIC, count, &seed);
+		if (!acl)
+			return -1;
+		text = richacl_to_text(acl, RICHACL_TEXT_SHOW_MASKS |
+					    RICHACL_TEXT_NUMERIC_IDS);
+		if (!text) {
+			richacl_free(acl);
+			return -1;
+		}
+		arg.acl = acl;
+		arg.text = text;
+		arg.st.st_mode = S_IFREG | 0644;
+		arg.st.st_uid = BENCH_UID + 1;
+		arg.st.st_gid = BENCH_GID + 1;
+
+		for (i = 0; i < sizeof(threads_cases) /
+				sizeof(threads_cases[0]); i++) {
+			struct threads_case *tc = threads_cases + i;
+			unsigned int n_threads;
+			double base = 0;
+
+			for (n_threads = 1; ; n_threads *= 2) {
+				char name[128];
+
+				if (n_threads > max_threads)
+					n_threads = max_threads;
+				snprintf(name, sizeof(name), "%s/%s/%u/%u",
+					 tc->function,
+					 corpus_name(CORPUS_REALISTIC), count,
+					 n_threads);
+				if (!bench_options.filter ||
+				    strstr(name, bench_options.filter)) {
+					fprintf(stderr, "%s\n", name);
+					json_begin_object(json, NULL);
+					json_string(json, "name", name);
+					json_string(json, "function",
+						    tc->function);
+					json_uint(json, "aces", count);
+					json_uint(json, "threads", n_threads);
+					if (measure_threads(tc, &arg,
+							    n_threads, &base,
+							    json))
+						status = -1;
+					json_end_object(json);
+				}
+				if (n_threads == max_threads)
+					break;
+			}
+		}
+		free(text);
+		richacl_free(acl);
+	}
+	json_end_array(json);
+	return status;
+}
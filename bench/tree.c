@@ -0,0 +1,622 @@
+/*
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; either version 2, or (at your option) any
+  later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along
+  with this library; if not, write to the Free Software Foundation, Inc.,
+  59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+/*
+ * Tree-scale benchmarks: generate a synthetic directory tree, and time
+ * Automatic Inheritance propagation with the same auto_inherit() walker
+ * that richacl uses, recursive acl retrieval, and recursive access
+ * checks.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+
+#include "richacl.h"
+#include "auto_inherit.h"
+#include "bench.h"
+
+#define BENCH_UID 999999
+#define BENCH_GID 999999
+
+struct tree_options tree_options = {
+	.fanout = 4,
+	.depth = 4,
+	.files = 16,
+	.aces = 8,
+	.explicit_percent = 10,
+	.protected_percent = 1,
+	.keep = 0,
+};
+
+struct tree_stats {
+	unsigned long dirs, files;
+};
+
+static uint64_t seed;
+
+static int one_in_hundred(unsigned int percent)
+{
+	seed ^= seed >> 12;
+	seed ^= seed << 25;
+	seed ^= seed >> 27;
+	return (seed * 2685821657736338717ULL) % 100 < percent;
+}
+
+/*
+ * Compute the acl of a new file the way the kernel would on create, and
+ * randomly add an explicit entry or mark the acl protected.
+ */
+static struct richacl *new_file_acl(const struct richacl *parent, int isdir,
+				    unsigned long n)
+{
+	struct richacl *acl, *acl2;
+
+	acl = richacl_inherit(parent, isdir);
+	if (!acl)
+		acl = richacl_alloc(0);
+	if (!acl)
+		return NULL;
+	if (one_in_hundred(tree_options.explicit_percent)) {
+		acl2 = richacl_alloc(acl->a_count + 1);
+		if (!acl2)
+			goto fail;
+		acl2->a_flags = acl->a_flags;
+		acl2->a_entries[0].e_type = ACE4_ACCESS_ALLOWED_ACE_TYPE;
+		acl2->a_entries[0].e_mask = ACE4_READ_DATA | ACE4_EXECUTE;
+		richace_set_uid(acl2->a_entries, 20000 + n % 1000);
+		memcpy(acl2->a_entries + 1, acl->a_entries,
+		       acl->a_count * sizeof(struct richace));
+		richacl_free(acl);
+		acl = acl2;
+	}
+	if (one_in_hundred(tree_options.protected_percent))
+		acl->a_flags |= ACL4_PROTECTED;
+	richacl_compute_max_masks(acl);
+	return acl;
+
+fail:
+	richacl_free(acl);
+	return NULL;
+}
+
+static int generate(const char *dirname, const struct richacl *dir_acl,
+		    unsigned int level, struct tree_stats *stats)
+{
+	size_t len = strlen(dirname);
+	char *path;
+	unsigned int n;
+	int ret = -1;
+
+	path = malloc(len + 32);
+	if (!path)
+		return -1;
+	for (n = 0; n < tree_options.files; n++) {
+		struct richacl *acl;
+		int fd;
+
+		sprintf(path, "%s/f%u", dirname, n);
+		fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0644);
+		if (fd < 0)
+			goto out;
+		close(fd);
+		acl = new_file_acl(dir_acl, 0, stats->files);
+		if (!acl)
+			goto out;
+		if (richacl_set_file(path, acl)) {
+			richacl_free(acl);
+			goto out;
+		}
+		richacl_free(acl);
+		stats->files++;
+	}
+	if (level == tree_options.depth)
+		goto done;
+	for (n = 0; n < tree_options.fanout; n++) {
+		struct richacl *acl;
+
+		sprintf(path, "%s/d%u", dirname, n);
+		if (mkdir(path, 0755))
+			goto out;
+		acl = new_file_acl(dir_acl, 1, stats->dirs);
+		if (!acl)
+			goto out;
+		stats->dirs++;
+		if (richacl_set_file(path, acl) ||
+		    generate(path, acl, level + 1, stats)) {
+			richacl_free(acl);
+			goto out;
+		}
+		richacl_free(acl);
+	}
+done:
+	ret = 0;
+out:
+	if (ret)
+		perror(path);
+	free(path);
+	return ret;
+}
+
+/*
+ * Call @fn for each file and directory in @dirname.  Recursing into
+ * subdirectories is up to @fn.
+ */
+static int walk(const char *dirname,
+		int (*fn)(const char *, const struct stat *, void *),
+		void *arg)
+{
+	struct dirent *dirent;
+	char *path = NULL;
+	size_t len = strlen(dirname);
+	int ret = -1;
+	DIR *dir;
+
+	dir = opendir(dirname);
+	if (!dir)
+		return -1;
+	while ((errno = 0, dirent = readdir(dir))) {
+		struct stat st;
+		char *p;
+
+		if (!strcmp(dirent->d_name, ".") ||
+		    !strcmp(dirent->d_name, ".."))
+			continue;
+		p = realloc(path, len + strlen(dirent->d_name) + 2);
+		if (!p)
+			goto out;
+		path = p;
+		sprintf(path, "%s/%s", dirname, dirent->d_name);
+		if (lstat(path, &st) || fn(path, &st, arg))
+			goto out;
+	}
+	if (!errno)
+		ret = 0;
+out:
+	free(path);
+	closedir(dir);
+	return ret;
+}
+
+static int count(const struct stat *st, struct tree_stats *stats)
+{
+	if (S_ISDIR(st->st_mode)) {
+		stats->dirs++;
+		return 1;
+	}
+	stats->files++;
+	return 0;
+}
+
+static int remove_one(const char *path, const struct stat *st, void *arg)
+{
+	if (count(st, arg))
+		return walk(path, remove_one, arg) || rmdir(path);
+	return unlink(path);
+}
+
+static int get_one(const char *path, const struct stat *st, void *arg)
+{
+	struct richacl *acl;
+
+	acl = richacl_get_file(path);
+	if (!acl && errno != ENODATA)
+		return -1;
+	richacl_free(acl);
+	if (count(st, arg))
+		return walk(path, get_one, arg);
+	return 0;
+}
+
+struct batch_arg {
+	struct tree_stats stats;
+	struct richacl_batch *batch;
+};
+
+static unsigned long batch_errors;
+
+static void batch_get_done(void *arg, struct richacl *acl, int error)
+{
+	char *path = arg;
+
+	if (!acl && error != ENODATA) {
+		errno = error;
+		perror(path);
+		batch_errors++;
+	}
+	richacl_free(acl);
+	free(path);
+}
+
+static int batch_get_one(const char *path, const struct stat *st, void *arg)
+{
+	struct batch_arg *ba = arg;
+	char *p;
+
+	p = strdup(path);
+	if (!p)
+		return -1;
+	if (richacl_batch_get_file(ba->batch, p, batch_get_done, p)) {
+		free(p);
+		return -1;
+	}
+	if (count(st, &ba->stats))
+		return walk(path, batch_get_one, arg);
+	return 0;
+}
+
+/* Operations in flight in the asynchronous retrieval phase */
+#define ASYNC_DEPTH 64
+
+struct async_arg {
+	struct tree_stats stats;
+	struct richacl_async *async;
+	unsigned long inflight, errors;
+};
+
+/* Collect completions; with @wait, wait until there are some. */
+static void async_reap(struct async_arg *aa, int wait)
+{
+	struct richacl_completion completions[ASYNC_DEPTH];
+	unsigned int n, i;
+
+	if (wait) {
+		struct pollfd pfd = {
+			.fd = richacl_async_fd(aa->async),
+			.events = POLLIN,
+		};
+
+		poll(&pfd, 1, -1);
+	}
+	n = richacl_async_complete(aa->async, completions, ASYNC_DEPTH);
+	for (i = 0; i < n; i++) {
+		struct richacl_completion *c = completions + i;
+
+		if (!c->acl && c->error != ENODATA) {
+			errno = c->error;
+			perror(c->arg);
+			aa->errors++;
+		}
+		richacl_free(c->acl);
+		free(c->arg);
+	}
+	aa->inflight -= n;
+}
+
+static int async_get_one(const char *path, const struct stat *st, void *arg)
+{
+	struct async_arg *aa = arg;
+	char *p;
+
+	while (aa->inflight >= ASYNC_DEPTH)
+		async_reap(aa, 1);
+	p = strdup(path);
+	if (!p)
+		return -1;
+	if (richacl_async_get_file(aa->async, p, p)) {
+		free(p);
+		return -1;
+	}
+	aa->inflight++;
+	if (count(st, &aa->stats))
+		return walk(path, async_get_one, arg);
+	return 0;
+}
+
+static int access_one(const char *path, const struct stat *st, void *arg)
+{
+	gid_t groups[] = { BENCH_GID };
+
+	if (richacl_access(path, st, BENCH_UID, groups, 1) < 0)
+		return -1;
+	if (count(st, arg))
+		return walk(path, access_one, arg);
+	return 0;
+}
+
+/*
+ * Check that propagation has reached a fixpoint: no acl that takes part in
+ * Automatic Inheritance may change when its parent acl is propagated to it
+ * once more.  These are the semantics test/auto-inheritance.test checks on
+ * a small scale.
+ */
+struct verify_arg {
+	struct tree_stats stats;
+	const struct richacl *dir_acl;
+	unsigned long mismatches;
+};
+
+static int verify_one(const char *path, const struct stat *st, void *arg)
+{
+	struct verify_arg *va = arg;
+	struct richacl *acl, *inheritable, *expected = NULL;
+	int isdir = S_ISDIR(st->st_mode), ret = 0;
+
+	acl = richacl_get_file(path);
+	if (!acl)
+		return -1;
+	if (richacl_is_auto_inherit(acl) &&
+	    !(acl->a_flags & ACL4_PROTECTED)) {
+		inheritable = richacl_inherit(va->dir_acl, isdir);
+		if (!inheritable)
+			inheritable = richacl_alloc(0);
+		if (inheritable)
+			expected = richacl_auto_inherit(acl, inheritable);
+		richacl_free(inheritable);
+		if (!expected || richacl_compare(acl, expected)) {
+			fprintf(stderr, "%s: acl not propagated\n", path);
+			va->mismatches++;
+		}
+		richacl_free(expected);
+	}
+	if (count(st, &va->stats)) {
+		const struct richacl *parent = va->dir_acl;
+
+		va->dir_acl = acl;
+		ret = walk(path, verify_one, va);
+		va->dir_acl = parent;
+	}
+	richacl_free(acl);
+	return ret;
+}
+
+static long peak_rss_kb(void)
+{
+	struct rusage ru;
+
+	if (getrusage(RUSAGE_SELF, &ru))
+		return -1;
+	return ru.ru_maxrss;
+}
+
+static void report_phase(struct json_writer *json, const char *phase,
+			 uint64_t elapsed, const struct tree_stats *stats)
+{
+	unsigned long total = stats->files + stats->dirs;
+	struct richacl_stats rs;
+	double seconds = elapsed / 1e9;
+
+	richacl_stats_get(&rs);
+	json_begin_object(json, NULL);
+	json_string(json, "phase", phase);
+	json_uint(json, "files", stats->files);
+	json_uint(json, "dirs", stats->dirs);
+	json_double(json, "milliseconds", elapsed / 1e6);
+	json_double(json, "files_per_second", seconds ? total / seconds : 0);
+	json_double(json, "xattr_gets_per_file",
+		    total ? (double)rs.xattr_gets / total : 0);
+	json_double(json, "xattr_sets_per_file",
+		    total ? (double)rs.xattr_sets / total : 0);
+	json_uint(json, "peak_rss_kb", peak_rss_kb());
+	json_end_object(json);
+}
+
+static void reset_counters(struct tree_stats *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+	richacl_stats_reset();
+}
+
+int run_tree(struct json_writer *json)
+{
+	struct richacl *root_acl = NULL, *acl2 = NULL;
+	struct tree_stats stats = { }, total;
+	struct verify_arg va;
+	struct batch_arg ba;
+	struct async_arg aa;
+	char *root = NULL;
+	uint64_t start;
+	int status = -1;
+
+	seed = bench_options.seed;
+	richacl_stats_enable(1);
+
+	json_uint(json, "fanout", tree_options.fanout);
+	json_uint(json, "depth", tree_options.depth);
+	json_uint(json, "files_per_dir", tree_options.files);
+	json_uint(json, "root_aces", tree_options.aces);
+	json_uint(json, "explicit_percent", tree_options.explicit_percent);
+	json_uint(json, "protected_percent", tree_options.protected_percent);
+	json_begin_array(json, "results");
+
+	if (asprintf(&root, "%s/richacl-tree.XXXXXX", bench_options.tmpdir) < 0) {
+		root = NULL;
+		goto out;
+	}
+	if (!mkdtemp(root)) {
+		perror(bench_options.tmpdir);
+		free(root);
+		root = NULL;
+		goto out;
+	}
+	root_acl = corpus_generate(CORPUS_REALISTIC, tree_options.aces, &seed);
+	if (!root_acl)
+		goto fail;
+	if (richacl_set_file(root, root_acl))
+		goto fail;
+
+	fprintf(stderr, "generating %s\n", root);
+	reset_counters(&stats);
+	start = bench_now();
+	if (generate(root, root_acl, 1, &stats))
+		goto out;
+	report_phase(json, "generate", bench_now() - start, &stats);
+	total = stats;
+
+	/*
+	 * Add an inheritable entry at the front of the root acl and
+	 * propagate it to the entire tree.
+	 */
+	acl2 = richacl_alloc(root_acl->a_count + 1);
+	if (!acl2)
+		goto fail;
+	memcpy(acl2, root_acl, sizeof(struct richacl));
+	acl2->a_count = root_acl->a_count + 1;
+	acl2->a_entries[0].e_type = ACE4_ACCESS_DENIED_ACE_TYPE;
+	acl2->a_entries[0].e_flags = ACE4_FILE_INHERIT_ACE |
+				     ACE4_DIRECTORY_INHERIT_ACE;
+	acl2->a_entries[0].e_mask = ACE4_WRITE_DATA | ACE4_APPEND_DATA;
+	richace_set_uid(acl2->a_entries, BENCH_UID);
+	memcpy(acl2->a_entries + 1, root_acl->a_entries,
+	       root_acl->a_count * sizeof(struct richace));
+	richacl_compute_max_masks(acl2);
+	if (richacl_set_file(root, acl2))
+		goto fail;
+
+	fprintf(stderr, "propagating\n");
+	reset_counters(&stats);
+	start = bench_now();
+	if (auto_inherit(root, acl2))
+		goto out;
+	stats.files = total.files;
+	stats.dirs = total.dirs;
+	report_phase(json, "propagate", bench_now() - start, &stats);
+
+	fprintf(stderr, "propagating again (no changes)\n");
+	reset_counters(&stats);
+	start = bench_now();
+	if (auto_inherit(root, acl2))
+		goto out;
+	stats.files = total.files;
+	stats.dirs = total.dirs;
+	report_phase(json, "propagate-unchanged", bench_now() - start, &stats);
+
+	/*
+	 * Force a full repropagation which records the fingerprints, and
+	 * then repeat it: this time, the fingerprints prune the entire tree.
+	 * Fingerprints are only kept with the xattr and user backends; with
+	 * the emulated backend, both runs do the same work.
+	 */
+	opt_repropagate = 1;
+	opt_incremental = 1;
+	fprintf(stderr, "repropagating\n");
+	reset_counters(&stats);
+	start = bench_now();
+	if (auto_inherit(root, acl2))
+		goto out;
+	stats.files = total.files;
+	stats.dirs = total.dirs;
+	report_phase(json, "repropagate", bench_now() - start, &stats);
+
+	fprintf(stderr, "repropagating incrementally\n");
+	reset_counters(&stats);
+	start = bench_now();
+	if (auto_inherit(root, acl2))
+		goto out;
+	stats.files = total.files;
+	stats.dirs = total.dirs;
+	report_phase(json, "repropagate-incremental", bench_now() - start,
+		     &stats);
+	opt_repropagate = 0;
+	opt_incremental = 0;
+
+	fprintf(stderr, "reading all acls\n");
+	reset_counters(&stats);
+	start = bench_now();
+	if (walk(root, get_one, &stats))
+		goto fail;
+	report_phase(json, "get", bench_now() - start, &stats);
+
+	fprintf(stderr, "reading all acls in batches\n");
+	memset(&ba, 0, sizeof(ba));
+	ba.batch = richacl_batch_alloc(64);
+	if (!ba.batch)
+		goto fail;
+	json_begin_object(json, NULL);
+	json_string(json, "phase", "batch");
+	json_string(json, "batch", richacl_batch_is_async(ba.batch) ?
+				   "io_uring" : "synchronous");
+	json_end_object(json);
+	reset_counters(&ba.stats);
+	batch_errors = 0;
+	start = bench_now();
+	if (walk(root, batch_get_one, &ba) ||
+	    richacl_batch_wait(ba.batch) ||
+	    batch_errors) {
+		richacl_batch_free(ba.batch);
+		goto fail;
+	}
+	report_phase(json, "get-batched", bench_now() - start, &ba.stats);
+	richacl_batch_free(ba.batch);
+
+	/*
+	 * The worker threads count their own xattr operations, so the
+	 * counts of this phase are zero.
+	 */
+	fprintf(stderr, "reading all acls asynchronously\n");
+	memset(&aa, 0, sizeof(aa));
+	aa.async = richacl_async_alloc(0);
+	if (!aa.async)
+		goto fail;
+	reset_counters(&aa.stats);
+	start = bench_now();
+	status = walk(root, async_get_one, &aa);
+	while (aa.inflight)
+		async_reap(&aa, 1);
+	richacl_async_free(aa.async);
+	if (status || aa.errors) {
+		status = -1;
+		goto fail;
+	}
+	status = -1;
+	report_phase(json, "get-async", bench_now() - start, &aa.stats);
+
+	fprintf(stderr, "checking access\n");
+	reset_counters(&stats);
+	start = bench_now();
+	if (walk(root, access_one, &stats))
+		goto fail;
+	report_phase(json, "access", bench_now() - start, &stats);
+
+	fprintf(stderr, "verifying\n");
+	memset(&va, 0, sizeof(va));
+	va.dir_acl = acl2;
+	if (walk(root, verify_one, &va))
+		goto fail;
+	if (va.mismatches) {
+		fprintf(stderr, "%lu acls not propagated correctly\n",
+			va.mismatches);
+		goto out;
+	}
+	status = 0;
+	goto out;
+
+fail:
+	perror(root);
+out:
+	json_end_array(json);
+	if (status == 0)
+		json_string(json, "verified", "ok");
+	else
+		json_string(json, "verified", "failed");
+	if (root && !tree_options.keep) {
+		if (walk(root, remove_one, &stats) || rmdir(root))
+			perror(root);
+	} else if (root)
+		fprintf(stderr, "keeping %s\n", root);
+	richacl_free(acl2);
+	richacl_free(root_acl);
+	free(root);
+	richacl_stats_enable(0);
+	return status;
+}
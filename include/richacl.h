@@ -21,8 +21,20 @@
 #define __RICHACL_H
 
 #include <sys/types.h>
+#include <stdio.h>
+#include <stdint.h>
 #include <string.h>
 
+/*
+ * All functions can be called from several threads at the same time as
+ * long as each thread passes its own acls, batches, clients, and buffers;
+ * acls which are only read can be shared.  richacl_set_backend(),
+ * richacl_access_cache(), and richacl_stats_enable() change settings of
+ * the whole process and take effect for later calls in all threads.
+ * richacl_shared_cache_open() and richacl_shared_cache_close() must not
+ * race with other library calls.
+ */
+
 /* a_flags values */
 #define ACL4_AUTO_INHERIT		0x01
 #define ACL4_PROTECTED			0x02
@@ -183,12 +195,97 @@ extern int richace_is_same_identifier(const struct richace *,
 				      const struct richace *);
 extern void richace_copy(struct richace *, const struct richace *);
 
+/*
+ * Storage backends: where richacl_get_file() & co. store acls in their
+ * xattr representation.  The get operations follow the getxattr(2)
+ * conventions: with a size of 0, they return the size of the value.
+ */
+struct richacl_backend {
+	const char *name;
+	ssize_t (*get_file)(const struct richacl_backend *, const char *,
+			    void *, size_t);
+	ssize_t (*get_fd)(const struct richacl_backend *, int, void *, size_t);
+	int (*set_file)(const struct richacl_backend *, const char *,
+			const void *, size_t);
+	int (*set_fd)(const struct richacl_backend *, int, const void *,
+		      size_t);
+	int (*remove_file)(const struct richacl_backend *, const char *);
+	int (*remove_fd)(const struct richacl_backend *, int);
+	void (*destroy)(struct richacl_backend *);
+	void *data;
+};
+
+extern const struct richacl_backend richacl_xattr_backend;
+extern const struct richacl_backend richacl_user_xattr_backend;
+extern struct richacl_backend *richacl_emulated_backend(unsigned long);
+extern struct richacl_backend *richacl_backend_by_name(const char *);
+extern void richacl_free_backend(struct richacl_backend *);
+extern void richacl_set_backend(const struct richacl_backend *);
+extern const struct richacl_backend *richacl_get_backend(void);
+
 extern struct richacl *richacl_get_file(const char *);
 extern struct richacl *richacl_get_fd(int);
 extern int richacl_set_file(const char *, const struct richacl *);
 extern int richacl_set_fd(int, const struct richacl *);
+extern int richacl_remove_file(const char *);
+extern int richacl_remove_fd(int);
+
+/*
+ * Batches: queue many acl operations, which may be carried out
+ * concurrently and complete in any order.
+ */
+struct richacl_batch;
+
+extern struct richacl_batch *richacl_batch_alloc(unsigned int);
+extern void richacl_batch_free(struct richacl_batch *);
+extern int richacl_batch_is_async(const struct richacl_batch *);
+extern int richacl_batch_get_file(struct richacl_batch *, const char *,
+				  void (*)(void *, struct richacl *, int),
+				  void *);
+extern int richacl_batch_set_file(struct richacl_batch *, const char *,
+				  const struct richacl *,
+				  void (*)(void *, struct richacl *, int),
+				  void *);
+extern int richacl_batch_wait(struct richacl_batch *);
+
+/*
+ * Asynchronous operations: carried out by worker threads.  The file
+ * descriptor returned by richacl_async_fd() becomes readable when
+ * completions can be collected with richacl_async_complete().
+ */
+struct richacl_async;
+struct stat;
+
+struct richacl_completion {
+	void *arg;		/* as passed when submitting */
+	int error;		/* 0, or an error number */
+	struct richacl *acl;	/* richacl_async_get_file() */
+	int mask;		/* richacl_async_access() */
+};
+
+extern struct richacl_async *richacl_async_alloc(unsigned int);
+extern void richacl_async_free(struct richacl_async *);
+extern int richacl_async_fd(const struct richacl_async *);
+extern int richacl_async_get_file(struct richacl_async *, const char *,
+				  void *);
+extern int richacl_async_set_file(struct richacl_async *, const char *,
+				  const struct richacl *, void *);
+extern int richacl_async_access(struct richacl_async *, const char *,
+				const struct stat *, uid_t, const gid_t *,
+				int, void *);
+extern unsigned int richacl_async_complete(struct richacl_async *,
+					   struct richacl_completion *,
+					   unsigned int);
+
+extern struct richacl *richacl_from_xattr(const void *, size_t);
+extern size_t richacl_xattr_size(const struct richacl *);
+extern void richacl_to_xattr(const struct richacl *, void *);
 
 extern char *richacl_to_text(const struct richacl *, int);
+extern int richacl_write_text(const struct richacl *, int,
+			      int (*)(void *, const char *, size_t), void *);
+extern int richacl_fprint_text(const struct richacl *, int, FILE *);
+extern int richacl_dprint_text(const struct richacl *, int, int);
 extern struct richacl *richacl_from_text(const char *, int *,
 					 void (*)(const char *, ...));
 
@@ -197,19 +294,92 @@ extern struct richacl *richacl_clone(const struct richacl *);
 extern void richacl_free(struct richacl *);
 
 extern int richacl_apply_masks(struct richacl **);
+extern int richacl_modify(struct richacl **, const struct richacl *, int);
+extern void richacl_compute_masks(struct richacl *, int);
+extern int richacl_simplify(struct richacl *);
+extern int richacl_canonicalize(struct richacl *);
+extern uint64_t richacl_hash(const struct richacl *);
 extern void richacl_compute_max_masks(struct richacl *);
 extern struct richacl *richacl_from_mode(mode_t);
 extern int richacl_masks_to_mode(const struct richacl *);
 extern struct richacl *richacl_inherit(const struct richacl *, int isdir);
+extern size_t richacl_inherit_size(const struct richacl *);
+extern void richacl_inherit_into(const struct richacl *, void *,
+				 struct richacl **, struct richacl **);
+extern int richacl_inherit_both(const struct richacl *, struct richacl **,
+				struct richacl **);
 extern int richacl_equiv_mode(const struct richacl *, mode_t *);
 extern int richacl_compare(const struct richacl *, const struct richacl *);
 
+/* A user and the groups it is in, for richacl_permissions() */
+struct richacl_principal {
+	uid_t		user;
+	const gid_t	*groups;
+	int		n_groups;
+};
+
 struct stat;
 extern int richacl_access(const char *, const struct stat *, uid_t,
 			  const gid_t *, int);
+extern int richacl_permission(const struct richacl *, const struct stat *,
+			      uid_t, const gid_t *, int);
+extern int richacl_permissions(const struct richacl *, const struct stat *,
+			       const struct richacl_principal *, unsigned int,
+			       unsigned int *);
+extern int richacl_access_cache(size_t);
+extern int richacl_shared_cache_open(const char *, size_t);
+extern void richacl_shared_cache_close(void);
 extern char *richacl_mask_to_text(unsigned int, int);
+extern int richacl_write_mask_text(unsigned int, int,
+				   int (*)(void *, const char *, size_t),
+				   void *);
+extern int richacl_fprint_mask_text(unsigned int, int, FILE *);
+extern int richacl_dprint_mask_text(unsigned int, int, int);
 
 extern struct richacl *richacl_auto_inherit(const struct richacl *,
 					    const struct richacl *);
 
+/*
+ * Clients of the richacld acl evaluation daemon.  The daemon caches
+ * decoded acls, group memberships, and access decisions for all of its
+ * clients.
+ */
+struct richacl_client;
+
+extern struct richacl_client *richacl_client_open(const char *);
+extern void richacl_client_close(struct richacl_client *);
+extern struct richacl *richacl_client_get_file(struct richacl_client *,
+					       const char *);
+extern int richacl_client_access(struct richacl_client *, const char *, uid_t,
+				 const gid_t *, int);
+extern struct richacl *richacl_client_inherit(struct richacl_client *,
+					      const char *, int);
+
+/*
+ * Performance counters.  Counting is off by default; once enabled, each
+ * thread counts the library calls it makes.
+ */
+struct richacl_stats {
+	unsigned long long xattr_gets;		/* backend get operations */
+	unsigned long long xattr_sets;		/* backend set operations */
+	unsigned long long xattr_removes;	/* backend remove operations */
+	unsigned long long xattr_bytes_read;
+	unsigned long long xattr_bytes_written;
+	unsigned long long decodes;		/* richacl_from_xattr() */
+	unsigned long long encodes;		/* richacl_to_xattr() */
+	unsigned long long access_checks;	/* richacl_access() */
+	unsigned long long aces_scanned;	/* ... entries looked at */
+	unsigned long long max_masks;		/* richacl_compute_max_masks() */
+	unsigned long long entry_reallocs;	/* growing acls in place */
+	unsigned long long id_lookups;		/* user and group database */
+	unsigned long long access_cache_hits;	/* see richacl_access_cache() */
+	unsigned long long access_cache_misses;
+	unsigned long long shared_cache_hits;	/* see richacl_shared_cache_open() */
+	unsigned long long shared_cache_misses;
+};
+
+extern int richacl_stats_enable(int);
+extern void richacl_stats_get(struct richacl_stats *);
+extern void richacl_stats_reset(void);
+
 #endif  /* __RICHACL_H */
@@ -0,0 +1,68 @@
+/*
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+#ifndef __RICHACL_PROBES_H
+#define __RICHACL_PROBES_H
+
+/*
+ * Static tracepoints, enabled with "configure --enable-sdt".  Without
+ * that, the probes compile to nothing and their arguments are not
+ * evaluated.
+ *
+ * Provider librichacl:
+ *   get__start(path)			richacl_get_file() called
+ *   get__done(path, size)		... returned; size is -1 on error
+ *   get__fd__start(fd)			richacl_get_fd() called
+ *   get__fd__done(fd, size)
+ *   set__start(path, size)		richacl_set_file() called
+ *   set__done(path, result)		... returned 0 or -1
+ *   set__fd__start(fd, size)		richacl_set_fd() called
+ *   set__fd__done(fd, result)
+ *   access(path, uid, mask, scanned)	richacl_access() granted mask
+ *					after looking at scanned entries
+ *   apply__masks(before, after)	number of entries before and after
+ *					richacl_apply_masks()
+ *
+ * Provider richacl:
+ *   auto__inherit__file(path, changed)	the Automatic Inheritance walker
+ *					visited path, and changed its acl
+ *
+ * Latencies are the time between the start and done probes, e.g.
+ *
+ *   bpftrace -e 'usdt:librichacl.so:get__start { @s[tid] = nsecs; }
+ *		  usdt:librichacl.so:get__done /@s[tid]/ {
+ *			@ns = hist(nsecs - @s[tid]); delete(@s[tid]); }'
+ */
+
+#ifdef ENABLE_SDT
+# include <sys/sdt.h>
+# define RICHACL_PROBE1(provider, name, a1) \
+	DTRACE_PROBE1(provider, name, a1)
+# define RICHACL_PROBE2(provider, name, a1, a2) \
+	DTRACE_PROBE2(provider, name, a1, a2)
+# define RICHACL_PROBE4(provider, name, a1, a2, a3, a4) \
+	DTRACE_PROBE4(provider, name, a1, a2, a3, a4)
+#else
+# define RICHACL_PROBE1(provider, name, a1) \
+	do { if (0) { (void)(a1); } } while (0)
+# define RICHACL_PROBE2(provider, name, a1, a2) \
+	do { if (0) { (void)(a1); (void)(a2); } } while (0)
+# define RICHACL_PROBE4(provider, name, a1, a2, a3, a4) \
+	do { if (0) { (void)(a1); (void)(a2); (void)(a3); (void)(a4); } } \
+	while (0)
+#endif
+
+#endif  /* __RICHACL_PROBES_H */
@@ -0,0 +1,68 @@
+/*
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+#ifndef __RICHACLD_H
+#define __RICHACLD_H
+
+#include <stdint.h>
+
+/*
+ * Protocol between the richacld acl evaluation daemon and
+ * richacl_client_*().  The daemon only serves local clients over a
+ * UNIX domain stream socket, so all fields are in host byte order.
+ *
+ * A client sends a request and waits for its reply; requests on the
+ * same connection are answered in order.  Paths are absolute, and are
+ * resolved with the credentials of the client.  Only regular files and
+ * directories are served (EINVAL).
+ */
+
+#define RICHACLD_SOCKET		"/var/run/richacld.socket"
+
+enum {
+	RICHACLD_GET = 1,	/* the acl of r_path */
+	RICHACLD_ACCESS,	/* the permissions of r_uid for r_path; only
+				   root can ask for other users (EPERM) */
+	RICHACLD_INHERIT,	/* the acl inherited from directory r_path */
+};
+
+/* r_flags */
+#define RICHACLD_ISDIR		1	/* RICHACLD_INHERIT for a directory */
+
+struct richacld_request {
+	uint32_t	r_size;		/* of the entire request */
+	uint16_t	r_op;
+	uint16_t	r_flags;
+	uint32_t	r_uid;
+	int32_t		r_ngroups;	/* -1: the groups r_uid is in */
+	/* Followed by r_ngroups gids, and the null-terminated path. */
+};
+
+struct richacld_reply {
+	uint32_t	r_size;		/* of the entire reply */
+	int32_t		r_error;	/* errno value, or 0 */
+	uint32_t	r_mask;		/* RICHACLD_ACCESS */
+	uint32_t	r_pad;
+	/* Followed by the acl in xattr format for RICHACLD_GET and
+	   RICHACLD_INHERIT.  RICHACLD_INHERIT returns no acl when
+	   nothing is inherited. */
+};
+
+/* Larger requests are rejected. */
+#define RICHACLD_MAX_REQUEST	(sizeof(struct richacld_request) + \
+				 65536 * sizeof(uint32_t) + 4096)
+
+#endif  /* __RICHACLD_H */
@@ -22,14 +22,23 @@
 
 #include <sys/types.h>
 
-/* A resizeable string buffer */
+/*
+ * A resizeable string buffer, or a fixed-size buffer which is passed to a
+ * flush function whenever it is full.
+ */
 struct string_buffer {
 	char *buffer;
 	size_t offset;
 	size_t size;
+	int (*flush)(void *, const char *, size_t);
+	void *flush_arg;
 };
 
 extern struct string_buffer *alloc_string_buffer(size_t size);
+extern void init_flushing_buffer(struct string_buffer *, char *, size_t,
+				 int (*)(void *, const char *, size_t),
+				 void *);
+extern int flush_string_buffer(struct string_buffer *);
 extern void reset_string_buffer(struct string_buffer *);
 extern void free_string_buffer(struct string_buffer *);
 extern char *buffer_sprintf(struct string_buffer *, const char *, ...)
@@ -85,6 +85,36 @@ richace_clear_inheritance_flags(struct richace *ace)
 			  ACE4_INHERITED_ACE);
 }
 
+extern int richacl_stats_enabled;
+extern __thread struct richacl_stats richacl_thread_stats;
+
+/* Add @n to performance counter @field if counting is enabled. */
+#define richacl_stat_add(field, n) \
+	do { \
+		if (__atomic_load_n(&richacl_stats_enabled, __ATOMIC_RELAXED)) \
+			richacl_thread_stats.field += (n); \
+	} while (0)
+
+/*
+ * Files whose ctime is less than this many seconds old are not cached: a
+ * further change within the same timestamp granularity might leave the
+ * ctime unchanged.
+ */
+#define CACHE_RACY_SECONDS 1
+
+struct stat;
+extern int richacl_access_cache_usable(void);
+extern int richacl_access_cache_lookup(const struct stat *, uid_t,
+				       const gid_t *, int, unsigned int *);
+extern void richacl_access_cache_insert(const struct stat *, uid_t,
+					const gid_t *, int, unsigned int);
+extern int richacl_shared_cache_usable(const struct richacl_backend *);
+extern int richacl_shared_cache_lookup(const struct richacl_backend *,
+				       const struct stat *, struct richacl **);
+extern void richacl_shared_cache_insert(const struct richacl_backend *,
+					const struct stat *, const void *,
+					size_t);
+
 extern const char *richace_owner_who;
 extern const char *richace_group_who;
 extern const char *richace_everyone_who;
@@ -0,0 +1,256 @@
+/*
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+/*
+ * The access decision cache of richacl_access(): the permissions granted
+ * by file (device, inode, and ctime) and credentials (user and a hash of
+ * the groups), with least recently used entries evicted first.
+ *
+ * Setting an acl or changing the file mode, owner, or owning group
+ * changes the ctime, which invalidates all cached decisions for the file.
+ * Files whose ctime is less than CACHE_RACY_SECONDS old are not
+ * cached: a further change within the same timestamp granularity might
+ * not change the ctime.  Acls are only cached for the xattr backends; the
+ * emulated backend does not update the ctime.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "richacl.h"
+#include "richacl-internal.h"
+
+struct access_entry {
+	struct access_entry *hash_next;
+	struct access_entry *lru_prev, *lru_next;
+	dev_t dev;
+	ino_t ino;
+	struct timespec ctime;
+	uid_t user;
+	uint64_t groups_hash;
+	unsigned int mask;
+};
+
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct access_entry **cache_table;
+static size_t cache_table_size, cache_count, cache_max;
+static struct access_entry cache_lru = {
+	.lru_prev = &cache_lru,
+	.lru_next = &cache_lru,
+};
+
+static uint64_t hash_groups(const gid_t *groups, int n_groups)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	int n;
+
+	hash = (hash ^ n_groups) * 0x100000001b3ULL;
+	for (n = 0; n < n_groups; n++)
+		hash = (hash ^ groups[n]) * 0x100000001b3ULL;
+	return hash;
+}
+
+static size_t hash_entry(dev_t dev, ino_t ino, uid_t user,
+			 uint64_t groups_hash)
+{
+	uint64_t x = ino ^ ((uint64_t)dev << 32) ^ ((uint64_t)user << 16) ^
+		     groups_hash;
+
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdULL;
+	x ^= x >> 33;
+	return x & (cache_table_size - 1);
+}
+
+static void lru_unlink(struct access_entry *entry)
+{
+	entry->lru_prev->lru_next = entry->lru_next;
+	entry->lru_next->lru_prev = entry->lru_prev;
+}
+
+static void lru_add(struct access_entry *entry)
+{
+	entry->lru_next = cache_lru.lru_next;
+	entry->lru_prev = &cache_lru;
+	cache_lru.lru_next->lru_prev = entry;
+	cache_lru.lru_next = entry;
+}
+
+/* Called with cache_lock held. */
+static struct access_entry **
+cache_lookup(dev_t dev, ino_t ino, uid_t user, uint64_t groups_hash)
+{
+	struct access_entry **pos;
+
+	pos = &cache_table[hash_entry(dev, ino, user, groups_hash)];
+	while (*pos) {
+		struct access_entry *entry = *pos;
+
+		if (entry->dev == dev && entry->ino == ino &&
+		    entry->user == user && entry->groups_hash == groups_hash)
+			break;
+		pos = &entry->hash_next;
+	}
+	return pos;
+}
+
+/* Called with cache_lock held. */
+static void cache_remove(struct access_entry **pos)
+{
+	struct access_entry *entry = *pos;
+
+	*pos = entry->hash_next;
+	lru_unlink(entry);
+	free(entry);
+	cache_count--;
+}
+
+/*
+ * Should richacl_access() use the cache?  Checked without cache_lock;
+ * lookups and inserts check cache_table under the lock.
+ */
+int richacl_access_cache_usable(void)
+{
+	const struct richacl_backend *backend = richacl_get_backend();
+
+	return __atomic_load_n(&cache_max, __ATOMIC_RELAXED) &&
+	       (backend == &richacl_xattr_backend ||
+		backend == &richacl_user_xattr_backend);
+}
+
+/*
+ * Look up a cached decision.  Returns 1 and the permissions in @mask on
+ * a hit, and 0 otherwise.
+ */
+int richacl_access_cache_lookup(const struct stat *st, uid_t user,
+				const gid_t *groups, int n_groups,
+				unsigned int *mask)
+{
+	uint64_t groups_hash;
+	struct access_entry **pos;
+	int hit = 0;
+
+	if (!richacl_access_cache_usable())
+		return 0;
+	groups_hash = hash_groups(groups, n_groups);
+	pthread_mutex_lock(&cache_lock);
+	if (cache_table) {
+		pos = cache_lookup(st->st_dev, st->st_ino, user, groups_hash);
+		if (*pos) {
+			struct access_entry *entry = *pos;
+
+			if (entry->ctime.tv_sec == st->st_ctim.tv_sec &&
+			    entry->ctime.tv_nsec == st->st_ctim.tv_nsec) {
+				lru_unlink(entry);
+				lru_add(entry);
+				*mask = entry->mask;
+				hit = 1;
+			} else
+				cache_remove(pos);
+		}
+	}
+	pthread_mutex_unlock(&cache_lock);
+	if (hit)
+		richacl_stat_add(access_cache_hits, 1);
+	else
+		richacl_stat_add(access_cache_misses, 1);
+	return hit;
+}
+
+/*
+ * Remember a decision which richacl_access_cache_lookup() did not find.
+ * The acl must have been read from the file @st refers to.
+ */
+void richacl_access_cache_insert(const struct stat *st, uid_t user,
+				 const gid_t *groups, int n_groups,
+				 unsigned int mask)
+{
+	struct access_entry *entry, **pos;
+
+	if (!richacl_access_cache_usable() ||
+	    time(NULL) - st->st_ctim.tv_sec < CACHE_RACY_SECONDS)
+		return;
+	entry = malloc(sizeof(*entry));
+	if (!entry)
+		return;
+	entry->dev = st->st_dev;
+	entry->ino = st->st_ino;
+	entry->ctime = st->st_ctim;
+	entry->user = user;
+	entry->groups_hash = hash_groups(groups, n_groups);
+	entry->mask = mask;
+
+	pthread_mutex_lock(&cache_lock);
+	if (!cache_table) {
+		pthread_mutex_unlock(&cache_lock);
+		free(entry);
+		return;
+	}
+	pos = cache_lookup(st->st_dev, st->st_ino, user, entry->groups_hash);
+	if (*pos)
+		cache_remove(pos);
+	entry->hash_next = *pos;
+	*pos = entry;
+	lru_add(entry);
+	if (++cache_count > cache_max) {
+		struct access_entry *oldest = cache_lru.lru_prev;
+
+		cache_remove(cache_lookup(oldest->dev, oldest->ino,
+					  oldest->user, oldest->groups_hash));
+	}
+	pthread_mutex_unlock(&cache_lock);
+}
+
+/**
+ * richacl_access_cache  -  cache the decisions of richacl_access()
+ * @size:	maximum number of decisions to cache, or 0 to turn the cache off
+ *
+ * The cache is off by default.  Changing its size discards all cached
+ * decisions.  Cache hits and misses are counted in the access_cache_hits
+ * and access_cache_misses performance counters.
+ */
+int richacl_access_cache(size_t size)
+{
+	struct access_entry **table = NULL;
+	size_t table_size = 0;
+
+	if (size) {
+		for (table_size = 64; table_size < size; table_size *= 2)
+			;
+		table = calloc(table_size, sizeof(*table));
+		if (!table)
+			return -1;
+	}
+
+	pthread_mutex_lock(&cache_lock);
+	while (cache_lru.lru_next != &cache_lru) {
+		struct access_entry *entry = cache_lru.lru_next;
+
+		lru_unlink(entry);
+		free(entry);
+	}
+	free(cache_table);
+	cache_table = table;
+	cache_table_size = table_size;
+	cache_count = 0;
+	__atomic_store_n(&cache_max, size, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&cache_lock);
+	return 0;
+}
@@ -0,0 +1,388 @@
+/*
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/eventfd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include "richacl.h"
+
+/*
+ * Asynchronous acl operations for programs built around an event loop.
+ * Requests are carried out by a pool of worker threads, so that a slow
+ * file system stalls a worker instead of the caller.  Finished requests
+ * are put on a completion queue; an eventfd becomes readable when the
+ * queue is not empty.
+ */
+
+/* Default number of worker threads */
+#define ASYNC_THREADS 8
+
+enum async_opcode {
+	ASYNC_GET,
+	ASYNC_SET,
+	ASYNC_ACCESS,
+};
+
+struct async_req {
+	struct async_req *next;
+	enum async_opcode opcode;
+	const char *path;
+	const struct richacl *acl;	/* ASYNC_SET */
+	struct stat st;			/* ASYNC_ACCESS */
+	int have_st;
+	uid_t user;
+	const gid_t *groups;
+	int n_groups;
+	struct richacl_completion completion;
+};
+
+struct async_queue {
+	struct async_req *head, **tail;
+};
+
+struct richacl_async {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;		/* requests pending or stopping */
+	struct async_queue pending, done;
+	int stopping;
+	int event_fd;
+	unsigned int n_threads;
+	pthread_t *threads;
+};
+
+static void queue_init(struct async_queue *queue)
+{
+	queue->head = NULL;
+	queue->tail = &queue->head;
+}
+
+static void queue_append(struct async_queue *queue, struct async_req *req)
+{
+	req->next = NULL;
+	*queue->tail = req;
+	queue->tail = &req->next;
+}
+
+static struct async_req *queue_pop(struct async_queue *queue)
+{
+	struct async_req *req = queue->head;
+
+	if (req) {
+		queue->head = req->next;
+		if (!queue->head)
+			queue->tail = &queue->head;
+	}
+	return req;
+}
+
+static void signal_event(struct richacl_async *async)
+{
+	uint64_t one = 1;
+
+	while (write(async->event_fd, &one, sizeof(one)) < 0 &&
+	       errno == EINTR)
+		;
+}
+
+static void async_run(struct async_req *req)
+{
+	struct richacl_completion *c = &req->completion;
+
+	switch(req->opcode) {
+	case ASYNC_GET:
+		c->acl = richacl_get_file(req->path);
+		if (!c->acl)
+			c->error = errno;
+		break;
+
+	case ASYNC_SET:
+		if (richacl_set_file(req->path, req->acl))
+			c->error = errno;
+		break;
+
+	case ASYNC_ACCESS:
+		c->mask = richacl_access(req->path,
+					 req->have_st ? &req->st : NULL,
+					 req->user, req->groups, req->n_groups);
+		if (c->mask < 0)
+			c->error = errno;
+		break;
+	}
+}
+
+static void *async_worker(void *arg)
+{
+	struct richacl_async *async = arg;
+	struct async_req *req;
+
+	pthread_mutex_lock(&async->lock);
+	for (;;) {
+		req = queue_pop(&async->pending);
+		if (!req) {
+			if (async->stopping)
+				break;
+			pthread_cond_wait(&async->cond, &async->lock);
+			continue;
+		}
+		pthread_mutex_unlock(&async->lock);
+
+		async_run(req);
+
+		pthread_mutex_lock(&async->lock);
+		/* The eventfd is signalled while the queue is not empty. */
+		if (!async->done.head)
+			signal_event(async);
+		queue_append(&async->done, req);
+	}
+	pthread_mutex_unlock(&async->lock);
+	return NULL;
+}
+
+static void async_stop(struct richacl_async *async, unsigned int n_threads)
+{
+	unsigned int n;
+
+	pthread_mutex_lock(&async->lock);
+	async->stopping = 1;
+	pthread_cond_broadcast(&async->cond);
+	pthread_mutex_unlock(&async->lock);
+	for (n = 0; n < n_threads; n++)
+		pthread_join(async->threads[n], NULL);
+}
+
+/**
+ * richacl_async_alloc  -  create a queue for asynchronous acl operations
+ * @threads:	number of worker threads, or 0 for the default
+ *
+ * The operations use the backend selected at the time they are carried
+ * out; see richacl_set_backend().
+ */
+struct richacl_async *richacl_async_alloc(unsigned int threads)
+{
+	struct richacl_async *async;
+	unsigned int n;
+
+	if (!threads)
+		threads = ASYNC_THREADS;
+	async = calloc(1, sizeof(*async));
+	if (!async)
+		return NULL;
+	async->threads = calloc(threads, sizeof(*async->threads));
+	if (!async->threads)
+		goto fail;
+	async->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (async->event_fd < 0)
+		goto fail;
+	pthread_mutex_init(&async->lock, NULL);
+	pthread_cond_init(&async->cond, NULL);
+	queue_init(&async->pending);
+	queue_init(&async->done);
+
+	for (n = 0; n < threads; n++) {
+		int error;
+
+		error = pthread_create(&async->threads[n], NULL, async_worker,
+				       async);
+		if (error) {
+			async_stop(async, n);
+			pthread_cond_destroy(&async->cond);
+			pthread_mutex_destroy(&async->lock);
+			close(async->event_fd);
+			errno = error;
+			goto fail;
+		}
+	}
+	async->n_threads = threads;
+	return async;
+
+fail:
+	free(async->threads);
+	free(async);
+	return NULL;
+}
+
+/**
+ * richacl_async_free  -  free an asynchronous acl operation queue
+ *
+ * Waits for all submitted operations to finish.  The acls of completions
+ * which have not been collected are freed.
+ */
+void richacl_async_free(struct richacl_async *async)
+{
+	struct async_req *req;
+
+	if (!async)
+		return;
+	async_stop(async, async->n_threads);
+	while ((req = queue_pop(&async->done))) {
+		richacl_free(req->completion.acl);
+		free(req);
+	}
+	pthread_cond_destroy(&async->cond);
+	pthread_mutex_destroy(&async->lock);
+	close(async->event_fd);
+	free(async->threads);
+	free(async);
+}
+
+/**
+ * richacl_async_fd  -  file descriptor for waiting for completions
+ *
+ * The file descriptor is readable while completions are waiting to be
+ * collected with richacl_async_complete().  Do not read from it.
+ */
+int richacl_async_fd(const struct richacl_async *async)
+{
+	return async->event_fd;
+}
+
+static struct async_req *async_req_alloc(enum async_opcode opcode,
+					 const char *path, void *arg)
+{
+	struct async_req *req;
+
+	req = calloc(1, sizeof(*req));
+	if (req) {
+		req->opcode = opcode;
+		req->path = path;
+		req->completion.arg = arg;
+	}
+	return req;
+}
+
+static void async_submit(struct richacl_async *async, struct async_req *req)
+{
+	pthread_mutex_lock(&async->lock);
+	queue_append(&async->pending, req);
+	pthread_cond_signal(&async->cond);
+	pthread_mutex_unlock(&async->lock);
+}
+
+/**
+ * richacl_async_get_file  -  read the acl of a file asynchronously
+ * @path:	the file; must remain valid until the operation has completed
+ * @arg:	returned in the completion
+ *
+ * The completion contains the acl, or %NULL and an error number.
+ * Returns -1 if the operation could not be submitted.
+ */
+int richacl_async_get_file(struct richacl_async *async, const char *path,
+			   void *arg)
+{
+	struct async_req *req;
+
+	req = async_req_alloc(ASYNC_GET, path, arg);
+	if (!req)
+		return -1;
+	async_submit(async, req);
+	return 0;
+}
+
+/**
+ * richacl_async_set_file  -  set the acl of a file asynchronously
+ * @path:	the file
+ * @acl:	the acl
+ *
+ * @path and @acl must remain valid and @acl must not be modified until
+ * the operation has completed.  See richacl_async_get_file().
+ */
+int richacl_async_set_file(struct richacl_async *async, const char *path,
+			   const struct richacl *acl, void *arg)
+{
+	struct async_req *req;
+
+	req = async_req_alloc(ASYNC_SET, path, arg);
+	if (!req)
+		return -1;
+	req->acl = acl;
+	async_submit(async, req);
+	return 0;
+}
+
+/**
+ * richacl_async_access  -  check the permissions of a user asynchronously
+ * @st:		the status of the file, or %NULL; copied
+ * @groups:	must remain valid until the operation has completed
+ *
+ * Same as richacl_access().  The completion contains the permissions
+ * granted, or -1 and an error number.
+ */
+int richacl_async_access(struct richacl_async *async, const char *path,
+			 const struct stat *st, uid_t user,
+			 const gid_t *groups, int n_groups, void *arg)
+{
+	struct async_req *req;
+
+	req = async_req_alloc(ASYNC_ACCESS, path, arg);
+	if (!req)
+		return -1;
+	if (st) {
+		req->st = *st;
+		req->have_st = 1;
+	}
+	req->user = user;
+	req->groups = groups;
+	req->n_groups = n_groups;
+	async_submit(async, req);
+	return 0;
+}
+
+/**
+ * richacl_async_complete  -  collect completed operations
+ * @completions:	the completions are returned here
+ * @max:		size of @completions
+ *
+ * Returns the number of completions, which is 0 if none are waiting.  The
+ * caller takes over the acls in the completions.
+ */
+unsigned int richacl_async_complete(struct richacl_async *async,
+				    struct richacl_completion *completions,
+				    unsigned int max)
+{
+	struct async_req *reqs = NULL, **tail = &reqs, *req;
+	unsigned int n;
+	uint64_t count;
+
+	pthread_mutex_lock(&async->lock);
+	for (n = 0; n < max; n++) {
+		req = queue_pop(&async->done);
+		if (!req)
+			break;
+		*tail = req;
+		tail = &req->next;
+	}
+	*tail = NULL;
+	if (!async->done.head) {
+		/* Nothing left; reset the eventfd. */
+		while (read(async->event_fd, &count, sizeof(count)) < 0 &&
+		       errno == EINTR)
+			;
+	}
+	pthread_mutex_unlock(&async->lock);
+
+	for (n = 0; reqs; n++) {
+		req = reqs;
+		reqs = req->next;
+		completions[n] = req->completion;
+		free(req);
+	}
+	return n;
+}
@@ -0,0 +1,436 @@
+/*
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <attr/xattr.h>
+#include "richacl.h"
+#include "richacl_xattr.h"
+#include "richacl-internal.h"
+
+/*
+ * Extended attribute backends: the acl is stored in the named attribute
+ * of the file itself.
+ */
+
+static ssize_t xattr_get_file(const struct richacl_backend *backend,
+			      const char *path, void *value, size_t size)
+{
+	return getxattr(path, backend->data, value, size);
+}
+
+static ssize_t xattr_get_fd(const struct richacl_backend *backend,
+			    int fd, void *value, size_t size)
+{
+	return fgetxattr(fd, backend->data, value, size);
+}
+
+static int xattr_set_file(const struct richacl_backend *backend,
+			  const char *path, const void *value, size_t size)
+{
+	return setxattr(path, backend->data, value, size, 0);
+}
+
+static int xattr_set_fd(const struct richacl_backend *backend,
+			int fd, const void *value, size_t size)
+{
+	return fsetxattr(fd, backend->data, value, size, 0);
+}
+
+static int xattr_remove_file(const struct richacl_backend *backend,
+			     const char *path)
+{
+	return removexattr(path, backend->data);
+}
+
+static int xattr_remove_fd(const struct richacl_backend *backend, int fd)
+{
+	return fremovexattr(fd, backend->data);
+}
+
+const struct richacl_backend richacl_xattr_backend = {
+	.name = "xattr",
+	.get_file = xattr_get_file,
+	.get_fd = xattr_get_fd,
+	.set_file = xattr_set_file,
+	.set_fd = xattr_set_fd,
+	.remove_file = xattr_remove_file,
+	.remove_fd = xattr_remove_fd,
+	.data = (void *)SYSTEM_RICHACL,
+};
+
+/*
+ * Same as richacl_xattr_backend, but in the user namespace: this works on
+ * file systems without richacl support, but the kernel does not enforce
+ * the acls stored.
+ */
+const struct richacl_backend richacl_user_xattr_backend = {
+	.name = "user",
+	.get_file = xattr_get_file,
+	.get_fd = xattr_get_fd,
+	.set_file = xattr_set_file,
+	.set_fd = xattr_set_fd,
+	.remove_file = xattr_remove_file,
+	.remove_fd = xattr_remove_fd,
+	.data = (void *)USER_RICHACL,
+};
+
+/*
+ * The emulated backend keeps all acls in memory, indexed by device and
+ * inode number, so that the files themselves must exist but the file
+ * system does not need to support extended attributes.  Each operation
+ * can be delayed by a fixed latency to model network file systems.
+ */
+
+struct emulated_entry {
+	struct emulated_entry *next;
+	dev_t dev;
+	ino_t ino;
+	size_t size;
+	unsigned char value[0];
+};
+
+struct emulated_backend {
+	struct richacl_backend backend;
+	unsigned long latency_ns;
+	pthread_mutex_t lock;
+	struct emulated_entry **table;
+	size_t table_size;
+	size_t count;
+};
+
+static unsigned long emulated_hash(dev_t dev, ino_t ino)
+{
+	unsigned long long x = ino ^ ((unsigned long long)dev << 32);
+
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdULL;
+	x ^= x >> 33;
+	return x;
+}
+
+static void emulated_delay(struct emulated_backend *emu)
+{
+	struct timespec ts;
+
+	if (!emu->latency_ns)
+		return;
+	ts.tv_sec = emu->latency_ns / 1000000000;
+	ts.tv_nsec = emu->latency_ns % 1000000000;
+	while (nanosleep(&ts, &ts) && errno == EINTR)
+		;
+}
+
+/* Called with emu->lock held. */
+static struct emulated_entry **
+emulated_lookup(struct emulated_backend *emu, const struct stat *st)
+{
+	struct emulated_entry **pos;
+
+	pos = &emu->table[emulated_hash(st->st_dev, st->st_ino) &
+			  (emu->table_size - 1)];
+	while (*pos) {
+		if ((*pos)->dev == st->st_dev && (*pos)->ino == st->st_ino)
+			break;
+		pos = &(*pos)->next;
+	}
+	return pos;
+}
+
+/* Called with emu->lock held. */
+static int emulated_grow(struct emulated_backend *emu)
+{
+	size_t size = emu->table_size * 2, n;
+	struct emulated_entry **table;
+
+	table = calloc(size, sizeof(*table));
+	if (!table)
+		return -1;
+	for (n = 0; n < emu->table_size; n++) {
+		struct emulated_entry *entry = emu->table[n], *next;
+
+		for (; entry; entry = next) {
+			unsigned long h = emulated_hash(entry->dev, entry->ino);
+
+			next = entry->next;
+			entry->next = table[h & (size - 1)];
+			table[h & (size - 1)] = entry;
+		}
+	}
+	free(emu->table);
+	emu->table = table;
+	emu->table_size = size;
+	return 0;
+}
+
+static ssize_t emulated_get(const struct richacl_backend *backend,
+			    const struct stat *st, void *value, size_t size)
+{
+	struct emulated_backend *emu = backend->data;
+	struct emulated_entry *entry;
+	ssize_t ret;
+
+	emulated_delay(emu);
+	pthread_mutex_lock(&emu->lock);
+	entry = *emulated_lookup(emu, st);
+	if (!entry) {
+		errno = ENODATA;
+		ret = -1;
+	} else if (!size)
+		ret = entry->size;
+	else if (size < entry->size) {
+		errno = ERANGE;
+		ret = -1;
+	} else {
+		memcpy(value, entry->value, entry->size);
+		ret = entry->size;
+	}
+	pthread_mutex_unlock(&emu->lock);
+	return ret;
+}
+
+static int emulated_set(const struct richacl_backend *backend,
+			const struct stat *st, const void *value, size_t size)
+{
+	struct emulated_backend *emu = backend->data;
+	struct emulated_entry *entry, **pos;
+
+	entry = malloc(sizeof(*entry) + size);
+	if (!entry)
+		return -1;
+	entry->dev = st->st_dev;
+	entry->ino = st->st_ino;
+	entry->size = size;
+	memcpy(entry->value, value, size);
+
+	emulated_delay(emu);
+	pthread_mutex_lock(&emu->lock);
+	pos = emulated_lookup(emu, st);
+	if (*pos) {
+		entry->next = (*pos)->next;
+		free(*pos);
+		*pos = entry;
+	} else {
+		if (emu->count >= emu->table_size &&
+		    emulated_grow(emu) == 0)
+			pos = emulated_lookup(emu, st);
+		entry->next = NULL;
+		*pos = entry;
+		emu->count++;
+	}
+	pthread_mutex_unlock(&emu->lock);
+	return 0;
+}
+
+static int emulated_remove(const struct richacl_backend *backend,
+			   const struct stat *st)
+{
+	struct emulated_backend *emu = backend->data;
+	struct emulated_entry *entry, **pos;
+	int ret = 0;
+
+	emulated_delay(emu);
+	pthread_mutex_lock(&emu->lock);
+	pos = emulated_lookup(emu, st);
+	entry = *pos;
+	if (entry) {
+		*pos = entry->next;
+		free(entry);
+		emu->count--;
+	} else {
+		errno = ENODATA;
+		ret = -1;
+	}
+	pthread_mutex_unlock(&emu->lock);
+	return ret;
+}
+
+static ssize_t emulated_get_file(const struct richacl_backend *backend,
+				 const char *path, void *value, size_t size)
+{
+	struct stat st;
+
+	if (stat(path, &st))
+		return -1;
+	return emulated_get(backend, &st, value, size);
+}
+
+static ssize_t emulated_get_fd(const struct richacl_backend *backend,
+			       int fd, void *value, size_t size)
+{
+	struct stat st;
+
+	if (fstat(fd, &st))
+		return -1;
+	return emulated_get(backend, &st, value, size);
+}
+
+static int emulated_set_file(const struct richacl_backend *backend,
+			     const char *path, const void *value, size_t size)
+{
+	struct stat st;
+
+	if (stat(path, &st))
+		return -1;
+	return emulated_set(backend, &st, value, size);
+}
+
+static int emulated_set_fd(const struct richacl_backend *backend,
+			   int fd, const void *value, size_t size)
+{
+	struct stat st;
+
+	if (fstat(fd, &st))
+		return -1;
+	return emulated_set(backend, &st, value, size);
+}
+
+static int emulated_remove_file(const struct richacl_backend *backend,
+				const char *path)
+{
+	struct stat st;
+
+	if (stat(path, &st))
+		return -1;
+	return emulated_remove(backend, &st);
+}
+
+static int emulated_remove_fd(const struct richacl_backend *backend, int fd)
+{
+	struct stat st;
+
+	if (fstat(fd, &st))
+		return -1;
+	return emulated_remove(backend, &st);
+}
+
+static void emulated_destroy(struct richacl_backend *backend)
+{
+	struct emulated_backend *emu = backend->data;
+	size_t n;
+
+	for (n = 0; n < emu->table_size; n++) {
+		struct emulated_entry *entry = emu->table[n], *next;
+
+		for (; entry; entry = next) {
+			next = entry->next;
+			free(entry);
+		}
+	}
+	pthread_mutex_destroy(&emu->lock);
+	free(emu->table);
+	free(emu);
+}
+
+/**
+ * richacl_emulated_backend  -  create an in-memory backend
+ * @latency_ns:	delay each operation by this many nanoseconds
+ *
+ * The acls stored in an emulated backend only live as long as the backend
+ * itself; free it with richacl_free_backend().
+ */
+struct richacl_backend *richacl_emulated_backend(unsigned long latency_ns)
+{
+	struct emulated_backend *emu;
+
+	emu = malloc(sizeof(*emu));
+	if (!emu)
+		return NULL;
+	memset(emu, 0, sizeof(*emu));
+	emu->table_size = 64;
+	emu->table = calloc(emu->table_size, sizeof(*emu->table));
+	if (!emu->table) {
+		free(emu);
+		return NULL;
+	}
+	pthread_mutex_init(&emu->lock, NULL);
+	emu->latency_ns = latency_ns;
+
+	emu->backend.name = "emulated";
+	emu->backend.get_file = emulated_get_file;
+	emu->backend.get_fd = emulated_get_fd;
+	emu->backend.set_file = emulated_set_file;
+	emu->backend.set_fd = emulated_set_fd;
+	emu->backend.remove_file = emulated_remove_file;
+	emu->backend.remove_fd = emulated_remove_fd;
+	emu->backend.destroy = emulated_destroy;
+	emu->backend.data = emu;
+	return &emu->backend;
+}
+
+/**
+ * richacl_backend_by_name  -  look up or create a backend by name
+ * @name:	"xattr", "user", or "emulated[:LATENCY]", where LATENCY is the
+ *		per-operation delay in microseconds
+ *
+ * Returns %NULL with errno set to %EINVAL for unknown names.
+ */
+struct richacl_backend *richacl_backend_by_name(const char *name)
+{
+	if (!strcmp(name, richacl_xattr_backend.name))
+		return (struct richacl_backend *)&richacl_xattr_backend;
+	if (!strcmp(name, richacl_user_xattr_backend.name))
+		return (struct richacl_backend *)&richacl_user_xattr_backend;
+	if (!strncmp(name, "emulated", 8) &&
+	    (name[8] == 0 || name[8] == ':')) {
+		unsigned long latency = 0;
+
+		if (name[8] == ':') {
+			char *end;
+
+			latency = strtoul(name + 9, &end, 10);
+			if (*end || end == name + 9)
+				goto fail_einval;
+		}
+		return richacl_emulated_backend(latency * 1000);
+	}
+
+fail_einval:
+	errno = EINVAL;
+	return NULL;
+}
+
+void richacl_free_backend(struct richacl_backend *backend)
+{
+	if (backend && backend->destroy)
+		backend->destroy(backend);
+}
+
+static const struct richacl_backend *current_backend = &richacl_xattr_backend;
+
+/**
+ * richacl_set_backend  -  select the backend used by richacl_get_file() & co.
+ * @backend:	the new backend, or %NULL for richacl_xattr_backend
+ *
+ * Operations which are already in progress in other threads may still use
+ * the previous backend, so it must not be freed until they have finished.
+ */
+void richacl_set_backend(const struct richacl_backend *backend)
+{
+	__atomic_store_n(&current_backend,
+			 backend ? backend : &richacl_xattr_backend,
+			 __ATOMIC_RELEASE);
+}
+
+const struct richacl_backend *richacl_get_backend(void)
+{
+	return __atomic_load_n(&current_backend, __ATOMIC_ACQUIRE);
+}
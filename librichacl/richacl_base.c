@@ -19,12 +19,14 @@
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <ctype.h>
 #include <errno.h>
 #include "richacl.h"
 #include "richacl-internal.h"
+#include "richacl_probes.h"
 
 const char *richace_owner_who	 = "OWNER@";
 const char *richace_group_who	 = "GROUP@";
@@ -161,6 +163,8 @@ void richacl_compute_max_masks(struct richacl *acl)
 	unsigned int gmask = ~0;
 	struct richace *ace;
 
+	richacl_stat_add(max_masks, 1);
+
 	/*
 	 * @gmask contains all permissions which the group class is ever
 	 * allowed.  We use it to avoid adding permissions to the group mask
@@ -312,7 +316,7 @@ int richace_is_unix_id(const struct richace *ace)
 
 }
 
-static int in_groups(gid_t group, gid_t groups[], int n_groups)
+static int in_groups(gid_t group, const gid_t groups[], int n_groups)
 {
 	int n;
 
@@ -322,47 +326,44 @@ static int in_groups(gid_t group, gid_t groups[], int n_groups)
 	return 0;
 }
 
-int richacl_access(const char *file, const struct stat *st, uid_t user,
-		   const gid_t *const_groups, int n_groups)
+/*
+ * With *@n_groups < 0, replace *@groups with the effective group and the
+ * supplementary groups of the process in a newly allocated array.  An
+ * empty @groups array may be %NULL.
+ */
+static int process_groups(const gid_t **groups, int *n_groups)
+{
+	gid_t *process_groups;
+	int n;
+
+	if (*n_groups >= 0)
+		return 0;
+	n = getgroups(0, NULL);
+	if (n < 0)
+		return -1;
+	process_groups = malloc(sizeof(gid_t) * (n + 1));
+	if (!process_groups)
+		return -1;
+	process_groups[0] = getegid();
+	n = getgroups(n, process_groups + 1);
+	if (n < 0) {
+		free(process_groups);
+		return -1;
+	}
+	*groups = process_groups;
+	*n_groups = n + 1;
+	return 0;
+}
+
+static int acl_permission(const struct richacl *acl, const struct stat *st,
+			  uid_t user, const gid_t *groups, int n_groups,
+			  unsigned int *scanned_p)
 {
-	const struct richacl *acl;
-	struct stat local_st;
 	const struct richace *ace;
 	unsigned int file_mask, mask = ACE4_VALID_MASK, denied = 0;
 	int in_owning_group;
 	int in_owner_or_group_class;
-	gid_t *groups = NULL;
-
-	if (!st) {
-		if (stat(file, &local_st) != 0)
-			return -1;
-		st = &local_st;
-	}
-
-	acl = richacl_get_file(file);
-	if (!acl) {
-		if (errno == ENODATA || errno == ENOTSUP || errno == ENOSYS) {
-			acl = richacl_from_mode(st->st_mode);
-			if (!acl)
-				return -1;
-		} else
-			return -1;
-	}
-
-	if (n_groups < 0) {
-		n_groups = getgroups(0, NULL);
-		if (n_groups < 0)
-			return -1;
-		groups = malloc(sizeof(gid_t) * (n_groups + 1));
-		if (!groups)
-			return -1;
-		groups[0] = getegid();
-		if (getgroups(n_groups, groups + 1) < 0) {
-			free(groups);
-			return -1;
-		}
-	} else
-		groups = (gid_t *)const_groups;  /* cast away const */
+	unsigned int scanned = 0;
 
 	in_owning_group = in_groups(st->st_gid, groups, n_groups);
 	in_owner_or_group_class = in_owning_group;
@@ -385,6 +386,7 @@ int richacl_access(const char *file, const struct stat *st, uid_t user,
 	richacl_for_each_entry(ace, acl) {
 		unsigned int ace_mask = ace->e_mask;
 
+		scanned++;
 		if (richace_is_inherit_only(ace))
 			continue;
 		if (richace_is_owner(ace)) {
@@ -444,12 +446,212 @@ is_everyone:
 	if (!S_ISDIR(st->st_mode))
 		file_mask &= ~ACE4_DELETE_CHILD;
 
-	if (groups != const_groups)
-		free(groups);
-
+	richacl_stat_add(access_checks, 1);
+	richacl_stat_add(aces_scanned, scanned);
+	*scanned_p = scanned;
 	return file_mask & ~denied;
 }
 
+/**
+ * richacl_permission  -  compute the permissions an acl grants
+ * @acl:	the acl of the file, for example from richacl_get_file()
+ * @st:		the owner, owning group, and file type of the file
+ * @n_groups:	the number of @groups, or -1 for the groups of the process
+ *
+ * Same as richacl_access(), but for an acl which has already been
+ * retrieved.
+ */
+int richacl_permission(const struct richacl *acl, const struct stat *st,
+		       uid_t user, const gid_t *groups, int n_groups)
+{
+	const gid_t *all_groups;
+	unsigned int scanned;
+	int ret;
+
+	all_groups = groups;
+	if (process_groups(&all_groups, &n_groups))
+		return -1;
+	ret = acl_permission(acl, st, user, all_groups, n_groups, &scanned);
+	if (all_groups != groups)
+		free((gid_t *)all_groups);  /* cast away const */
+	return ret;
+}
+
+/* The state of one principal in richacl_permissions() */
+struct principal_state {
+	unsigned int mask, denied;
+	int in_owning_group;
+	int in_owner_or_group_class;
+};
+
+/**
+ * richacl_permissions  -  compute the permissions of several principals
+ * @principals:	the principals, with n_groups >= 0
+ * @count:	number of @principals
+ * @masks:	the permissions of each principal are returned here
+ *
+ * Same as richacl_permission() for each principal, but with a single scan
+ * of the acl.
+ */
+int richacl_permissions(const struct richacl *acl, const struct stat *st,
+			const struct richacl_principal *principals,
+			unsigned int count, unsigned int *masks)
+{
+	const struct richace *ace;
+	struct principal_state *states;
+	unsigned int n, pending = count, scanned = 0;
+
+	states = malloc(sizeof(*states) * (count ? count : 1));
+	if (!states)
+		return -1;
+	for (n = 0; n < count; n++) {
+		const struct richacl_principal *p = &principals[n];
+
+		states[n].mask = ACE4_VALID_MASK;
+		states[n].denied = 0;
+		states[n].in_owning_group =
+			in_groups(st->st_gid, p->groups, p->n_groups);
+		states[n].in_owner_or_group_class =
+			states[n].in_owning_group ||
+			!(acl->a_flags & ACL4_MASKED);
+	}
+
+	/* See acl_permission(). */
+	richacl_for_each_entry(ace, acl) {
+		if (!pending)
+			break;
+		scanned++;
+		if (richace_is_inherit_only(ace))
+			continue;
+		for (n = 0; n < count; n++) {
+			const struct richacl_principal *p = &principals[n];
+			struct principal_state *state = &states[n];
+			unsigned int ace_mask = ace->e_mask;
+
+			if (!state->mask)
+				continue;
+			if (richace_is_owner(ace)) {
+				if (p->user != st->st_uid)
+					continue;
+				state->in_owner_or_group_class = 1;
+			} else if (richace_is_group(ace) ||
+				   richace_is_unix_id(ace)) {
+				if (richace_is_group(ace)) {
+					if (!state->in_owning_group)
+						continue;
+				} else if (ace->e_flags & ACE4_IDENTIFIER_GROUP) {
+					if (!in_groups(ace->e_id, p->groups,
+						       p->n_groups))
+						continue;
+				} else if (p->user != ace->e_id)
+					continue;
+				if ((acl->a_flags & ACL4_MASKED) &&
+				    richace_is_allow(ace))
+					ace_mask &= acl->a_group_mask;
+				state->in_owner_or_group_class = 1;
+			}
+
+			if (richace_is_deny(ace))
+				state->denied |= ace_mask & state->mask;
+			state->mask &= ~ace_mask;
+			if (!state->mask)
+				pending--;
+		}
+	}
+
+	for (n = 0; n < count; n++) {
+		struct principal_state *state = &states[n];
+		unsigned int file_mask;
+
+		if (!(acl->a_flags & ACL4_MASKED))
+			file_mask = ACE4_VALID_MASK;
+		else if (principals[n].user == st->st_uid)
+			file_mask = acl->a_owner_mask;
+		else if (state->in_owner_or_group_class)
+			file_mask = acl->a_group_mask;
+		else
+			file_mask = acl->a_other_mask;
+		if (!S_ISDIR(st->st_mode))
+			file_mask &= ~ACE4_DELETE_CHILD;
+		masks[n] = file_mask & ~(state->denied | state->mask);
+	}
+	free(states);
+
+	richacl_stat_add(access_checks, count);
+	richacl_stat_add(aces_scanned, scanned);
+	return 0;
+}
+
+int richacl_access(const char *file, const struct stat *st, uid_t user,
+		   const gid_t *groups, int n_groups)
+{
+	struct richacl *acl;
+	struct stat local_st;
+	const gid_t *all_groups;
+	unsigned int scanned = 0, mask;
+	int ret = -1, fd = -1, cacheable = 0;
+
+	if (!st) {
+		if (stat(file, &local_st) != 0)
+			return -1;
+		st = &local_st;
+	}
+
+	all_groups = groups;
+	if (process_groups(&all_groups, &n_groups))
+		return -1;
+	if (richacl_access_cache_lookup(st, user, all_groups, n_groups,
+					&mask)) {
+		ret = mask;
+		goto out;
+	}
+
+	/*
+	 * Only cache the decision when the acl was read through a file
+	 * descriptor of the file @st refers to; @file might have been
+	 * replaced in the meantime.  Device special files are not opened.
+	 */
+	if (richacl_access_cache_usable() &&
+	    (S_ISREG(st->st_mode) || S_ISDIR(st->st_mode)))
+		fd = open(file, O_RDONLY | O_NONBLOCK | O_NOCTTY | O_CLOEXEC);
+	if (fd >= 0) {
+		struct stat fd_st;
+		int saved_errno;
+
+		cacheable = fstat(fd, &fd_st) == 0 &&
+			    fd_st.st_dev == st->st_dev &&
+			    fd_st.st_ino == st->st_ino &&
+			    fd_st.st_ctim.tv_sec == st->st_ctim.tv_sec &&
+			    fd_st.st_ctim.tv_nsec == st->st_ctim.tv_nsec;
+		acl = richacl_get_fd(fd);
+		saved_errno = errno;
+		close(fd);
+		errno = saved_errno;
+	} else
+		acl = richacl_get_file(file);
+	if (!acl) {
+		if (errno == ENODATA || errno == ENOTSUP || errno == ENOSYS) {
+			acl = richacl_from_mode(st->st_mode);
+			if (!acl)
+				goto out;
+		} else
+			goto out;
+	}
+
+	ret = acl_permission(acl, st, user, all_groups, n_groups, &scanned);
+	richacl_free(acl);
+	if (cacheable)
+		richacl_access_cache_insert(st, user, all_groups, n_groups,
+					    ret);
+
+out:
+	if (all_groups != groups)
+		free((gid_t *)all_groups);  /* cast away const */
+	if (ret >= 0)
+		RICHACL_PROBE4(librichacl, access, file, user, ret, scanned);
+	return ret;
+}
+
 /**
  * richacl_mask_to_mode  -  compute the file permission bits which correspond to @mask
  * @mask:	%ACE4_* permission mask
@@ -497,6 +699,36 @@ richacl_masks_to_mode(const struct richacl *acl)
 	       richacl_mask_to_mode(acl->a_other_mask);
 }
 
+/*
+ * Compute the entry which a non-directory inherits from @dir_ace, which
+ * must have ACE4_FILE_INHERIT_ACE set.
+ */
+static inline void
+inherit_file_ace(struct richace *ace, const struct richace *dir_ace)
+{
+	memcpy(ace, dir_ace, sizeof(struct richace));
+	richace_clear_inheritance_flags(ace);
+	/*
+	 * ACE4_DELETE_CHILD is meaningless for non-directories, so clear it.
+	 */
+	ace->e_mask &= ~ACE4_DELETE_CHILD;
+}
+
+/*
+ * Compute the entry which a directory inherits from @dir_ace, which must
+ * be inheritable.
+ */
+static inline void
+inherit_dir_ace(struct richace *ace, const struct richace *dir_ace)
+{
+	memcpy(ace, dir_ace, sizeof(struct richace));
+	if (dir_ace->e_flags & ACE4_NO_PROPAGATE_INHERIT_ACE)
+		richace_clear_inheritance_flags(ace);
+	if ((dir_ace->e_flags & ACE4_FILE_INHERIT_ACE) &&
+	    !(dir_ace->e_flags & ACE4_DIRECTORY_INHERIT_ACE))
+		ace->e_flags |= ACE4_INHERIT_ONLY_ACE;
+}
+
 /**
  * richacl_inherit  -  compute the inheritable acl
  * @dir_acl:	acl of the containing direcory
@@ -529,13 +761,7 @@ richacl_inherit(const struct richacl *dir_acl, int isdir)
 		richacl_for_each_entry(dir_ace, dir_acl) {
 			if (!richace_is_inheritable(dir_ace))
 				continue;
-			memcpy(ace, dir_ace, sizeof(struct richace));
-			if (dir_ace->e_flags & ACE4_NO_PROPAGATE_INHERIT_ACE)
-				richace_clear_inheritance_flags(ace);
-			if ((dir_ace->e_flags & ACE4_FILE_INHERIT_ACE) &&
-			    !(dir_ace->e_flags & ACE4_DIRECTORY_INHERIT_ACE))
-				ace->e_flags |= ACE4_INHERIT_ONLY_ACE;
-			ace++;
+			inherit_dir_ace(ace++, dir_ace);
 		}
 	} else {
 		richacl_for_each_entry(dir_ace, dir_acl) {
@@ -552,14 +778,7 @@ richacl_inherit(const struct richacl *dir_acl, int isdir)
 		richacl_for_each_entry(dir_ace, dir_acl) {
 			if (!(dir_ace->e_flags & ACE4_FILE_INHERIT_ACE))
 				continue;
-			memcpy(ace, dir_ace, sizeof(struct richace));
-			richace_clear_inheritance_flags(ace);
-			/*
-			 * ACE4_DELETE_CHILD is meaningless for
-			 * non-directories, so clear it.
-			 */
-			ace->e_mask &= ~ACE4_DELETE_CHILD;
-			ace++;
+			inherit_file_ace(ace++, dir_ace);
 		}
 	}
 
@@ -572,6 +791,96 @@ richacl_inherit(const struct richacl *dir_acl, int isdir)
 	return acl;
 }
 
+/*
+ * Size of an acl with room for @count entries.  This is a multiple of the
+ * alignment of struct richacl, so acls can be placed one after the other.
+ */
+static inline size_t
+acl_size(unsigned int count)
+{
+	return sizeof(struct richacl) + count * sizeof(struct richace);
+}
+
+/**
+ * richacl_inherit_size  -  storage needed by richacl_inherit_into()
+ * @dir_acl:	acl of the containing direcory
+ */
+size_t
+richacl_inherit_size(const struct richacl *dir_acl)
+{
+	return 2 * acl_size(dir_acl->a_count);
+}
+
+/**
+ * richacl_inherit_into  -  compute the inheritable acls of files and directories
+ * @dir_acl:	acl of the containing direcory
+ * @buffer:	richacl_inherit_size(@dir_acl) bytes, suitably aligned
+ * @file_acl:	returns the acl which a new non-directory inherits
+ * @subdir_acl:	returns the acl which a new directory inherits
+ *
+ * Like richacl_inherit() for both kinds of files at once, but with a single
+ * pass over @dir_acl and without allocating memory: both acls are placed in
+ * @buffer.  Unlike richacl_inherit(), an acl without any entries is returned
+ * when there is nothing to inherit.
+ */
+void
+richacl_inherit_into(const struct richacl *dir_acl, void *buffer,
+		     struct richacl **file_acl, struct richacl **subdir_acl)
+{
+	struct richacl *facl = buffer;
+	struct richacl *dacl = (void *)((char *)buffer +
+					  acl_size(dir_acl->a_count));
+	struct richace *file_ace = facl->a_entries;
+	struct richace *dir_ace = dacl->a_entries;
+	const struct richace *ace;
+	unsigned short inherited = 0;
+
+	memset(facl, 0, sizeof(*facl));
+	memset(dacl, 0, sizeof(*dacl));
+	if (richacl_is_auto_inherit(dir_acl)) {
+		facl->a_flags = ACL4_AUTO_INHERIT;
+		dacl->a_flags = ACL4_AUTO_INHERIT;
+		inherited = ACE4_INHERITED_ACE;
+	}
+	richacl_for_each_entry(ace, dir_acl) {
+		if (ace->e_flags & ACE4_FILE_INHERIT_ACE) {
+			inherit_file_ace(file_ace, ace);
+			file_ace++->e_flags |= inherited;
+		}
+		if (richace_is_inheritable(ace)) {
+			inherit_dir_ace(dir_ace, ace);
+			dir_ace++->e_flags |= inherited;
+		}
+	}
+	facl->a_count = file_ace - facl->a_entries;
+	dacl->a_count = dir_ace - dacl->a_entries;
+	*file_acl = facl;
+	*subdir_acl = dacl;
+}
+
+/**
+ * richacl_inherit_both  -  compute the inheritable acls of files and directories
+ * @dir_acl:	acl of the containing direcory
+ * @file_acl:	returns the acl which a new non-directory inherits
+ * @subdir_acl:	returns the acl which a new directory inherits
+ *
+ * Like richacl_inherit_into(), with both acls in a single allocation.  Free
+ * them with richacl_free(*@file_acl) only; this also frees *@subdir_acl.
+ * Returns 0, or -1 with errno set.
+ */
+int
+richacl_inherit_both(const struct richacl *dir_acl,
+		     struct richacl **file_acl, struct richacl **subdir_acl)
+{
+	void *buffer;
+
+	buffer = malloc(richacl_inherit_size(dir_acl));
+	if (!buffer)
+		return -1;
+	richacl_inherit_into(dir_acl, buffer, file_acl, subdir_acl);
+	return 0;
+}
+
 /**
  * richacl_equiv_mode  -  determine if @acl is equivalent to a file mode
  * @mode_p:	the file mode
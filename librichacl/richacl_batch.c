@@ -0,0 +1,481 @@
+/*
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+#include <sys/types.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include "richacl.h"
+#include "richacl_xattr.h"
+#include "richacl-internal.h"
+
+#ifdef HAVE_IO_URING
+# include <sys/mman.h>
+# include <sys/syscall.h>
+# include <linux/io_uring.h>
+#endif
+
+/*
+ * Batches queue acl operations and carry them out concurrently through
+ * io_uring when the acls are stored in extended attributes and the kernel
+ * supports the xattr operations.  Otherwise, each operation is carried
+ * out synchronously when it is queued.
+ */
+
+/*
+ * Size of the buffer of each queued operation.  Larger acls are read and
+ * written synchronously.
+ */
+#define BATCH_BUFFER_SIZE 1024
+
+enum batch_opcode {
+	BATCH_GET,
+	BATCH_SET,
+};
+
+struct batch_op {
+	struct batch_op *next;		/* in the free list */
+	enum batch_opcode opcode;
+	const char *path;
+	void (*done)(void *, struct richacl *, int);
+	void *arg;
+	unsigned char *value;
+};
+
+struct richacl_batch {
+	int ring_fd;
+	const struct richacl_backend *backend;
+	unsigned int depth;
+	unsigned int queued;		/* not submitted yet */
+	unsigned int inflight;		/* submitted or queued */
+	struct batch_op *ops, *free_ops;
+	unsigned char *buffers;
+
+	/* submission queue */
+	void *sq_ring;
+	size_t sq_ring_size;
+	unsigned int *sq_head, *sq_tail, *sq_mask, *sq_array;
+	struct io_uring_sqe *sqes;
+	size_t sqes_size;
+
+	/* completion queue */
+	void *cq_ring;
+	size_t cq_ring_size;
+	unsigned int *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_cqe *cqes;
+};
+
+#ifdef HAVE_IO_URING
+
+static int io_uring_setup(unsigned int entries, struct io_uring_params *p)
+{
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int io_uring_enter(int fd, unsigned int to_submit,
+			  unsigned int min_complete, unsigned int flags)
+{
+	return syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+		       flags, NULL, 0);
+}
+
+static int io_uring_register(int fd, unsigned int opcode, void *arg,
+			     unsigned int nr_args)
+{
+	return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+/* Check that the kernel supports the xattr operations. */
+static int batch_probe(struct richacl_batch *batch)
+{
+	size_t size = sizeof(struct io_uring_probe) +
+		      256 * sizeof(struct io_uring_probe_op);
+	struct io_uring_probe *probe;
+	int ret = -1;
+
+	probe = calloc(1, size);
+	if (!probe)
+		return -1;
+	if (io_uring_register(batch->ring_fd, IORING_REGISTER_PROBE,
+			      probe, 256) == 0 &&
+	    probe->last_op >= IORING_OP_GETXATTR &&
+	    probe->last_op >= IORING_OP_SETXATTR &&
+	    (probe->ops[IORING_OP_GETXATTR].flags & IO_URING_OP_SUPPORTED) &&
+	    (probe->ops[IORING_OP_SETXATTR].flags & IO_URING_OP_SUPPORTED))
+		ret = 0;
+	free(probe);
+	return ret;
+}
+
+static void batch_unmap(struct richacl_batch *batch)
+{
+	if (batch->sqes)
+		munmap(batch->sqes, batch->sqes_size);
+	if (batch->cq_ring && batch->cq_ring != batch->sq_ring)
+		munmap(batch->cq_ring, batch->cq_ring_size);
+	if (batch->sq_ring)
+		munmap(batch->sq_ring, batch->sq_ring_size);
+	close(batch->ring_fd);
+	batch->ring_fd = -1;
+}
+
+static int batch_setup_ring(struct richacl_batch *batch)
+{
+	struct io_uring_params p;
+	unsigned char *sq, *cq;
+
+	memset(&p, 0, sizeof(p));
+	batch->ring_fd = io_uring_setup(batch->depth, &p);
+	if (batch->ring_fd < 0)
+		return -1;
+	if (batch_probe(batch))
+		goto fail;
+
+	batch->sq_ring_size = p.sq_off.array +
+			      p.sq_entries * sizeof(unsigned int);
+	batch->cq_ring_size = p.cq_off.cqes +
+			      p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (batch->cq_ring_size > batch->sq_ring_size)
+			batch->sq_ring_size = batch->cq_ring_size;
+		batch->cq_ring_size = batch->sq_ring_size;
+	}
+	sq = mmap(NULL, batch->sq_ring_size, PROT_READ | PROT_WRITE,
+		  MAP_SHARED | MAP_POPULATE, batch->ring_fd, IORING_OFF_SQ_RING);
+	if (sq == MAP_FAILED)
+		goto fail;
+	batch->sq_ring = sq;
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		cq = sq;
+	else {
+		cq = mmap(NULL, batch->cq_ring_size, PROT_READ | PROT_WRITE,
+			  MAP_SHARED | MAP_POPULATE, batch->ring_fd,
+			  IORING_OFF_CQ_RING);
+		if (cq == MAP_FAILED)
+			goto fail;
+	}
+	batch->cq_ring = cq;
+	batch->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	batch->sqes = mmap(NULL, batch->sqes_size, PROT_READ | PROT_WRITE,
+			   MAP_SHARED | MAP_POPULATE, batch->ring_fd,
+			   IORING_OFF_SQES);
+	if (batch->sqes == MAP_FAILED) {
+		batch->sqes = NULL;
+		goto fail;
+	}
+
+	batch->sq_head = (void *)(sq + p.sq_off.head);
+	batch->sq_tail = (void *)(sq + p.sq_off.tail);
+	batch->sq_mask = (void *)(sq + p.sq_off.ring_mask);
+	batch->sq_array = (void *)(sq + p.sq_off.array);
+	batch->cq_head = (void *)(cq + p.cq_off.head);
+	batch->cq_tail = (void *)(cq + p.cq_off.tail);
+	batch->cq_mask = (void *)(cq + p.cq_off.ring_mask);
+	batch->cqes = (void *)(cq + p.cq_off.cqes);
+	return 0;
+
+fail:
+	batch_unmap(batch);
+	return -1;
+}
+
+static void batch_queue(struct richacl_batch *batch, struct batch_op *op,
+			size_t size)
+{
+	unsigned int tail = *batch->sq_tail, index;
+	struct io_uring_sqe *sqe;
+
+	index = tail & *batch->sq_mask;
+	sqe = batch->sqes + index;
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = op->opcode == BATCH_GET ?
+		      IORING_OP_GETXATTR : IORING_OP_SETXATTR;
+	sqe->addr = (unsigned long)batch->backend->data;
+	sqe->addr2 = (unsigned long)op->value;
+	sqe->addr3 = (unsigned long)op->path;
+	sqe->len = size;
+	sqe->user_data = op - batch->ops;
+	batch->sq_array[index] = index;
+	__atomic_store_n(batch->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	batch->queued++;
+	batch->inflight++;
+}
+
+/* Submit all queued operations and wait for at least @min_complete. */
+static int batch_enter(struct richacl_batch *batch, unsigned int min_complete)
+{
+	int ret;
+
+	do {
+		ret = io_uring_enter(batch->ring_fd, batch->queued,
+				     min_complete,
+				     min_complete ? IORING_ENTER_GETEVENTS : 0);
+	} while (ret < 0 && errno == EINTR);
+	if (ret < 0)
+		return -1;
+	batch->queued -= ret;
+	return 0;
+}
+
+static void batch_complete(struct richacl_batch *batch, struct batch_op *op,
+			   int res)
+{
+	struct richacl *acl = NULL;
+	int error = 0;
+
+	if (op->opcode == BATCH_GET) {
+		if (res == -ERANGE) {
+			/* Too large for the buffer. */
+			acl = richacl_get_file(op->path);
+			if (!acl)
+				error = errno;
+		} else if (res < 0)
+			error = -res;
+		else {
+			richacl_stat_add(xattr_bytes_read, res);
+			acl = richacl_from_xattr(op->value, res);
+			if (!acl)
+				error = errno;
+		}
+	} else if (res < 0)
+		error = -res;
+
+	/* The callback may queue further operations, so free @op first. */
+	op->next = batch->free_ops;
+	batch->free_ops = op;
+	batch->inflight--;
+	op->done(op->arg, acl, error);
+}
+
+/* Run the callbacks of all completed operations. */
+static void batch_reap(struct richacl_batch *batch)
+{
+	for (;;) {
+		unsigned int head = *batch->cq_head;
+		struct io_uring_cqe *cqe;
+		struct batch_op *op;
+		int res;
+
+		if (head == __atomic_load_n(batch->cq_tail, __ATOMIC_ACQUIRE))
+			break;
+		cqe = batch->cqes + (head & *batch->cq_mask);
+		op = batch->ops + cqe->user_data;
+		res = cqe->res;
+		__atomic_store_n(batch->cq_head, head + 1, __ATOMIC_RELEASE);
+		batch_complete(batch, op, res);
+	}
+}
+
+#else  /* HAVE_IO_URING */
+
+static int batch_setup_ring(struct richacl_batch *batch)
+{
+	errno = ENOSYS;
+	return -1;
+}
+
+static void batch_unmap(struct richacl_batch *batch)
+{
+}
+
+static void batch_queue(struct richacl_batch *batch, struct batch_op *op,
+			size_t size)
+{
+}
+
+static int batch_enter(struct richacl_batch *batch, unsigned int min_complete)
+{
+	errno = ENOSYS;
+	return -1;
+}
+
+static void batch_reap(struct richacl_batch *batch)
+{
+}
+
+#endif  /* HAVE_IO_URING */
+
+/**
+ * richacl_batch_alloc  -  allocate a batch for queueing acl operations
+ * @depth:	maximum number of operations in flight
+ *
+ * Operations go through io_uring if the current backend (see
+ * richacl_set_backend()) stores acls in extended attributes, and the
+ * kernel supports it.  Otherwise, they complete synchronously.
+ */
+struct richacl_batch *richacl_batch_alloc(unsigned int depth)
+{
+	const struct richacl_backend *backend = richacl_get_backend();
+	struct richacl_batch *batch;
+	unsigned int n;
+
+	if (!depth)
+		depth = 1;
+	batch = calloc(1, sizeof(*batch));
+	if (!batch)
+		return NULL;
+	batch->ring_fd = -1;
+	batch->backend = backend;
+	batch->depth = depth;
+
+	if (backend != &richacl_xattr_backend &&
+	    backend != &richacl_user_xattr_backend)
+		return batch;
+	if (batch_setup_ring(batch))
+		return batch;
+
+	batch->ops = calloc(depth, sizeof(*batch->ops));
+	batch->buffers = malloc(depth * BATCH_BUFFER_SIZE);
+	if (!batch->ops || !batch->buffers) {
+		free(batch->ops);
+		free(batch->buffers);
+		batch_unmap(batch);
+		free(batch);
+		return NULL;
+	}
+	for (n = 0; n < depth; n++) {
+		struct batch_op *op = batch->ops + n;
+
+		op->value = batch->buffers + n * BATCH_BUFFER_SIZE;
+		op->next = batch->free_ops;
+		batch->free_ops = op;
+	}
+	return batch;
+}
+
+/**
+ * richacl_batch_is_async  -  check if a batch carries out operations concurrently
+ */
+int richacl_batch_is_async(const struct richacl_batch *batch)
+{
+	return batch->ring_fd >= 0;
+}
+
+/*
+ * Get a free operation slot, waiting for operations in flight to
+ * complete if necessary.
+ */
+static struct batch_op *batch_get_op(struct richacl_batch *batch)
+{
+	while (!batch->free_ops) {
+		if (batch_enter(batch, 1))
+			return NULL;
+		batch_reap(batch);
+	}
+	return batch->free_ops;
+}
+
+/**
+ * richacl_batch_get_file  -  queue reading the acl of a file
+ * @path:	the file; must remain valid until @done has been called
+ * @done:	called with @arg and either the acl read or %NULL and an
+ *		error number; the callback takes over the acl
+ *
+ * @done may be called before this function returns, or from any later
+ * richacl_batch_*() call on the same batch.  Returns -1 if the operation
+ * could not be queued; @done is not called in that case.
+ */
+int richacl_batch_get_file(struct richacl_batch *batch, const char *path,
+			   void (*done)(void *, struct richacl *, int),
+			   void *arg)
+{
+	struct batch_op *op;
+
+	if (batch->ring_fd < 0) {
+		struct richacl *acl = richacl_get_file(path);
+
+		done(arg, acl, acl ? 0 : errno);
+		return 0;
+	}
+	op = batch_get_op(batch);
+	if (!op)
+		return -1;
+	batch->free_ops = op->next;
+	op->opcode = BATCH_GET;
+	op->path = path;
+	op->done = done;
+	op->arg = arg;
+	richacl_stat_add(xattr_gets, 1);
+	batch_queue(batch, op, BATCH_BUFFER_SIZE);
+	return 0;
+}
+
+/**
+ * richacl_batch_set_file  -  queue setting the acl of a file
+ * @path:	the file; must remain valid until @done has been called
+ * @acl:	the acl; not referenced after this function returns
+ * @done:	called with @arg, %NULL, and zero or an error number
+ *
+ * See richacl_batch_get_file().
+ */
+int richacl_batch_set_file(struct richacl_batch *batch, const char *path,
+			   const struct richacl *acl,
+			   void (*done)(void *, struct richacl *, int),
+			   void *arg)
+{
+	size_t size = richacl_xattr_size(acl);
+	struct batch_op *op;
+
+	if (batch->ring_fd < 0 || size > BATCH_BUFFER_SIZE) {
+		int error = richacl_set_file(path, acl) ? errno : 0;
+
+		done(arg, NULL, error);
+		return 0;
+	}
+	op = batch_get_op(batch);
+	if (!op)
+		return -1;
+	batch->free_ops = op->next;
+	op->opcode = BATCH_SET;
+	op->path = path;
+	op->done = done;
+	op->arg = arg;
+	richacl_to_xattr(acl, op->value);
+	richacl_stat_add(xattr_sets, 1);
+	richacl_stat_add(xattr_bytes_written, size);
+	batch_queue(batch, op, size);
+	return 0;
+}
+
+/**
+ * richacl_batch_wait  -  carry out all queued operations
+ *
+ * Returns when the callbacks of all queued operations (including those
+ * queued by callbacks) have been called, or -1 if waiting failed.
+ */
+int richacl_batch_wait(struct richacl_batch *batch)
+{
+	while (batch->inflight) {
+		if (batch_enter(batch, 1))
+			return -1;
+		batch_reap(batch);
+	}
+	return 0;
+}
+
+void richacl_batch_free(struct richacl_batch *batch)
+{
+	if (!batch)
+		return;
+	if (batch->ring_fd >= 0) {
+		richacl_batch_wait(batch);
+		batch_unmap(batch);
+	}
+	free(batch->ops);
+	free(batch->buffers);
+	free(batch);
+}
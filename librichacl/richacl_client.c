@@ -0,0 +1,256 @@
+/*
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+/*
+ * Clients of the richacld acl evaluation daemon (see richacld.h).  A
+ * connection must not be used by several threads at the same time.
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include "richacl.h"
+#include "richacld.h"
+
+struct richacl_client {
+	int fd;
+	unsigned char *buffer;
+	size_t size;
+};
+
+static int client_reserve(struct richacl_client *client, size_t size)
+{
+	unsigned char *buffer;
+
+	if (size <= client->size)
+		return 0;
+	buffer = realloc(client->buffer, size);
+	if (!buffer)
+		return -1;
+	client->buffer = buffer;
+	client->size = size;
+	return 0;
+}
+
+static int write_all(int fd, const void *buf, size_t size)
+{
+	const unsigned char *p = buf;
+
+	while (size) {
+		ssize_t ret = send(fd, p, size, MSG_NOSIGNAL);
+
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		p += ret;
+		size -= ret;
+	}
+	return 0;
+}
+
+static int read_all(int fd, void *buf, size_t size)
+{
+	unsigned char *p = buf;
+
+	while (size) {
+		ssize_t ret = read(fd, p, size);
+
+		if (ret <= 0) {
+			if (ret < 0 && errno == EINTR)
+				continue;
+			if (ret == 0)
+				errno = ECONNRESET;
+			return -1;
+		}
+		p += ret;
+		size -= ret;
+	}
+	return 0;
+}
+
+/*
+ * Send a request and wait for the reply.  The data which follows the
+ * reply header ends up in client->buffer; its size is returned.
+ */
+static ssize_t client_call(struct richacl_client *client, int op, int flags,
+			   const char *path, uid_t uid, const gid_t *groups,
+			   int n_groups, struct richacld_reply *reply)
+{
+	struct richacld_request *request;
+	size_t cwd_len = 0, path_len = strlen(path), size;
+	unsigned char *p;
+	int n;
+
+	if (n_groups < 0)
+		n_groups = -1;
+	if (path[0] != '/') {
+		if (client_reserve(client, 4096))
+			return -1;
+		if (!getcwd((char *)client->buffer, client->size))
+			return -1;
+		cwd_len = strlen((char *)client->buffer) + 1;
+	}
+	size = sizeof(*request) + (n_groups > 0 ? n_groups : 0) *
+	       sizeof(uint32_t) + cwd_len + path_len + 1;
+	if (size > RICHACLD_MAX_REQUEST) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	if (client_reserve(client, size))
+		return -1;
+	p = client->buffer + size - path_len - 1 - cwd_len;
+	if (cwd_len) {
+		memmove(p, client->buffer, cwd_len - 1);
+		p[cwd_len - 1] = '/';
+	}
+	memcpy(p + cwd_len, path, path_len + 1);
+
+	request = (struct richacld_request *)client->buffer;
+	request->r_size = size;
+	request->r_op = op;
+	request->r_flags = flags;
+	request->r_uid = uid;
+	request->r_ngroups = n_groups;
+	for (n = 0; n < n_groups; n++)
+		((uint32_t *)(request + 1))[n] = groups[n];
+
+	if (write_all(client->fd, client->buffer, size) ||
+	    read_all(client->fd, reply, sizeof(*reply)))
+		return -1;
+	if (reply->r_size < sizeof(*reply)) {
+		errno = EPROTO;
+		return -1;
+	}
+	size = reply->r_size - sizeof(*reply);
+	if (client_reserve(client, size) ||
+	    read_all(client->fd, client->buffer, size))
+		return -1;
+	if (reply->r_error) {
+		errno = reply->r_error;
+		return -1;
+	}
+	return size;
+}
+
+/**
+ * richacl_client_open  -  connect to richacld
+ * @socket_path:	the daemon's socket, or %NULL for %RICHACLD_SOCKET
+ */
+struct richacl_client *richacl_client_open(const char *socket_path)
+{
+	struct richacl_client *client;
+	struct sockaddr_un addr;
+
+	if (!socket_path)
+		socket_path = RICHACLD_SOCKET;
+	if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+		errno = ENAMETOOLONG;
+		return NULL;
+	}
+	client = malloc(sizeof(*client));
+	if (!client)
+		return NULL;
+	memset(client, 0, sizeof(*client));
+	client->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (client->fd < 0)
+		goto fail;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, socket_path);
+	if (connect(client->fd, (struct sockaddr *)&addr, sizeof(addr)))
+		goto fail;
+	return client;
+
+fail:
+	richacl_client_close(client);
+	return NULL;
+}
+
+void richacl_client_close(struct richacl_client *client)
+{
+	int saved_errno = errno;
+
+	if (!client)
+		return;
+	if (client->fd >= 0)
+		close(client->fd);
+	free(client->buffer);
+	free(client);
+	errno = saved_errno;
+}
+
+/**
+ * richacl_client_get_file  -  richacl_get_file() through richacld
+ *
+ * Unlike richacl_get_file(), this returns the acl equivalent to the file
+ * mode when the file has no acl.
+ */
+struct richacl *richacl_client_get_file(struct richacl_client *client,
+					const char *path)
+{
+	struct richacld_reply reply;
+	ssize_t size;
+
+	size = client_call(client, RICHACLD_GET, 0, path, 0, NULL, 0, &reply);
+	if (size < 0)
+		return NULL;
+	return richacl_from_xattr(client->buffer, size);
+}
+
+/**
+ * richacl_client_access  -  richacl_access() through richacld
+ * @n_groups:	the number of @groups, or -1 for the groups @user is in
+ */
+int richacl_client_access(struct richacl_client *client, const char *path,
+			  uid_t user, const gid_t *groups, int n_groups)
+{
+	struct richacld_reply reply;
+
+	if (client_call(client, RICHACLD_ACCESS, 0, path, user, groups,
+			n_groups, &reply) < 0)
+		return -1;
+	return reply.r_mask;
+}
+
+/**
+ * richacl_client_inherit  -  the acl a new file in directory @path inherits
+ *
+ * Returns %NULL with errno set to 0 when nothing is inherited, like
+ * richacl_inherit().
+ */
+struct richacl *richacl_client_inherit(struct richacl_client *client,
+				       const char *path, int isdir)
+{
+	struct richacld_reply reply;
+	ssize_t size;
+
+	size = client_call(client, RICHACLD_INHERIT,
+			   isdir ? RICHACLD_ISDIR : 0, path, 0, NULL, 0,
+			   &reply);
+	if (size < 0)
+		return NULL;
+	if (size == 0) {
+		errno = 0;
+		return NULL;
+	}
+	return richacl_from_xattr(client->buffer, size);
+}
@@ -20,6 +20,7 @@
 #include <stdlib.h>
 #include "richacl.h"
 #include "richacl-internal.h"
+#include "richacl_probes.h"
 
 /**
  * struct richacl_alloc  -  remember how many entries are actually allocated
@@ -77,6 +78,7 @@ richacl_insert_entry(struct richacl_alloc *x, struct richace **ace)
 		acl2 = realloc(x->acl, size);
 		if (!acl2)
 			return -1;
+		richacl_stat_add(entry_reallocs, 1);
 		x->count++;
 		x->acl = acl2;
 		*ace = acl2->a_entries + n;
@@ -107,6 +109,7 @@ richacl_append_entry(struct richacl_alloc *x)
 		acl2 = realloc(x->acl, size);
 		if (!acl2)
 			return NULL;
+		richacl_stat_add(entry_reallocs, 1);
 		x->count++;
 		x->acl = acl2;
 	}
@@ -647,6 +650,8 @@ richacl_apply_masks(struct richacl **acl)
 			.acl = *acl,
 			.count = (*acl)->a_count,
 		};
+		unsigned int before = x.count;
+
 		if (richacl_move_everyone_aces_down(&x) ||
 		    richacl_propagate_everyone(&x) ||
 		    __richacl_apply_masks(&x) ||
@@ -656,6 +661,8 @@ richacl_apply_masks(struct richacl **acl)
 
 		x.acl->a_flags &= ~ACL4_MASKED;
 		*acl = x.acl;
+		RICHACL_PROBE2(librichacl, apply__masks, before,
+			       x.acl->a_count);
 	}
 	return retval;
 }
@@ -0,0 +1,539 @@
+/*
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+#include <sys/types.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "richacl.h"
+#include "richacl-internal.h"
+
+/*
+ * Where new entries are inserted, in the order in which they end up when
+ * inserted at the same position.  Entries inserted at the same position
+ * stay in the order in which they were given.
+ */
+enum insert_position {
+	INSERT_DENY,		/* after the initial non-inherited denies */
+	INSERT_ALLOW,		/* at the end of the non-inherited entries */
+	INSERT_INHERITED_DENY,	/* after the initial denies of the final
+				   block of inherited entries */
+	INSERT_INHERITED_ALLOW,	/* at the end */
+	INSERT_POSITIONS
+};
+
+/* Size of the index table which is kept on the stack. */
+#define SMALL_INDEX 64
+
+/*
+ * An index of the entries of the acl and of the entries to insert, by
+ * type, inherited flag, and identifier: entries which richacl_modify()
+ * treats as the same are in the same slot.  Slots contain an entry
+ * number plus one, or zero when empty.
+ */
+struct modify_index {
+	unsigned int *slots;
+	unsigned int mask;
+	const struct richace *entries;	/* the entries of the acl */
+	unsigned int count;		/* number of entries in the acl */
+	const struct richace *new_entries;
+};
+
+static inline int richace_is_inherited(const struct richace *ace)
+{
+	return ace->e_flags & ACE4_INHERITED_ACE;
+}
+
+static inline int same_entry(const struct richace *a, const struct richace *b)
+{
+	return a->e_type == b->e_type &&
+	       richace_is_inherited(a) == richace_is_inherited(b) &&
+	       richace_is_same_identifier(a, b);
+}
+
+static inline unsigned int mix(uint64_t x)
+{
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdULL;
+	x ^= x >> 33;
+	return x;
+}
+
+static unsigned int entry_hash(const struct richace *ace)
+{
+	return mix((uint64_t)ace->e_id << 32 | ace->e_type << 16 |
+		   (ace->e_flags & (ACE4_SPECIAL_WHO | ACE4_IDENTIFIER_GROUP |
+				    ACE4_INHERITED_ACE)));
+}
+
+static inline const struct richace *
+index_entry(const struct modify_index *index, unsigned int n)
+{
+	if (n < index->count)
+		return index->entries + n;
+	return index->new_entries + (n - index->count);
+}
+
+/*
+ * Find the entry which is the same as @ace.  If there is none, return the
+ * free slot for it.
+ */
+static unsigned int *index_lookup(struct modify_index *index,
+				  const struct richace *ace)
+{
+	unsigned int n;
+
+	for (n = entry_hash(ace); ; n++) {
+		unsigned int *slot = index->slots + (n & index->mask);
+
+		if (!*slot || same_entry(index_entry(index, *slot - 1), ace))
+			return slot;
+	}
+}
+
+static enum insert_position insert_position(const struct richace *ace)
+{
+	if (richace_is_inherited(ace))
+		return richace_is_deny(ace) ? INSERT_INHERITED_DENY :
+					      INSERT_INHERITED_ALLOW;
+	return richace_is_deny(ace) ? INSERT_DENY : INSERT_ALLOW;
+}
+
+/*
+ * Compute where the entries for each insert position go in @acl, as the
+ * number of existing entries before them.
+ */
+static void insert_positions(const struct richacl *acl,
+			     unsigned int where[INSERT_POSITIONS])
+{
+	const struct richace *ace = acl->a_entries;
+	unsigned int n = 0, count = acl->a_count, last_block;
+
+	while (n < count && richace_is_deny(ace + n) &&
+	       !richace_is_inherited(ace + n))
+		n++;
+	where[INSERT_DENY] = n;
+	while (n < count && !richace_is_inherited(ace + n))
+		n++;
+	where[INSERT_ALLOW] = n;
+	last_block = count;
+	while (last_block > 0 && richace_is_inherited(ace + last_block - 1))
+		last_block--;
+	n = last_block;
+	while (n < count && richace_is_deny(ace + n))
+		n++;
+	where[INSERT_INHERITED_DENY] = n;
+	where[INSERT_INHERITED_ALLOW] = count;
+}
+
+/**
+ * richacl_modify  -  replace and add acl entries
+ * @acl:	the acl to modify; may be replaced
+ * @changes:	the entries to replace and add
+ * @changes_has: which of the flags and masks in @changes to use
+ *		(%RICHACL_TEXT_OWNER_MASK, ..., as from richacl_from_text())
+ *
+ * The file masks of @acl are applied first.  Then, each entry in @changes
+ * replaces the mask and flags of the first entry in @acl of the same type,
+ * with the same inherited flag, and for the same identifier.  The other
+ * entries in @changes are inserted: non-inherited deny entries after the
+ * initial non-inherited deny entries, non-inherited allow entries at the
+ * end of the non-inherited entries, inherited deny entries after the
+ * initial deny entries of the final block of inherited entries, and
+ * inherited allow entries at the end.  Finally, the flags and masks are
+ * set as in richacl_compute_masks().
+ *
+ * Entries are looked up through a hash index and all insertions are done
+ * in a single pass, so this takes linear time and allocates at most one
+ * new acl.  Returns 0, or -1 with errno set.
+ */
+int
+richacl_modify(struct richacl **acl, const struct richacl *changes,
+	       int changes_has)
+{
+	unsigned int small_slots[SMALL_INDEX], *slots = small_slots;
+	unsigned int where[INSERT_POSITIONS], n_new = 0, size, n;
+	struct richace *new_entries = NULL;
+	struct modify_index index;
+	const struct richace *ace;
+	int ret = -1;
+
+	if (richacl_apply_masks(acl))
+		return -1;
+
+	for (size = 16; size < 2 * ((*acl)->a_count + changes->a_count);
+	     size *= 2)
+		/* nothing */ ;
+	if (size > SMALL_INDEX) {
+		slots = malloc(sizeof(*slots) * size);
+		if (!slots)
+			return -1;
+	}
+	memset(slots, 0, sizeof(*slots) * size);
+	if (changes->a_count) {
+		new_entries = malloc(sizeof(*new_entries) * changes->a_count);
+		if (!new_entries)
+			goto out;
+	}
+	index.slots = slots;
+	index.mask = size - 1;
+	index.entries = (*acl)->a_entries;
+	index.count = (*acl)->a_count;
+	index.new_entries = new_entries;
+
+	for (n = 0; n < (*acl)->a_count; n++) {
+		unsigned int *slot = index_lookup(&index, (*acl)->a_entries + n);
+
+		/* Only the first of several same entries is modified. */
+		if (!*slot)
+			*slot = n + 1;
+	}
+	richacl_for_each_entry(ace, changes) {
+		unsigned int *slot = index_lookup(&index, ace);
+		struct richace *ace2;
+
+		if (*slot) {
+			ace2 = (struct richace *)index_entry(&index, *slot - 1);
+			ace2->e_mask = ace->e_mask;
+			ace2->e_flags = ace->e_flags;
+		} else {
+			richace_copy(new_entries + n_new, ace);
+			*slot = index.count + ++n_new;
+		}
+	}
+
+	if (n_new) {
+		struct richacl *acl2;
+		struct richace *ace2;
+		enum insert_position pos;
+		unsigned int from = 0;
+
+		acl2 = richacl_alloc((*acl)->a_count + n_new);
+		if (!acl2)
+			goto out;
+		richacl_stat_add(entry_reallocs, 1);
+		acl2->a_flags = (*acl)->a_flags;
+		acl2->a_owner_mask = (*acl)->a_owner_mask;
+		acl2->a_group_mask = (*acl)->a_group_mask;
+		acl2->a_other_mask = (*acl)->a_other_mask;
+		insert_positions(*acl, where);
+		ace2 = acl2->a_entries;
+		for (pos = 0; pos < INSERT_POSITIONS; pos++) {
+			memcpy(ace2, (*acl)->a_entries + from,
+			       (where[pos] - from) * sizeof(*ace2));
+			ace2 += where[pos] - from;
+			from = where[pos];
+			for (n = 0; n < n_new; n++) {
+				if (insert_position(new_entries + n) == pos)
+					richace_copy(ace2++, new_entries + n);
+			}
+		}
+		richacl_free(*acl);
+		*acl = acl2;
+	}
+
+	if (changes_has & RICHACL_TEXT_FLAGS)
+		(*acl)->a_flags = changes->a_flags;
+	if (changes_has & RICHACL_TEXT_OWNER_MASK)
+		(*acl)->a_owner_mask = changes->a_owner_mask;
+	if (changes_has & RICHACL_TEXT_GROUP_MASK)
+		(*acl)->a_group_mask = changes->a_group_mask;
+	if (changes_has & RICHACL_TEXT_OTHER_MASK)
+		(*acl)->a_other_mask = changes->a_other_mask;
+	richacl_compute_masks(*acl, changes_has);
+	ret = 0;
+
+out:
+	free(new_entries);
+	if (slots != small_slots)
+		free(slots);
+	return ret;
+}
+
+/*
+ * What richacl_simplify() knows about the entries so far for one
+ * identifier.
+ */
+struct who_state {
+	int used;
+	int applied;		/* an entry for the identifier has applied */
+	unsigned short flags;	/* ACE4_SPECIAL_WHO and ACE4_IDENTIFIER_GROUP */
+	id_t id;
+	unsigned int decided;	/* permissions which are allowed or denied */
+	unsigned int allow_decided; /* ... for allow entries only */
+};
+
+#define WHO_FLAGS (ACE4_SPECIAL_WHO | ACE4_IDENTIFIER_GROUP)
+
+static struct who_state *who_lookup(struct who_state *index, unsigned int mask,
+				    const struct richace *ace)
+{
+	unsigned short flags = ace->e_flags & WHO_FLAGS;
+	unsigned int n;
+
+	for (n = mix((uint64_t)ace->e_id << 32 | flags); ; n++) {
+		struct who_state *who = index + (n & mask);
+
+		if (!who->used) {
+			who->used = 1;
+			who->flags = flags;
+			who->id = ace->e_id;
+			return who;
+		}
+		if (who->flags == flags && who->id == ace->e_id)
+			return who;
+	}
+}
+
+/*
+ * Allow entries other than OWNER@ and EVERYONE@ are limited by the group
+ * file mask.  In masked acls, these entries also put the processes they
+ * apply to in the group file class, even when their mask is empty.
+ */
+static inline int richace_is_masked(const struct richace *ace)
+{
+	return !richace_is_owner(ace) && !richace_is_everyone(ace);
+}
+
+/**
+ * richacl_simplify  -  remove redundant acl entries
+ *
+ * Remove entries which never apply to any process, permissions from
+ * entries which are always decided by previous entries, and entries
+ * which end up without permissions.  Merge adjacent entries which only
+ * differ in their permissions.
+ *
+ * Entries which are inherited by new files are left alone except for
+ * merging, and the file masks are not taken into account: the acl grants
+ * the same permissions as before even after the file masks are changed,
+ * for example by chmod().  The acl never grows.
+ *
+ * Returns 1 if @acl has changed, 0 if not, or -1 with errno set.
+ */
+int
+richacl_simplify(struct richacl *acl)
+{
+	struct who_state small_index[SMALL_INDEX / 4], *index = small_index;
+	struct richace *ace, *out = acl->a_entries;
+	unsigned int everyone_decided = 0, size;
+	int changed = 0;
+
+	for (size = 16; size < 2 * acl->a_count; size *= 2)
+		/* nothing */ ;
+	if (size > SMALL_INDEX / 4) {
+		index = malloc(sizeof(*index) * size);
+		if (!index)
+			return -1;
+	}
+	memset(index, 0, sizeof(*index) * size);
+
+	richacl_for_each_entry(ace, acl) {
+		struct richace entry = *ace;
+		struct who_state *who = NULL;
+		unsigned int decided;
+
+		if (richace_is_inheritable(&entry) ||
+		    (!richace_is_allow(&entry) && !richace_is_deny(&entry)))
+			goto keep;
+		if (richace_is_inherit_only(&entry) ||
+		    (everyone_decided & ACE4_VALID_MASK) == ACE4_VALID_MASK) {
+			/* Never inherited and never reached. */
+			changed = 1;
+			continue;
+		}
+
+		decided = everyone_decided;
+		if (!richace_is_everyone(&entry)) {
+			who = who_lookup(index, size - 1, &entry);
+			decided |= who->decided;
+			if (richace_is_allow(&entry))
+				decided |= who->allow_decided;
+		}
+		decided &= ACE4_VALID_MASK;
+		if (entry.e_mask & decided) {
+			entry.e_mask &= ~decided;
+			changed = 1;
+		}
+		if (!entry.e_mask &&
+		    (!richace_is_masked(&entry) || who->applied)) {
+			changed = 1;
+			continue;
+		}
+
+		if (!who)
+			everyone_decided |= entry.e_mask;
+		else {
+			if (richace_is_deny(&entry) ||
+			    !richace_is_masked(&entry))
+				who->decided |= entry.e_mask;
+			else
+				who->allow_decided |= entry.e_mask;
+			who->applied = 1;
+		}
+
+	keep:
+		if (out != acl->a_entries &&
+		    out[-1].e_type == entry.e_type &&
+		    out[-1].e_flags == entry.e_flags &&
+		    out[-1].e_id == entry.e_id) {
+			out[-1].e_mask |= entry.e_mask;
+			changed = 1;
+			continue;
+		}
+		*out++ = entry;
+	}
+	acl->a_count = out - acl->a_entries;
+
+	if (index != small_index)
+		free(index);
+	return changed;
+}
+
+/*
+ * The order of the entries in canonical acls: non-inherited entries first,
+ * then by identifier, flags, and mask.
+ */
+static int compare_entries(const void *a, const void *b)
+{
+	const struct richace *x = a, *y = b;
+
+	if (richace_is_inherited(x) != richace_is_inherited(y))
+		return richace_is_inherited(x) ? 1 : -1;
+	if ((x->e_flags & WHO_FLAGS) != (y->e_flags & WHO_FLAGS))
+		return (x->e_flags & WHO_FLAGS) > (y->e_flags & WHO_FLAGS) ?
+		       -1 : 1;
+	if (x->e_id != y->e_id)
+		return x->e_id < y->e_id ? -1 : 1;
+	if (x->e_flags != y->e_flags)
+		return x->e_flags < y->e_flags ? -1 : 1;
+	if (x->e_mask != y->e_mask)
+		return x->e_mask < y->e_mask ? -1 : 1;
+	return 0;
+}
+
+/*
+ * Can @ace trade places with the entries next to it of the same type?
+ * EVERYONE@ entries cannot: processes may stop evaluating the acl after
+ * them, and then not get to the entries which would put them in the group
+ * file class.
+ */
+static inline int is_movable(const struct richace *ace)
+{
+	return (richace_is_allow(ace) || richace_is_deny(ace)) &&
+	       !richace_is_everyone(ace);
+}
+
+/*
+ * Sort each run of adjacent movable entries of the same type.  The order
+ * of such entries does not matter, for access checks as well as for the
+ * acls of new files.  Returns whether any entries have moved.
+ */
+static int sort_entries(struct richacl *acl)
+{
+	struct richace *ace = acl->a_entries, *end = ace + acl->a_count;
+	int moved = 0;
+
+	while (ace != end) {
+		struct richace *run = ace, *x;
+
+		if (is_movable(ace)) {
+			while (++ace != end && is_movable(ace) &&
+			       ace->e_type == run->e_type)
+				/* nothing */ ;
+		} else
+			ace++;
+		for (x = run + 1; x < ace; x++) {
+			if (compare_entries(x - 1, x) > 0) {
+				qsort(run, ace - run, sizeof(*run),
+				      compare_entries);
+				moved = 1;
+				break;
+			}
+		}
+	}
+	return moved;
+}
+
+/**
+ * richacl_canonicalize  -  bring an acl into canonical form
+ *
+ * Simplify @acl with richacl_simplify(), and bring the entries whose order
+ * does not matter into a fixed order, until nothing changes anymore.
+ * Acls which only differ in such ways then end up the same, so that they
+ * compare equal with richacl_compare() and have the same richacl_hash().
+ * The acl flags and file masks are not changed.
+ *
+ * Returns 1 if @acl has changed, 0 if not, or -1 with errno set.
+ */
+int
+richacl_canonicalize(struct richacl *acl)
+{
+	int changed = 0, simplified, moved;
+
+	do {
+		simplified = richacl_simplify(acl);
+		if (simplified < 0)
+			return -1;
+		moved = sort_entries(acl);
+		changed |= simplified | moved;
+	} while (simplified || moved);
+	return changed;
+}
+
+/**
+ * richacl_compute_masks  -  compute the flags and masks not given explicitly
+ * @acl_has:	which of the flags and masks of @acl were given explicitly
+ *		(%RICHACL_TEXT_OWNER_MASK, ..., as from richacl_from_text())
+ *
+ * The masks which were not given are set to the maximum permissions.
+ * Unless the flags were given, %ACL4_MASKED is set when a given mask takes
+ * away permissions.
+ */
+void
+richacl_compute_masks(struct richacl *acl, int acl_has)
+{
+	unsigned int owner_mask = acl->a_owner_mask;
+	unsigned int group_mask = acl->a_group_mask;
+	unsigned int other_mask = acl->a_other_mask;
+
+	if ((acl_has & RICHACL_TEXT_OWNER_MASK) &&
+	    (acl_has & RICHACL_TEXT_GROUP_MASK) &&
+	    (acl_has & RICHACL_TEXT_OTHER_MASK) &&
+	    (acl_has & RICHACL_TEXT_FLAGS))
+		return;
+
+	if (!(acl_has & RICHACL_TEXT_FLAGS))
+		acl->a_flags &= ~ACL4_MASKED;
+	richacl_compute_max_masks(acl);
+	if (acl_has & RICHACL_TEXT_OWNER_MASK) {
+		if (!(acl_has & RICHACL_TEXT_FLAGS) &&
+		    (acl->a_owner_mask & ~owner_mask))
+			acl->a_flags |= ACL4_MASKED;
+		acl->a_owner_mask = owner_mask;
+	}
+	if (acl_has & RICHACL_TEXT_GROUP_MASK) {
+		if (!(acl_has & RICHACL_TEXT_FLAGS) &&
+		    (acl->a_group_mask & ~group_mask))
+			acl->a_flags |= ACL4_MASKED;
+		acl->a_group_mask = group_mask;
+	}
+	if (acl_has & RICHACL_TEXT_OTHER_MASK) {
+		if (!(acl_has & RICHACL_TEXT_FLAGS) &&
+		    (acl->a_other_mask & ~other_mask))
+			acl->a_flags |= ACL4_MASKED;
+		acl->a_other_mask = other_mask;
+	}
+}
@@ -0,0 +1,266 @@
+/*
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+/*
+ * The shared acl cache of richacl_get_file() and richacl_get_fd(): a
+ * direct-mapped hash table in a file which all processes on a host map.
+ * Each slot holds the xattr representation of the acl of one file
+ * (device and inode) in one attribute (system.richacl or user.richacl),
+ * together with the ctime of the file at the time the acl was read.  A
+ * slot can also record that the file has no acl.
+ *
+ * Readers do not take any locks: each slot has a sequence number which
+ * writers make odd while they update the slot, and readers retry or give
+ * up when the sequence number is odd or has changed while they copied the
+ * slot.  Writers which find a slot busy do not wait and skip the update.
+ * A writer which dies in the middle of an update leaves its slot unused
+ * until the cache file is recreated.
+ *
+ * Any process which can write to the cache file can make other processes
+ * see arbitrary acls; the file is created with mode 0600.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include "richacl.h"
+#include "richacl-internal.h"
+
+#define SHARED_CACHE_MAGIC	"richacl\n"
+#define SHARED_CACHE_VERSION	2
+
+struct shared_header {
+	char		h_magic[8];
+	uint32_t	h_version;
+	uint32_t	h_slot_size;
+	uint32_t	h_slots;	/* a power of two */
+	uint32_t	h_pad[3];
+};
+
+#define SLOT_NO_ACL		1	/* s_flags */
+#define SLOT_USER_XATTR		2	/* user.richacl, not system.richacl */
+
+struct shared_slot {
+	uint32_t	s_seq;		/* odd while being updated */
+	uint32_t	s_size;		/* of s_data */
+	uint32_t	s_flags;
+	uint32_t	s_ctime_nsec;
+	uint64_t	s_dev;
+	uint64_t	s_ino;		/* 0 for unused slots */
+	int64_t		s_ctime_sec;
+	unsigned char	s_data[472];	/* acls with up to 38 entries */
+};
+
+static struct shared_header *shared_header;
+static struct shared_slot *shared_slots;
+static size_t shared_mask, shared_map_size;
+
+static size_t slot_index(dev_t dev, ino_t ino)
+{
+	uint64_t x = ino ^ ((uint64_t)dev << 32);
+
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdULL;
+	x ^= x >> 33;
+	return x & shared_mask;
+}
+
+/* Can richacl_get_file() and richacl_get_fd() cache the acls of @backend? */
+int richacl_shared_cache_usable(const struct richacl_backend *backend)
+{
+	return shared_slots && (backend == &richacl_xattr_backend ||
+				backend == &richacl_user_xattr_backend);
+}
+
+/* The slot flags which identify the attribute @backend stores acls in. */
+static uint32_t backend_flags(const struct richacl_backend *backend)
+{
+	return backend == &richacl_user_xattr_backend ? SLOT_USER_XATTR : 0;
+}
+
+/*
+ * Look up the acl which @backend has for the file @st refers to.  Returns
+ * 1 on a hit, with the acl in @acl, or with @acl set to %NULL and errno
+ * set to %ENODATA if the file has no acl.  Returns 0 otherwise.
+ */
+int richacl_shared_cache_lookup(const struct richacl_backend *backend,
+				const struct stat *st, struct richacl **acl)
+{
+	struct shared_slot *slot = &shared_slots[slot_index(st->st_dev,
+							    st->st_ino)];
+	unsigned char data[sizeof(slot->s_data)];
+	uint32_t seq, size, flags;
+
+	seq = __atomic_load_n(&slot->s_seq, __ATOMIC_ACQUIRE);
+	if ((seq & 1) ||
+	    slot->s_ino != st->st_ino || slot->s_dev != st->st_dev ||
+	    slot->s_ctime_sec != st->st_ctim.tv_sec ||
+	    slot->s_ctime_nsec != st->st_ctim.tv_nsec)
+		goto miss;
+	size = slot->s_size;
+	flags = slot->s_flags;
+	if (size > sizeof(data) ||
+	    (flags & SLOT_USER_XATTR) != backend_flags(backend))
+		goto miss;
+	memcpy(data, slot->s_data, size);
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	if (__atomic_load_n(&slot->s_seq, __ATOMIC_RELAXED) != seq)
+		goto miss;
+
+	if (flags & SLOT_NO_ACL) {
+		*acl = NULL;
+		errno = ENODATA;
+	} else {
+		*acl = richacl_from_xattr(data, size);
+		if (!*acl)
+			goto miss;
+	}
+	richacl_stat_add(shared_cache_hits, 1);
+	return 1;
+
+miss:
+	richacl_stat_add(shared_cache_misses, 1);
+	return 0;
+}
+
+/*
+ * Remember the acl which @backend has for the file @st refers to: @value
+ * and @size are the xattr representation, or %NULL and 0 if the file has
+ * no acl.  @st must have been obtained from the same open file as the acl,
+ * before the acl was read.
+ */
+void richacl_shared_cache_insert(const struct richacl_backend *backend,
+				 const struct stat *st, const void *value,
+				 size_t size)
+{
+	struct shared_slot *slot;
+	uint32_t seq;
+
+	if (size > sizeof(slot->s_data) ||
+	    time(NULL) - st->st_ctim.tv_sec < CACHE_RACY_SECONDS)
+		return;
+	slot = &shared_slots[slot_index(st->st_dev, st->st_ino)];
+	seq = __atomic_load_n(&slot->s_seq, __ATOMIC_RELAXED);
+	if ((seq & 1) ||
+	    !__atomic_compare_exchange_n(&slot->s_seq, &seq, seq + 1, 0,
+					 __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+		return;
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	slot->s_dev = st->st_dev;
+	slot->s_ino = st->st_ino;
+	slot->s_ctime_sec = st->st_ctim.tv_sec;
+	slot->s_ctime_nsec = st->st_ctim.tv_nsec;
+	slot->s_flags = (value ? 0 : SLOT_NO_ACL) | backend_flags(backend);
+	slot->s_size = size;
+	memcpy(slot->s_data, value, size);
+	__atomic_store_n(&slot->s_seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+/**
+ * richacl_shared_cache_open  -  share the acls read with other processes
+ * @path:	the cache file, for example in /dev/shm
+ * @slots:	number of acls to cache when creating the cache file
+ *
+ * Map the cache file at @path, creating it if necessary, and use it in
+ * richacl_get_file() and richacl_get_fd().  When the cache is in use,
+ * those functions stat the file and only read the acl when the cache does
+ * not have the acl for the current ctime of the file; richacl_get_file()
+ * opens regular files and directories for that, so that the status and
+ * the acl are from the same file.  The acls of other files are not
+ * cached.  This pays off when the acls are large or reading them is
+ * expensive.
+ *
+ * Only the xattr backends are cached.  Like richacl_set_backend(), this
+ * is not synchronized against concurrent acl operations.
+ */
+int richacl_shared_cache_open(const char *path, size_t slots)
+{
+	struct shared_header header;
+	struct stat st;
+	size_t n, size;
+	void *map;
+	int fd, saved_errno;
+
+	fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+	if (fd < 0)
+		return -1;
+	if (flock(fd, LOCK_EX) || fstat(fd, &st))
+		goto fail;
+	if (st.st_size == 0) {
+		for (n = 64; n < slots; n *= 2)
+			;
+		memset(&header, 0, sizeof(header));
+		memcpy(header.h_magic, SHARED_CACHE_MAGIC,
+		       sizeof(header.h_magic));
+		header.h_version = SHARED_CACHE_VERSION;
+		header.h_slot_size = sizeof(struct shared_slot);
+		header.h_slots = n;
+		size = sizeof(struct shared_slot) * (n + 1);
+		if (ftruncate(fd, size) ||
+		    pwrite(fd, &header, sizeof(header), 0) != sizeof(header))
+			goto fail;
+	} else {
+		if (pread(fd, &header, sizeof(header), 0) != sizeof(header))
+			goto fail;
+		n = header.h_slots;
+		size = sizeof(struct shared_slot) * (n + 1);
+		if (memcmp(header.h_magic, SHARED_CACHE_MAGIC,
+			   sizeof(header.h_magic)) ||
+		    header.h_version != SHARED_CACHE_VERSION ||
+		    header.h_slot_size != sizeof(struct shared_slot) ||
+		    n == 0 || (n & (n - 1)) || st.st_size != size) {
+			errno = EINVAL;
+			goto fail;
+		}
+	}
+	map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED)
+		goto fail;
+	close(fd);
+
+	richacl_shared_cache_close();
+	shared_header = map;
+	/* The header occupies the first slot. */
+	shared_slots = (struct shared_slot *)map + 1;
+	shared_mask = n - 1;
+	shared_map_size = size;
+	return 0;
+
+fail:
+	saved_errno = errno;
+	close(fd);
+	errno = saved_errno;
+	return -1;
+}
+
+/**
+ * richacl_shared_cache_close  -  stop using the shared acl cache
+ */
+void richacl_shared_cache_close(void)
+{
+	if (!shared_header)
+		return;
+	munmap(shared_header, shared_map_size);
+	shared_header = NULL;
+	shared_slots = NULL;
+}
@@ -0,0 +1,52 @@
+/*
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+#include <string.h>
+#include "richacl.h"
+#include "richacl-internal.h"
+
+int richacl_stats_enabled;
+__thread struct richacl_stats richacl_thread_stats;
+
+/**
+ * richacl_stats_enable  -  turn performance counting on or off
+ * @enable:	nonzero to count
+ *
+ * Returns whether counting was enabled before.  Counting costs a test and
+ * branch per counted event when disabled, and a thread-local increment
+ * when enabled.
+ */
+int richacl_stats_enable(int enable)
+{
+	return __atomic_exchange_n(&richacl_stats_enabled, !!enable,
+				   __ATOMIC_RELAXED);
+}
+
+/**
+ * richacl_stats_get  -  get the performance counters of the calling thread
+ */
+void richacl_stats_get(struct richacl_stats *stats)
+{
+	*stats = richacl_thread_stats;
+}
+
+/**
+ * richacl_stats_reset  -  reset the performance counters of the calling thread
+ */
+void richacl_stats_reset(void)
+{
+	memset(&richacl_thread_stats, 0, sizeof(richacl_thread_stats));
+}
@@ -23,6 +23,7 @@
 #include <ctype.h>
 #include <alloca.h>
 #include <errno.h>
+#include <unistd.h>
 #include <pwd.h>
 #include <grp.h>
 #include "string_buffer.h"
@@ -306,11 +307,112 @@ static void write_mask(struct string_buffer *buffer, uint32_t mask, int fmt)
 	}
 }
 
-static void write_identifier(struct string_buffer *buffer,
-			     const struct richace *ace, int align, int fmt)
+/*
+ * Space for the reentrant user and group database functions.  Most entries
+ * fit into the inline buffer; larger ones are allocated.
+ */
+struct name_buffer {
+	char *buf;
+	size_t size;
+	char space[1024];
+};
+
+static void init_name_buffer(struct name_buffer *nb)
+{
+	nb->buf = nb->space;
+	nb->size = sizeof(nb->space);
+}
+
+static void free_name_buffer(struct name_buffer *nb)
+{
+	if (nb->buf != nb->space)
+		free(nb->buf);
+}
+
+static int grow_name_buffer(struct name_buffer *nb)
 {
-	/* FIXME: switch to getpwuid_r() and getgrgid_r() here. */
+	size_t size = nb->size * 2;
+	char *buf;
+
+	if (nb->buf == nb->space)
+		buf = malloc(size);
+	else
+		buf = realloc(nb->buf, size);
+	if (!buf)
+		return -1;
+	nb->buf = buf;
+	nb->size = size;
+	return 0;
+}
+
+/* Returns the name of a user or group, or NULL if there is none. */
+static const char *id_to_name(id_t id, int is_group, struct name_buffer *nb)
+{
+	int err;
+
+	richacl_stat_add(id_lookups, 1);
+	for (;;) {
+		if (is_group) {
+			struct group group, *result;
+
+			err = getgrgid_r(id, &group, nb->buf, nb->size,
+					 &result);
+			if (!err && result)
+				return result->gr_name;
+		} else {
+			struct passwd passwd, *result;
+
+			err = getpwuid_r(id, &passwd, nb->buf, nb->size,
+					 &result);
+			if (!err && result)
+				return result->pw_name;
+		}
+		if (err != ERANGE || grow_name_buffer(nb))
+			return NULL;
+	}
+}
+
+/* Returns 0 and the id of a user or group, or -1 if there is none. */
+static int name_to_id(const char *name, int is_group, id_t *id)
+{
+	struct name_buffer nb;
+	int err, ret = -1;
+
+	richacl_stat_add(id_lookups, 1);
+	init_name_buffer(&nb);
+	for (;;) {
+		if (is_group) {
+			struct group group, *result;
+
+			err = getgrnam_r(name, &group, nb.buf, nb.size,
+					 &result);
+			if (!err && result) {
+				*id = result->gr_gid;
+				ret = 0;
+				break;
+			}
+		} else {
+			struct passwd passwd, *result;
 
+			err = getpwnam_r(name, &passwd, nb.buf, nb.size,
+					 &result);
+			if (!err && result) {
+				*id = result->pw_uid;
+				ret = 0;
+				break;
+			}
+		}
+		if (err != ERANGE || grow_name_buffer(&nb))
+			break;
+	}
+	free_name_buffer(&nb);
+	return ret;
+}
+
+static void write_identifier(struct string_buffer *buffer,
+			     const struct richace *ace, int align, int fmt,
+			     struct name_buffer *nb)
+{
 	if (ace->e_flags & ACE4_SPECIAL_WHO) {
 		const char *id = NULL;
 		char *dup, *c;
@@ -332,33 +434,28 @@ static void write_identifier(struct string_buffer *buffer,
 			*c = tolower(*c);
 
 		buffer_sprintf(buffer, "%*s", align, dup);
-	} else if (ace->e_flags & ACE4_IDENTIFIER_GROUP) {
-		struct group *group = NULL;
-
-		if (!(fmt & RICHACL_TEXT_NUMERIC_IDS))
-			group = getgrgid(ace->e_id);
-		if (group)
-			buffer_sprintf(buffer, "%*s", align, group->gr_name);
-		else
-			buffer_sprintf(buffer, "%*d", align, ace->e_id);
 	} else {
-		struct passwd *passwd = NULL;
+		const char *name = NULL;
 
 		if (!(fmt & RICHACL_TEXT_NUMERIC_IDS))
-			passwd = getpwuid(ace->e_id);
-		if (passwd)
-			buffer_sprintf(buffer, "%*s", align, passwd->pw_name);
+			name = id_to_name(ace->e_id,
+					  ace->e_flags & ACE4_IDENTIFIER_GROUP,
+					  nb);
+		if (name)
+			buffer_sprintf(buffer, "%*s", align, name);
 		else
 			buffer_sprintf(buffer, "%*d", align, ace->e_id);
 	}
 }
 
-char *richacl_to_text(const struct richacl *acl, int fmt)
+static void write_acl_text(struct string_buffer *buffer,
+			   const struct richacl *acl, int fmt)
 {
-	struct string_buffer *buffer;
 	const struct richace *ace;
+	struct name_buffer nb;
 	int fmt2, align = 0;
 
+	init_name_buffer(&nb);
 	if (fmt & RICHACL_TEXT_ALIGN) {
 		if (acl->a_flags && align < 6)
 			align = 6;
@@ -370,22 +467,15 @@ char *richacl_to_text(const struct richacl *acl, int fmt)
 				a = 6;
 			else if (richace_is_everyone(ace))
 				a = 9;
-			else if (ace->e_flags & ACE4_IDENTIFIER_GROUP) {
-				struct group *group = NULL;
+			else {
+				const char *name = NULL;
 
 				if (!(fmt & RICHACL_TEXT_NUMERIC_IDS))
-					group = getgrgid(ace->e_id);
-				if (group)
-					a = strlen(group->gr_name);
-				else
-					a = snprintf(NULL, 0, "%d", ace->e_id);
-			} else {
-				struct passwd *passwd = NULL;
-
-				if (!(fmt & RICHACL_TEXT_NUMERIC_IDS))
-					passwd = getpwuid(ace->e_id);
-				if (passwd)
-					a = strlen(passwd->pw_name);
+					name = id_to_name(ace->e_id,
+						ace->e_flags & ACE4_IDENTIFIER_GROUP,
+						&nb);
+				if (name)
+					a = strlen(name);
 				else
 					a = snprintf(NULL, 0, "%d", ace->e_id);
 			}
@@ -394,10 +484,6 @@ char *richacl_to_text(const struct richacl *acl, int fmt)
 		}
 	}
 
-	buffer = alloc_string_buffer(128);
-	if (!buffer)
-		return NULL;
-
 	write_acl_flags(buffer, acl->a_flags, align, fmt);
 	if (fmt & RICHACL_TEXT_SHOW_MASKS) {
 		unsigned int allowed = 0;
@@ -431,7 +517,7 @@ char *richacl_to_text(const struct richacl *acl, int fmt)
 	}
 
 	richacl_for_each_entry(ace, acl) {
-		write_identifier(buffer, ace, align, fmt);
+		write_identifier(buffer, ace, align, fmt, &nb);
 		buffer_sprintf(buffer, ":");
 
 		fmt2 = fmt;
@@ -450,6 +536,17 @@ char *richacl_to_text(const struct richacl *acl, int fmt)
 		write_type(buffer, ace->e_type);
 		buffer_sprintf(buffer, "\n");
 	}
+	free_name_buffer(&nb);
+}
+
+char *richacl_to_text(const struct richacl *acl, int fmt)
+{
+	struct string_buffer *buffer;
+
+	buffer = alloc_string_buffer(128);
+	if (!buffer)
+		return NULL;
+	write_acl_text(buffer, acl, fmt);
 
 	if (string_buffer_okay(buffer)) {
 		char *str = realloc(buffer->buffer, buffer->offset + 1);
@@ -462,6 +559,72 @@ char *richacl_to_text(const struct richacl *acl, int fmt)
 	return NULL;
 }
 
+/* Large enough for most acls, so that they are written in a single call. */
+#define TEXT_BUFFER_SIZE 1024
+
+/**
+ * richacl_write_text  -  pass the text form of an acl to a callback
+ * @write:	called with consecutive pieces of the text; returns 0, or -1
+ *		with errno set to stop
+ * @arg:	passed through to @write
+ *
+ * Produces the same text as richacl_to_text(), but without allocating
+ * memory for the whole text.  Returns 0, or -1 with errno set.
+ */
+int richacl_write_text(const struct richacl *acl, int fmt,
+		       int (*write)(void *, const char *, size_t), void *arg)
+{
+	struct string_buffer buffer;
+	char buf[TEXT_BUFFER_SIZE];
+
+	init_flushing_buffer(&buffer, buf, sizeof(buf), write, arg);
+	write_acl_text(&buffer, acl, fmt);
+	return flush_string_buffer(&buffer);
+}
+
+static int write_to_file(void *arg, const char *str, size_t len)
+{
+	FILE *file = arg;
+
+	if (fwrite(str, 1, len, file) != len)
+		return -1;
+	return 0;
+}
+
+static int write_to_fd(void *arg, const char *str, size_t len)
+{
+	int fd = *(int *)arg;
+
+	while (len) {
+		ssize_t ret = write(fd, str, len);
+
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		str += ret;
+		len -= ret;
+	}
+	return 0;
+}
+
+/**
+ * richacl_fprint_text  -  write the text form of an acl to a stdio stream
+ */
+int richacl_fprint_text(const struct richacl *acl, int fmt, FILE *file)
+{
+	return richacl_write_text(acl, fmt, write_to_file, file);
+}
+
+/**
+ * richacl_dprint_text  -  write the text form of an acl to a file descriptor
+ */
+int richacl_dprint_text(const struct richacl *acl, int fmt, int fd)
+{
+	return richacl_write_text(acl, fmt, write_to_fd, &fd);
+}
+
 static int acl_flags_from_text(const char *str, struct richacl *acl,
 			       void (*error)(const char *, ...))
 {
@@ -552,22 +715,16 @@ static int identifier_from_text(const char *str, struct richace *ace,
 		return 0;
 	}
 	if (ace->e_flags & ACE4_IDENTIFIER_GROUP) {
-		struct group *group = getgrnam(str);
-
-		if (!group) {
+		if (name_to_id(str, 1, &ace->e_id)) {
 			error("Group `%s' does not exist\n", str);
 			goto fail;
 		}
-		ace->e_id = group->gr_gid;
 		return 0;
 	} else {
-		struct passwd *passwd = getpwnam(str);
-
-		if (!passwd) {
+		if (name_to_id(str, 0, &ace->e_id)) {
 			error("User `%s' does not exist\n", str);
 			goto fail;
 		}
-		ace->e_id = passwd->pw_uid;
 		return 0;
 	}
 fail:
@@ -883,4 +1040,31 @@ char *richacl_mask_to_text(unsigned int mask, int fmt)
 	return NULL;
 }
 
+/**
+ * richacl_write_mask_text  -  pass the text form of a mask to a callback
+ *
+ * See richacl_write_text().
+ */
+int richacl_write_mask_text(unsigned int mask, int fmt,
+			    int (*write)(void *, const char *, size_t),
+			    void *arg)
+{
+	struct string_buffer buffer;
+	char buf[TEXT_BUFFER_SIZE];
+
+	init_flushing_buffer(&buffer, buf, sizeof(buf), write, arg);
+	write_mask(&buffer, mask, fmt);
+	return flush_string_buffer(&buffer);
+}
+
+int richacl_fprint_mask_text(unsigned int mask, int fmt, FILE *file)
+{
+	return richacl_write_mask_text(mask, fmt, write_to_file, file);
+}
+
+int richacl_dprint_mask_text(unsigned int mask, int fmt, int fd)
+{
+	return richacl_write_mask_text(mask, fmt, write_to_fd, &fd);
+}
+
 
@@ -17,16 +17,26 @@
   Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
 */
 
+#include <sys/stat.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <alloca.h>
 #include <errno.h>
-#include <attr/xattr.h>
 #include "richacl.h"
 #include "richacl_xattr.h"
 #include "richacl-internal.h"
+#include "richacl_probes.h"
 #include "byteorder.h"
 
-static struct richacl *richacl_from_xattr(const void *value, size_t size)
+/**
+ * richacl_from_xattr  -  decode the xattr representation of an acl
+ * @value:	xattr value as stored in the system.richacl attribute
+ * @size:	size of @value in bytes
+ *
+ * Returns a newly allocated acl, or %NULL with errno set to %EINVAL if
+ * @value is not a valid acl.
+ */
+struct richacl *richacl_from_xattr(const void *value, size_t size)
 {
 	const struct richacl_xattr *xattr_acl = value;
 	const struct richace_xattr *xattr_ace = (void *)(xattr_acl + 1);
@@ -34,6 +44,7 @@ static struct richacl *richacl_from_xattr(const void *value, size_t size)
 	struct richace *ace;
 	int count;
 
+	richacl_stat_add(decodes, 1);
 	if (size < sizeof(struct richacl_xattr) ||
 	    xattr_acl->a_version != ACL4_XATTR_VERSION ||
 	    (xattr_acl->a_flags & ~ACL4_VALID_FLAGS))
@@ -72,7 +83,10 @@ fail_einval:
 	return NULL;
 }
 
-static size_t richacl_xattr_size(const struct richacl *acl)
+/**
+ * richacl_xattr_size  -  size of the xattr representation of @acl
+ */
+size_t richacl_xattr_size(const struct richacl *acl)
 {
 	size_t size = sizeof(struct richacl_xattr);
 
@@ -80,12 +94,17 @@ static size_t richacl_xattr_size(const struct richacl *acl)
 	return size;
 }
 
-static void richacl_to_xattr(const struct richacl *acl, void *buffer)
+/**
+ * richacl_to_xattr  -  encode @acl in its xattr representation
+ * @buffer:	must be at least richacl_xattr_size(@acl) bytes large
+ */
+void richacl_to_xattr(const struct richacl *acl, void *buffer)
 {
 	struct richacl_xattr *xattr_acl = buffer;
 	struct richace_xattr *xattr_ace;
 	const struct richace *ace;
 
+	richacl_stat_add(encodes, 1);
 	xattr_acl->a_version = ACL4_XATTR_VERSION;
 	xattr_acl->a_flags = acl->a_flags;
 	xattr_acl->a_count = cpu_to_le16(acl->a_count);
@@ -105,58 +124,201 @@ static void richacl_to_xattr(const struct richacl *acl, void *buffer)
 	}
 }
 
+static inline uint64_t hash_word(uint64_t hash, uint32_t word)
+{
+	hash = (hash ^ word) * 0x9e3779b97f4a7c15ULL;
+	return hash ^ (hash >> 29);
+}
+
+/**
+ * richacl_hash  -  compute a 64-bit fingerprint of an acl
+ *
+ * The fingerprint is computed over the xattr representation of @acl (see
+ * richacl_to_xattr()) taken as a sequence of little-endian 32-bit words,
+ * without actually encoding @acl.  It is the same on all platforms, and
+ * acls with the same xattr representation have the same fingerprint.
+ * Use richacl_canonicalize() first to get the same fingerprint for all
+ * acls which grant the same permissions in the same way.
+ *
+ * This is not a cryptographic hash.
+ */
+uint64_t richacl_hash(const struct richacl *acl)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	const struct richace *ace;
+
+	hash = hash_word(hash, ACL4_XATTR_VERSION | acl->a_flags << 8 |
+			       (uint32_t)acl->a_count << 16);
+	hash = hash_word(hash, acl->a_owner_mask);
+	hash = hash_word(hash, acl->a_group_mask);
+	hash = hash_word(hash, acl->a_other_mask);
+	richacl_for_each_entry(ace, acl) {
+		hash = hash_word(hash, ace->e_type |
+				 (uint32_t)(ace->e_flags & ACE4_VALID_FLAGS) << 16);
+		hash = hash_word(hash, ace->e_mask);
+		hash = hash_word(hash, ace->e_id);
+	}
+
+	/* Finalize as in MurmurHash3. */
+	hash ^= hash >> 33;
+	hash *= 0xff51afd7ed558ccdULL;
+	hash ^= hash >> 33;
+	hash *= 0xc4ceb9fe1a85ec53ULL;
+	hash ^= hash >> 33;
+	return hash;
+}
+
+/*
+ * Read the acl of the open file @fd, using the shared cache when it is in
+ * use.  Returns the size of the xattr representation of the acl in
+ * *@retval, or -1.
+ */
+static struct richacl *get_fd(const struct richacl_backend *backend, int fd,
+			      ssize_t *retval)
+{
+	void *value = NULL;
+	struct richacl *acl = NULL;
+	struct stat st;
+	int cached = 0;
+
+	if (richacl_shared_cache_usable(backend) && fstat(fd, &st) == 0) {
+		cached = 1;
+		if (richacl_shared_cache_lookup(backend, &st, &acl)) {
+			*retval = acl ? richacl_xattr_size(acl) : -1;
+			return acl;
+		}
+	}
+	richacl_stat_add(xattr_gets, 1);
+	*retval = backend->get_fd(backend, fd, NULL, 0);
+	if (*retval <= 0)
+		goto out_cache;
+
+	value = alloca(*retval);
+	if (!value)
+		return NULL;
+	richacl_stat_add(xattr_gets, 1);
+	*retval = backend->get_fd(backend, fd, value, *retval);
+	if (*retval > 0)
+		richacl_stat_add(xattr_bytes_read, *retval);
+	acl = richacl_from_xattr(value, *retval);
+
+out_cache:
+	if (cached && (acl || (*retval < 0 && errno == ENODATA))) {
+		int saved_errno = errno;
+
+		richacl_shared_cache_insert(backend, &st, acl ? value : NULL,
+					    acl ? *retval : 0);
+		errno = saved_errno;
+	}
+	return acl;
+}
+
 struct richacl *richacl_get_file(const char *path)
 {
-	void *value;
+	const struct richacl_backend *backend = richacl_get_backend();
+	void *value = NULL;
 	ssize_t retval;
-	struct richacl *acl;
-
-	retval = getxattr(path, SYSTEM_RICHACL, NULL, 0);
+	struct richacl *acl = NULL;
+	struct stat st;
+
+	RICHACL_PROBE1(librichacl, get__start, path);
+	if (richacl_shared_cache_usable(backend) && stat(path, &st) == 0 &&
+	    (S_ISREG(st.st_mode) || S_ISDIR(st.st_mode))) {
+		int fd, saved_errno;
+
+		/*
+		 * Stat the file and read its acl through the same file
+		 * descriptor, so that the cache entry is for the file which
+		 * the acl was read from.  Only regular files and directories
+		 * are opened: opening devices can have side effects.  Other
+		 * files, and files which cannot be opened, are not cached.
+		 */
+		fd = open(path, O_RDONLY | O_NONBLOCK | O_NOCTTY | O_CLOEXEC);
+		if (fd >= 0) {
+			acl = get_fd(backend, fd, &retval);
+			saved_errno = errno;
+			close(fd);
+			errno = saved_errno;
+			goto out;
+		}
+	}
+	richacl_stat_add(xattr_gets, 1);
+	retval = backend->get_file(backend, path, NULL, 0);
 	if (retval <= 0)
-		return NULL;
+		goto out;
 
 	value = alloca(retval);
 	if (!value)
-		return NULL;
-	retval = getxattr(path, SYSTEM_RICHACL, value, retval);
+		goto out;
+	richacl_stat_add(xattr_gets, 1);
+	retval = backend->get_file(backend, path, value, retval);
+	if (retval > 0)
+		richacl_stat_add(xattr_bytes_read, retval);
 	acl = richacl_from_xattr(value, retval);
 
+out:
+	RICHACL_PROBE2(librichacl, get__done, path, retval);
 	return acl;
 }
 
 struct richacl *richacl_get_fd(int fd)
 {
-	void *value;
+	const struct richacl_backend *backend = richacl_get_backend();
 	ssize_t retval;
 	struct richacl *acl;
 
-	retval = fgetxattr(fd, SYSTEM_RICHACL, NULL, 0);
-	if (retval <= 0)
-		return NULL;
-
-	value = alloca(retval);
-	if (!value)
-		return NULL;
-	retval = fgetxattr(fd, SYSTEM_RICHACL, value, retval);
-	acl = richacl_from_xattr(value, retval);
-
+	RICHACL_PROBE1(librichacl, get__fd__start, fd);
+	acl = get_fd(backend, fd, &retval);
+	RICHACL_PROBE2(librichacl, get__fd__done, fd, retval);
 	return acl;
 }
 
 int richacl_set_file(const char *path, const struct richacl *acl)
 {
+	const struct richacl_backend *backend = richacl_get_backend();
 	size_t size = richacl_xattr_size(acl);
 	void *value = alloca(size);
 
+	int retval;
+
+	RICHACL_PROBE2(librichacl, set__start, path, size);
 	richacl_to_xattr(acl, value);
-	return setxattr(path, SYSTEM_RICHACL, value, size, 0);
+	richacl_stat_add(xattr_sets, 1);
+	richacl_stat_add(xattr_bytes_written, size);
+	retval = backend->set_file(backend, path, value, size);
+	RICHACL_PROBE2(librichacl, set__done, path, retval);
+	return retval;
 }
 
 int richacl_set_fd(int fd, const struct richacl *acl)
 {
+	const struct richacl_backend *backend = richacl_get_backend();
 	size_t size = richacl_xattr_size(acl);
 	void *value = alloca(size);
 
+	int retval;
+
+	RICHACL_PROBE2(librichacl, set__fd__start, fd, size);
 	richacl_to_xattr(acl, value);
-	return fsetxattr(fd, SYSTEM_RICHACL, value, size, 0);
+	richacl_stat_add(xattr_sets, 1);
+	richacl_stat_add(xattr_bytes_written, size);
+	retval = backend->set_fd(backend, fd, value, size);
+	RICHACL_PROBE2(librichacl, set__fd__done, fd, retval);
+	return retval;
+}
+
+int richacl_remove_file(const char *path)
+{
+	const struct richacl_backend *backend = richacl_get_backend();
+
+	richacl_stat_add(xattr_removes, 1);
+	return backend->remove_file(backend, path);
+}
+
+int richacl_remove_fd(int fd)
+{
+	const struct richacl_backend *backend = richacl_get_backend();
+
+	richacl_stat_add(xattr_removes, 1);
+	return backend->remove_fd(backend, fd);
 }
@@ -40,6 +40,7 @@ struct richacl_xattr {
 };
 
 #define SYSTEM_RICHACL		"system.richacl"
+#define USER_RICHACL		"user.richacl"
 #define ACL4_XATTR_VERSION	0
 #define ACL4_XATTR_MAX_COUNT	1024
 
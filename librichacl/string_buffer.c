@@ -20,6 +20,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdarg.h>
+#include <string.h>
 #include "string_buffer.h"
 
 struct string_buffer *alloc_string_buffer(size_t size)
@@ -27,6 +28,7 @@ struct string_buffer *alloc_string_buffer(size_t size)
 	struct string_buffer *buffer = malloc(sizeof(struct string_buffer));
 
 	if (buffer) {
+		memset(buffer, 0, sizeof(*buffer));
 		buffer->buffer = malloc(size);
 		if (!buffer->buffer) {
 			free(buffer);
@@ -40,6 +42,40 @@ struct string_buffer *alloc_string_buffer(size_t size)
 	return buffer;
 }
 
+/**
+ * init_flushing_buffer  -  set up a buffer which is flushed instead of grown
+ * @buf:	the memory to use, owned by the caller
+ * @flush:	called with the contents when @buf is full, and from
+ *		flush_string_buffer(); returns 0, or -1 with errno set
+ *
+ * After an error, string_buffer_okay() is false.
+ */
+void init_flushing_buffer(struct string_buffer *buffer, char *buf, size_t size,
+			  int (*flush)(void *, const char *, size_t), void *arg)
+{
+	buffer->buffer = buf;
+	buffer->buffer[0] = 0;
+	buffer->offset = 0;
+	buffer->size = size;
+	buffer->flush = flush;
+	buffer->flush_arg = arg;
+}
+
+/* Pass the contents of a flushing buffer on, and empty it. */
+int flush_string_buffer(struct string_buffer *buffer)
+{
+	if (!string_buffer_okay(buffer))
+		return -1;
+	if (buffer->offset &&
+	    buffer->flush(buffer->flush_arg, buffer->buffer, buffer->offset)) {
+		/* The memory belongs to the caller. */
+		buffer->buffer = NULL;
+		return -1;
+	}
+	reset_string_buffer(buffer);
+	return 0;
+}
+
 void reset_string_buffer(struct string_buffer *buffer)
 {
 	buffer->buffer[0] = 0;
@@ -74,6 +110,28 @@ char *buffer_sprintf(struct string_buffer *buffer, const char *format, ...)
 		if (needed < buffer->size - buffer->offset)
 			break;
 
+		if (buffer->flush) {
+			char *str;
+
+			if (buffer->offset) {
+				if (flush_string_buffer(buffer))
+					goto out;
+				continue;
+			}
+			/* Too long for the buffer even when empty. */
+			va_copy(aq, ap);
+			needed = vasprintf(&str, format, aq);
+			va_end(aq);
+			if (needed < 0) {
+				buffer->buffer = NULL;
+				goto out;
+			}
+			if (buffer->flush(buffer->flush_arg, str, needed))
+				buffer->buffer = NULL;
+			free(str);
+			goto out;
+		}
+
 		new_size = buffer->size * 2;
 		if (new_size < buffer->offset + needed + 1)
 			new_size = buffer->offset + needed + 1;
@@ -0,0 +1,13 @@
+AC_DEFUN([AC_PACKAGE_WANT_IO_URING],
+  [ AC_MSG_CHECKING([for io_uring xattr operations])
+    AC_TRY_COMPILE([
+#include <sys/syscall.h>
+#include <linux/io_uring.h>],
+    [ struct io_uring_sqe sqe;
+      sqe.addr3 = 0;
+      sqe.xattr_flags = 0;
+      return __NR_io_uring_setup + IORING_OP_GETXATTR + IORING_OP_SETXATTR; ],
+    [ have_io_uring=yes ], [ have_io_uring=no ])
+    AC_MSG_RESULT($have_io_uring)
+    AC_SUBST(have_io_uring)
+  ])
@@ -0,0 +1,12 @@
+AC_DEFUN([AC_PACKAGE_WANT_SYS_SDT_H],
+  [ if test "$enable_sdt" = "yes"; then
+        AC_CHECK_HEADERS([sys/sdt.h])
+        if test "$ac_cv_header_sys_sdt_h" != "yes"; then
+            echo
+            echo 'FATAL ERROR: sys/sdt.h does not exist.'
+            echo 'Install the systemtap SDT development package, or'
+            echo 'configure with --enable-sdt=no.'
+            exit 1
+        fi
+    fi
+  ])
@@ -0,0 +1,397 @@
+/*
+  Copyright (C) 2006, 2008, 2009, 2010  Novell, Inc.
+  Written by Andreas Gruenbacher <agruen@suse.de>
+
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; either version 2, or (at your option) any
+  later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along
+  with this library; if not, write to the Free Software Foundation, Inc.,
+  59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/xattr.h>
+
+#include "richacl.h"
+#include "richacl_probes.h"
+#include "auto_inherit.h"
+#include "journal.h"
+#include "scan.h"
+
+/* Number of directory entries processed at once */
+#define AUTO_INHERIT_CHUNK 256
+
+/* Maximum number of acl operations in flight */
+#define AUTO_INHERIT_DEPTH 64
+
+/*
+ * Fingerprint of the inheritable entries last propagated below a
+ * directory, as a 64-bit little-endian number.
+ */
+#define PROPAGATED_XATTR "user.richacl.propagated"
+
+int opt_repropagate;
+int opt_incremental;
+
+struct walk_entry {
+	char *path;
+	int isdir;
+	int error;
+	int changed;
+	int recurse;
+	struct richacl *old_acl, *new_acl;
+};
+
+static void get_done(void *arg, struct richacl *acl, int error)
+{
+	struct walk_entry *entry = arg;
+
+	entry->old_acl = acl;
+	entry->error = error;
+}
+
+static void set_done(void *arg, struct richacl *acl, int error)
+{
+	struct walk_entry *entry = arg;
+
+	entry->error = error;
+}
+
+static int auto_inherit_dir(struct richacl_batch *, const char *,
+			    struct richacl *, int);
+
+/*
+ * Queueing an operation failed.  The operations queued before refer to
+ * the paths and entries of the chunk, so let them complete before the
+ * caller frees those.
+ */
+static int batch_failed(struct richacl_batch *batch)
+{
+	int saved_errno = errno;
+
+	richacl_batch_wait(batch);
+	errno = saved_errno;
+	return -1;
+}
+
+/*
+ * Read the acls of a chunk of directory entries, compute their new acls,
+ * write back the acls which have changed, and recurse into
+ * subdirectories.  The reads and writes are batched.
+ */
+static int auto_inherit_chunk(struct richacl_batch *batch,
+			      struct walk_entry *entries, unsigned int count,
+			      struct richacl *dir_inheritable,
+			      struct richacl *file_inheritable)
+{
+	unsigned int n;
+	int status = 0;
+
+	for (n = 0; n < count; n++) {
+		if (richacl_batch_get_file(batch, entries[n].path, get_done,
+					   entries + n))
+			return batch_failed(batch);
+	}
+	if (richacl_batch_wait(batch))
+		return -1;
+
+	for (n = 0; n < count; n++) {
+		struct walk_entry *entry = entries + n;
+
+		if (!entry->old_acl) {
+			if (entry->error == ENODATA ||
+			    entry->error == ENOTSUP ||
+			    entry->error == ENOSYS)
+				continue;
+			goto fail;
+		}
+		if (!richacl_is_auto_inherit(entry->old_acl))
+			continue;
+		if (entry->old_acl->a_flags & ACL4_PROTECTED) {
+			if (!opt_repropagate)
+				continue;
+			entry->new_acl = entry->old_acl;
+			entry->old_acl = NULL;
+		} else {
+			entry->new_acl = richacl_auto_inherit(entry->old_acl,
+					entry->isdir ? dir_inheritable :
+						       file_inheritable);
+			if (!entry->new_acl) {
+				entry->error = errno;
+				goto fail;
+			}
+			entry->changed = !!richacl_compare(entry->old_acl,
+							   entry->new_acl);
+			if (!entry->changed && !opt_repropagate)
+				continue;
+			if (entry->changed &&
+			    richacl_batch_set_file(batch, entry->path,
+						   entry->new_acl, set_done,
+						   entry))
+				return batch_failed(batch);
+		}
+		entry->recurse = entry->isdir;
+		continue;
+
+	fail:
+		errno = entry->error;
+		perror(entry->path);
+		status = -1;
+	}
+	if (richacl_batch_wait(batch))
+		return -1;
+
+	for (n = 0; n < count; n++) {
+		struct walk_entry *entry = entries + n;
+
+		if (entry->changed && entry->error) {
+			errno = entry->error;
+			perror(entry->path);
+			status = -1;
+			continue;
+		}
+		RICHACL_PROBE2(richacl, auto__inherit__file, entry->path,
+			       entry->changed);
+		if (entry->recurse && !journal_contains(entry->path) &&
+		    auto_inherit_dir(batch, entry->path, entry->new_acl,
+				     entry->changed))
+			status = -1;
+	}
+	return status;
+}
+
+/*
+ * Compute a fingerprint of what a directory passes on to its children: its
+ * inheritable entries for files and for directories.
+ */
+static uint64_t inheritable_fingerprint(const struct richacl *file_inheritable,
+					const struct richacl *dir_inheritable)
+{
+	return richacl_hash(file_inheritable) * 31 +
+	       richacl_hash(dir_inheritable);
+}
+
+/*
+ * Set when a file system does not support user extended attributes: from
+ * then on, fingerprints are no longer looked up or recorded, but stale
+ * ones are still removed.
+ */
+static int fingerprints_unsupported;
+
+/*
+ * Fingerprints are stored in an extended attribute next to the acl, so
+ * they are only used with the backends which store acls in extended
+ * attributes.
+ */
+static int use_fingerprints(void)
+{
+	const struct richacl_backend *backend = richacl_get_backend();
+
+	return backend == &richacl_xattr_backend ||
+	       backend == &richacl_user_xattr_backend;
+}
+
+static void check_fingerprint_error(void)
+{
+	if (errno == ENOTSUP)
+		__atomic_store_n(&fingerprints_unsupported, 1,
+				 __ATOMIC_RELAXED);
+}
+
+static void remove_fingerprint(const char *dirname)
+{
+	if (removexattr(dirname, PROPAGATED_XATTR))
+		check_fingerprint_error();
+}
+
+/*
+ * Check if the subtree below @dirname was last completely propagated with
+ * the same inheritable entries.  A fingerprint which does not match is
+ * removed before anything below @dirname changes, so that an interrupted
+ * propagation never leaves a stale fingerprint behind which could match
+ * again later.  Only directories whose acl has @changed can have a
+ * mismatching fingerprint, so when fingerprints are not used for pruning,
+ * those of the other directories are not looked at.
+ */
+static int already_propagated(const char *dirname, uint64_t fingerprint,
+			      int changed)
+{
+	unsigned char value[8];
+	uint64_t stored = 0;
+	ssize_t size;
+	int n;
+
+	if (!use_fingerprints())
+		return 0;
+	if (!opt_incremental ||
+	    __atomic_load_n(&fingerprints_unsupported, __ATOMIC_RELAXED)) {
+		if (changed)
+			remove_fingerprint(dirname);
+		return 0;
+	}
+	size = getxattr(dirname, PROPAGATED_XATTR, value, sizeof(value));
+	if (size < 0) {
+		check_fingerprint_error();
+		return 0;
+	}
+	if (size == sizeof(value)) {
+		for (n = sizeof(value) - 1; n >= 0; n--)
+			stored = (stored << 8) | value[n];
+		if (stored == fingerprint)
+			return 1;
+	}
+	remove_fingerprint(dirname);
+	return 0;
+}
+
+static void record_propagated(const char *dirname, uint64_t fingerprint)
+{
+	unsigned char value[8];
+	unsigned int n;
+
+	if (!use_fingerprints() ||
+	    __atomic_load_n(&fingerprints_unsupported, __ATOMIC_RELAXED))
+		return;
+	for (n = 0; n < sizeof(value); n++) {
+		value[n] = fingerprint;
+		fingerprint >>= 8;
+	}
+	/* The fingerprint only saves work later; ignore errors. */
+	if (setxattr(dirname, PROPAGATED_XATTR, value, sizeof(value), 0))
+		check_fingerprint_error();
+}
+
+static void free_entries(struct walk_entry *entries, unsigned int count)
+{
+	unsigned int n;
+
+	for (n = 0; n < count; n++) {
+		free(entries[n].path);
+		richacl_free(entries[n].old_acl);
+		richacl_free(entries[n].new_acl);
+	}
+	memset(entries, 0, count * sizeof(*entries));
+}
+
+static int auto_inherit_dir(struct richacl_batch *batch, const char *dirname,
+			    struct richacl *dir_acl, int changed)
+{
+	struct richacl *dir_inheritable = NULL, *file_inheritable = NULL;
+	struct walk_entry *entries = NULL;
+	unsigned int count = 0;
+	struct dir_scan scan;
+	uint64_t fingerprint;
+	size_t dirname_len;
+	int status = 0;
+
+	if (dir_scan_open(&scan, dirname)) {
+		if (errno == ENOTDIR)
+			return 0;
+		return -1;
+	}
+	dirname_len = strlen(dirname);
+
+	if (richacl_inherit_both(dir_acl, &file_inheritable, &dir_inheritable))
+		goto fail;
+	fingerprint = inheritable_fingerprint(file_inheritable, dir_inheritable);
+	if (already_propagated(dirname, fingerprint, changed))
+		goto out;
+	entries = calloc(AUTO_INHERIT_CHUNK, sizeof(*entries));
+	if (!entries)
+		goto fail;
+
+	for (;;) {
+		struct walk_entry *entry;
+		struct dir_entry dirent;
+		char *path;
+		int ret;
+
+		ret = dir_scan_next(&scan, &dirent);
+		if (ret <= 0 || count == AUTO_INHERIT_CHUNK) {
+			if (ret < 0) {
+				perror(dirname);
+				status = -1;
+			}
+			if (auto_inherit_chunk(batch, entries, count,
+					       dir_inheritable,
+					       file_inheritable))
+				status = -1;
+			free_entries(entries, count);
+			count = 0;
+			if (ret <= 0)
+				break;
+		}
+
+		path = malloc(dirname_len + strlen(dirent.name) + 2);
+		if (!path)
+			goto fail;
+		sprintf(path, "%s/%s", dirname, dirent.name);
+
+		if (dir_scan_type(&scan, &dirent)) {
+			perror(path);
+			free(path);
+			status = -1;
+			continue;
+		}
+		if (dirent.type == DT_LNK) {
+			free(path);
+			continue;
+		}
+		entry = entries + count++;
+		entry->path = path;
+		entry->isdir = (dirent.type == DT_DIR);
+	}
+	free(entries);
+	if (status == 0 && opt_incremental)
+		record_propagated(dirname, fingerprint);
+out:
+	/* Also frees dir_inheritable. */
+	richacl_free(file_inheritable);
+	dir_scan_close(&scan);
+	if (status == 0 && journal_record(dirname)) {
+		perror(basename(progname));
+		status = -1;
+	}
+	return status;
+
+fail:
+	perror(basename(progname));
+	if (entries) {
+		free_entries(entries, count);
+		free(entries);
+	}
+	richacl_free(file_inheritable);
+	dir_scan_close(&scan);
+	return -1;
+}
+
+int auto_inherit(const char *dirname, struct richacl *dir_acl)
+{
+	struct richacl_batch *batch;
+	int status;
+
+	if (journal_contains(dirname))
+		return 0;
+	batch = richacl_batch_alloc(AUTO_INHERIT_DEPTH);
+	if (!batch) {
+		perror(basename(progname));
+		return -1;
+	}
+	status = auto_inherit_dir(batch, dirname, dir_acl, 1);
+	richacl_batch_free(batch);
+	return status;
+}
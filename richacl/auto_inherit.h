@@ -0,0 +1,47 @@
+/*
+  Copyright (C) 2006, 2008, 2009, 2010  Novell, Inc.
+  Written by Andreas Gruenbacher <agruen@suse.de>
+
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; either version 2, or (at your option) any
+  later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along
+  with this library; if not, write to the Free Software Foundation, Inc.,
+  59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+#ifndef __AUTO_INHERIT_H
+#define __AUTO_INHERIT_H
+
+struct richacl;
+
+extern const char *progname;
+
+/* Descend into all directories, even when their acls do not change. */
+extern int opt_repropagate;
+
+/*
+ * Record a fingerprint of the inheritable entries propagated below each
+ * directory, and skip directories whose fingerprint still matches.
+ */
+extern int opt_incremental;
+
+/*
+ * Propagate the inheritable entries of @dir_acl to all files and
+ * directories below @dirname which have Automatic Inheritance enabled.
+ * Subtrees recorded in the journal (see journal.h) are skipped, and
+ * completed subtrees are recorded.  A mismatching fingerprint left by
+ * opt_incremental is removed whenever a directory whose acl has changed is
+ * descended into.  Fingerprints are only kept with the xattr and user
+ * backends.
+ */
+extern int auto_inherit(const char *dirname, struct richacl *dir_acl);
+
+#endif  /* __AUTO_INHERIT_H */
@@ -0,0 +1,718 @@
+/*
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; either version 2, or (at your option) any
+  later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along
+  with this library; if not, write to the Free Software Foundation, Inc.,
+  59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "richacl.h"
+#include "index.h"
+#include "scan.h"
+#include "walk.h"
+
+/*
+ * Index file layout.  The index is only used on the host which wrote it,
+ * so all fields are in host byte order.  The header is followed by the
+ * tables in this order:
+ *
+ *   struct index_file files[h_files];		sorted by device and inode
+ *   struct index_principal principals[h_principals];  sorted by flags and id
+ *   uint32_t refs[h_refs];			files of each principal
+ *   uint32_t file_refs[h_refs];		principals of each file
+ *   char paths[h_paths];			null-terminated
+ */
+
+#define INDEX_MAGIC	"richidx\n"
+#define INDEX_VERSION	1
+
+struct index_header {
+	char		h_magic[8];
+	uint32_t	h_version;
+	uint32_t	h_files;
+	uint32_t	h_principals;
+	uint32_t	h_refs;
+	uint64_t	h_paths;	/* size of the paths table */
+};
+
+/*
+ * Changes within the same ctime granularity as the index update might not
+ * have changed the ctime.  The acls of files with such a racy ctime are
+ * read again on the next update.
+ */
+#define INDEX_RACY_NSEC	UINT32_MAX	/* f_ctime_nsec */
+
+struct index_file {
+	uint64_t	f_dev;
+	uint64_t	f_ino;
+	int64_t		f_ctime_sec;
+	uint32_t	f_ctime_nsec;
+	uint32_t	f_refs;		/* first entry in file_refs */
+	uint32_t	f_count;	/* number of entries in file_refs */
+	uint32_t	f_pad;
+	uint64_t	f_path;		/* offset in paths */
+};
+
+#define INDEX_GROUP	1	/* p_flags */
+
+struct index_principal {
+	uint32_t	p_id;
+	uint32_t	p_flags;
+	uint32_t	p_refs;		/* first entry in refs */
+	uint32_t	p_count;	/* number of entries in refs */
+};
+
+/* A mapped index file */
+struct index_map {
+	void *map;
+	size_t size;
+	const struct index_header *header;
+	const struct index_file *files;
+	const struct index_principal *principals;
+	const uint32_t *refs, *file_refs;
+	const char *paths;
+};
+
+/*
+ * Check that all references within a mapped index are in bounds, so that
+ * a truncated or corrupted index cannot make us read outside the map.
+ */
+static int check_index(const struct index_map *index)
+{
+	const struct index_header *header = index->header;
+	uint64_t n;
+
+	for (n = 0; n < header->h_files; n++) {
+		const struct index_file *file = &index->files[n];
+
+		if ((uint64_t)file->f_refs + file->f_count > header->h_refs ||
+		    file->f_path >= header->h_paths)
+			return -1;
+	}
+	for (n = 0; n < header->h_principals; n++) {
+		const struct index_principal *p = &index->principals[n];
+
+		if ((uint64_t)p->p_refs + p->p_count > header->h_refs)
+			return -1;
+	}
+	for (n = 0; n < header->h_refs; n++) {
+		if (index->refs[n] >= header->h_files ||
+		    index->file_refs[n] >= header->h_principals)
+			return -1;
+	}
+	/* All paths are null-terminated within the paths table. */
+	if (header->h_paths && index->paths[header->h_paths - 1])
+		return -1;
+	return 0;
+}
+
+static int map_index(const char *path, struct index_map *index)
+{
+	const struct index_header *header;
+	struct stat st;
+	uint64_t size;
+	int fd;
+
+	memset(index, 0, sizeof(*index));
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+	if (fstat(fd, &st)) {
+		close(fd);
+		return -1;
+	}
+	if (st.st_size < sizeof(*header)) {
+		close(fd);
+		errno = EINVAL;
+		return -1;
+	}
+	index->map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (index->map == MAP_FAILED)
+		return -1;
+	index->size = st.st_size;
+
+	header = index->map;
+	if (header->h_paths > st.st_size)
+		goto invalid;
+	size = sizeof(*header) +
+	       (uint64_t)header->h_files * sizeof(struct index_file) +
+	       (uint64_t)header->h_principals *
+			sizeof(struct index_principal) +
+	       (uint64_t)header->h_refs * 2 * sizeof(uint32_t) +
+	       header->h_paths;
+	if (memcmp(header->h_magic, INDEX_MAGIC, sizeof(header->h_magic)) ||
+	    header->h_version != INDEX_VERSION || size != st.st_size)
+		goto invalid;
+	index->header = header;
+	index->files = (const void *)(header + 1);
+	index->principals = (const void *)(index->files + header->h_files);
+	index->refs = (const void *)(index->principals + header->h_principals);
+	index->file_refs = index->refs + header->h_refs;
+	index->paths = (const void *)(index->file_refs + header->h_refs);
+	if (check_index(index))
+		goto invalid;
+	return 0;
+
+invalid:
+	munmap(index->map, index->size);
+	memset(index, 0, sizeof(*index));
+	errno = EINVAL;
+	return -1;
+}
+
+static void unmap_index(struct index_map *index)
+{
+	if (index->map)
+		munmap(index->map, index->size);
+}
+
+static const struct index_file *
+lookup_file(const struct index_map *index, dev_t dev, ino_t ino)
+{
+	size_t lo = 0, hi = index->map ? index->header->h_files : 0;
+
+	while (lo < hi) {
+		size_t mid = (lo + hi) / 2;
+		const struct index_file *file = &index->files[mid];
+
+		if (file->f_dev == dev && file->f_ino == ino)
+			return file;
+		if (file->f_dev < dev ||
+		    (file->f_dev == dev && file->f_ino < ino))
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return NULL;
+}
+
+static const struct index_principal *
+lookup_principal(const struct index_map *index, uint32_t id, uint32_t flags)
+{
+	size_t lo = 0, hi = index->header->h_principals;
+
+	while (lo < hi) {
+		size_t mid = (lo + hi) / 2;
+		const struct index_principal *p = &index->principals[mid];
+
+		if (p->p_flags == flags && p->p_id == id)
+			return p;
+		if (p->p_flags < flags ||
+		    (p->p_flags == flags && p->p_id < id))
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return NULL;
+}
+
+/* A principal named in an acl, while updating the index */
+struct id_ref {
+	uint32_t id;
+	uint32_t flags;
+	uint32_t file;
+};
+
+struct file_entry {
+	struct index_file f;	/* f_path and f_refs are not used */
+	char *path;
+	size_t first;		/* in the id_ref array */
+};
+
+/* The files collected by all threads, or by one thread */
+struct index_data {
+	struct file_entry *files;
+	size_t n_files, files_size;
+	struct id_ref *ids;
+	size_t n_ids, ids_size;
+	int failed;		/* some acls could not be read */
+};
+
+struct index_walk {
+	struct tree_walk walk;
+	struct index_map old;
+	time_t start;
+	struct index_data data;
+	int error;		/* out of memory collecting the files */
+};
+
+static int add_file(struct index_data *data, const struct stat *st,
+		    const char *path)
+{
+	struct file_entry *entry;
+
+	if (data->n_files == data->files_size) {
+		size_t size = data->files_size ? data->files_size * 2 : 256;
+		struct file_entry *files;
+
+		files = realloc(data->files, sizeof(*files) * size);
+		if (!files)
+			return -1;
+		data->files = files;
+		data->files_size = size;
+	}
+	entry = &data->files[data->n_files];
+	memset(entry, 0, sizeof(*entry));
+	entry->path = strdup(path);
+	if (!entry->path)
+		return -1;
+	entry->f.f_dev = st->st_dev;
+	entry->f.f_ino = st->st_ino;
+	entry->f.f_ctime_sec = st->st_ctim.tv_sec;
+	entry->f.f_ctime_nsec = st->st_ctim.tv_nsec;
+	entry->first = data->n_ids;
+	data->n_files++;
+	return 0;
+}
+
+/* Add a principal to the last file added, unless it is already there. */
+static int add_id(struct index_data *data, uint32_t id, uint32_t flags)
+{
+	struct file_entry *entry = &data->files[data->n_files - 1];
+	size_t n;
+
+	for (n = entry->first; n < data->n_ids; n++)
+		if (data->ids[n].id == id && data->ids[n].flags == flags)
+			return 0;
+	if (data->n_ids == data->ids_size) {
+		size_t size = data->ids_size ? data->ids_size * 2 : 256;
+		struct id_ref *ids;
+
+		ids = realloc(data->ids, sizeof(*ids) * size);
+		if (!ids)
+			return -1;
+		data->ids = ids;
+		data->ids_size = size;
+	}
+	data->ids[data->n_ids].id = id;
+	data->ids[data->n_ids].flags = flags;
+	data->n_ids++;
+	entry->f.f_count++;
+	return 0;
+}
+
+static void free_data(struct index_data *data)
+{
+	size_t n;
+
+	for (n = 0; n < data->n_files; n++)
+		free(data->files[n].path);
+	free(data->files);
+	free(data->ids);
+}
+
+/* Add the principals which the previous index has for a file. */
+static int add_old_ids(struct index_walk *iw, struct index_data *data,
+		       const struct index_file *old)
+{
+	uint32_t n;
+
+	for (n = 0; n < old->f_count; n++) {
+		const struct index_principal *p = &iw->old.principals[
+			iw->old.file_refs[old->f_refs + n]];
+
+		if (add_id(data, p->p_id, p->p_flags))
+			return -1;
+	}
+	return 0;
+}
+
+static void *index_start(struct tree_walk *walk)
+{
+	return calloc(1, sizeof(struct index_data));
+}
+
+/*
+ * Record the principals in the acl of @path.  When the previous index
+ * has the file with the same ctime, take the principals from there.
+ * When the acl cannot be read, the error is reported and the principals
+ * from the previous index are kept; the file is read again next time.
+ */
+static int index_file(struct tree_walk *walk, void *arg, const char *path,
+		      const struct stat *st)
+{
+	struct index_walk *iw = (struct index_walk *)walk;
+	struct index_data *data = arg;
+	const struct index_file *old;
+	struct file_entry *entry;
+	struct richacl *acl;
+	struct richace *ace;
+
+	if (add_file(data, st, path))
+		return -1;
+	entry = &data->files[data->n_files - 1];
+	if (st->st_ctim.tv_sec >= iw->start - 1)
+		entry->f.f_ctime_nsec = INDEX_RACY_NSEC;
+
+	old = lookup_file(&iw->old, st->st_dev, st->st_ino);
+	if (old && old->f_ctime_sec == st->st_ctim.tv_sec &&
+	    old->f_ctime_nsec == st->st_ctim.tv_nsec)
+		return add_old_ids(iw, data, old);
+
+	acl = richacl_get_file(path);
+	if (!acl) {
+		if (errno == ENODATA || errno == ENOTSUP || errno == ENOSYS)
+			return 0;
+		/* Go on, so that the files below directories are indexed. */
+		perror(path);
+		data->failed = 1;
+		entry->f.f_ctime_nsec = INDEX_RACY_NSEC;
+		return old ? add_old_ids(iw, data, old) : 0;
+	}
+	richacl_for_each_entry(ace, acl) {
+		if (!richace_is_unix_id(ace))
+			continue;
+		if (add_id(data, ace->e_id,
+			   (ace->e_flags & ACE4_IDENTIFIER_GROUP) ?
+			   INDEX_GROUP : 0)) {
+			richacl_free(acl);
+			return -1;
+		}
+	}
+	richacl_free(acl);
+	return 0;
+}
+
+/* Move the files of a thread over to the index. */
+static void index_finish(struct tree_walk *walk, void *arg)
+{
+	struct index_walk *iw = (struct index_walk *)walk;
+	struct index_data *all = &iw->data, *data = arg;
+	struct file_entry *files;
+	struct id_ref *ids;
+	size_t n;
+
+	all->failed |= data->failed;
+	if (iw->error)
+		goto out;
+	files = realloc(all->files, sizeof(*files) *
+			(all->n_files + data->n_files + 1));
+	if (!files)
+		goto fail;
+	all->files = files;
+	ids = realloc(all->ids, sizeof(*ids) * (all->n_ids + data->n_ids + 1));
+	if (!ids)
+		goto fail;
+	all->ids = ids;
+
+	for (n = 0; n < data->n_files; n++) {
+		files[all->n_files + n] = data->files[n];
+		files[all->n_files + n].first += all->n_ids;
+	}
+	memcpy(ids + all->n_ids, data->ids, sizeof(*ids) * data->n_ids);
+	all->n_files += data->n_files;
+	all->n_ids += data->n_ids;
+	/* The paths now belong to the index. */
+	data->n_files = 0;
+	goto out;
+
+fail:
+	iw->error = 1;
+out:
+	free_data(data);
+	free(data);
+}
+
+static int compare_files(const void *a, const void *b)
+{
+	const struct file_entry *x = a, *y = b;
+
+	if (x->f.f_dev != y->f.f_dev)
+		return x->f.f_dev < y->f.f_dev ? -1 : 1;
+	if (x->f.f_ino != y->f.f_ino)
+		return x->f.f_ino < y->f.f_ino ? -1 : 1;
+	return strcmp(x->path, y->path);
+}
+
+static int compare_ids(const void *a, const void *b)
+{
+	const struct id_ref *x = a, *y = b;
+
+	if (x->flags != y->flags)
+		return x->flags < y->flags ? -1 : 1;
+	if (x->id != y->id)
+		return x->id < y->id ? -1 : 1;
+	return (x->file > y->file) - (x->file < y->file);
+}
+
+/*
+ * Write the collected files to @path.  The index is written to a temporary
+ * file first, and then renamed, so that readers never see a partial index.
+ */
+static int write_index(const char *path, struct index_data *data)
+{
+	struct index_header header;
+	struct index_principal *principals = NULL;
+	uint32_t *refs = NULL, *file_refs = NULL, n_principals = 0;
+	struct id_ref *ids = NULL;
+	char *tmp = NULL;
+	FILE *file = NULL;
+	size_t n, m;
+	uint64_t offset;
+	int fd, ret = -1;
+
+	qsort(data->files, data->n_files, sizeof(*data->files),
+	      compare_files);
+
+	/* Principal references, sorted by principal and then file. */
+	ids = malloc(sizeof(*ids) * (data->n_ids ? data->n_ids : 1));
+	refs = malloc(sizeof(*refs) * (data->n_ids ? data->n_ids : 1));
+	file_refs = malloc(sizeof(*refs) * (data->n_ids ? data->n_ids : 1));
+	principals = malloc(sizeof(*principals) *
+			    (data->n_ids ? data->n_ids : 1));
+	if (!ids || !refs || !file_refs || !principals)
+		goto out;
+	m = 0;
+	for (n = 0; n < data->n_files; n++) {
+		struct file_entry *entry = &data->files[n];
+		uint32_t k;
+
+		for (k = 0; k < entry->f.f_count; k++) {
+			ids[m] = data->ids[entry->first + k];
+			ids[m].file = n;
+			m++;
+		}
+	}
+	qsort(ids, m, sizeof(*ids), compare_ids);
+	for (n = 0; n < m; n++) {
+		if (!n || ids[n].id != ids[n - 1].id ||
+		    ids[n].flags != ids[n - 1].flags) {
+			struct index_principal *p = &principals[n_principals++];
+
+			p->p_id = ids[n].id;
+			p->p_flags = ids[n].flags;
+			p->p_refs = n;
+			p->p_count = 0;
+		}
+		principals[n_principals - 1].p_count++;
+		refs[n] = ids[n].file;
+	}
+
+	/* The principals of each file, in file order. */
+	offset = 0;
+	for (n = 0; n < data->n_files; n++) {
+		data->files[n].f.f_refs = offset;
+		data->files[n].f.f_path = 0;
+		offset += data->files[n].f.f_count;
+		data->files[n].f.f_count = 0;
+	}
+	for (n = 0, m = 0; n < n_principals; n++) {
+		uint32_t k;
+
+		for (k = 0; k < principals[n].p_count; k++) {
+			struct file_entry *entry =
+				&data->files[refs[principals[n].p_refs + k]];
+
+			file_refs[entry->f.f_refs + entry->f.f_count++] = n;
+		}
+	}
+
+	if (asprintf(&tmp, "%s.XXXXXX", path) < 0) {
+		tmp = NULL;
+		goto out;
+	}
+	fd = mkstemp(tmp);
+	if (fd < 0)
+		goto out;
+	file = fdopen(fd, "w");
+	if (!file) {
+		close(fd);
+		goto out;
+	}
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.h_magic, INDEX_MAGIC, sizeof(header.h_magic));
+	header.h_version = INDEX_VERSION;
+	header.h_files = data->n_files;
+	header.h_principals = n_principals;
+	header.h_refs = data->n_ids;
+	for (n = 0; n < data->n_files; n++)
+		header.h_paths += strlen(data->files[n].path) + 1;
+	fwrite(&header, sizeof(header), 1, file);
+	offset = 0;
+	for (n = 0; n < data->n_files; n++) {
+		struct index_file f = data->files[n].f;
+
+		f.f_path = offset;
+		offset += strlen(data->files[n].path) + 1;
+		fwrite(&f, sizeof(f), 1, file);
+	}
+	fwrite(principals, sizeof(*principals), n_principals, file);
+	fwrite(refs, sizeof(*refs), data->n_ids, file);
+	fwrite(file_refs, sizeof(*file_refs), data->n_ids, file);
+	for (n = 0; n < data->n_files; n++)
+		fwrite(data->files[n].path, strlen(data->files[n].path) + 1,
+		       1, file);
+	if (ferror(file) | fclose(file)) {
+		file = NULL;
+		goto out;
+	}
+	file = NULL;
+	if (rename(tmp, path))
+		goto out;
+	free(tmp);
+	tmp = NULL;
+	ret = 0;
+
+out:
+	if (tmp) {
+		int saved_errno = errno;
+
+		if (file)
+			fclose(file);
+		unlink(tmp);
+		free(tmp);
+		errno = saved_errno;
+	}
+	free(principals);
+	free(file_refs);
+	free(refs);
+	free(ids);
+	return ret;
+}
+
+/**
+ * update_index  -  index the acls of files and of everything below directories
+ * @index:	the index file
+ * @paths:	the files and directories to index
+ *
+ * The new index replaces the previous one, which is used to avoid reading
+ * acls which have not changed.  Files which are no longer below @paths are
+ * dropped from the index.  The index is also written when some files or
+ * directories could not be read; the errors are reported, and the return
+ * value is non-zero.
+ */
+int update_index(const char *index, char **paths, int n_paths,
+		 unsigned int jobs)
+{
+	struct index_walk iw;
+	int status;
+
+	memset(&iw, 0, sizeof(iw));
+	iw.walk.jobs = jobs;
+	iw.walk.attrs = STAT_MODE | STAT_CTIME;
+	iw.walk.start = index_start;
+	iw.walk.visit = index_file;
+	iw.walk.finish = index_finish;
+	iw.start = time(NULL);
+	if (map_index(index, &iw.old) && errno != ENOENT) {
+		fprintf(stderr, "%s: %s; rebuilding the index\n", index,
+			strerror(errno));
+	}
+
+	status = walk_tree(&iw.walk, paths, n_paths);
+	if (iw.data.failed)
+		status = 1;
+	if (iw.error) {
+		errno = ENOMEM;
+		perror(basename(progname));
+		status = 1;
+	} else if (write_index(index, &iw.data)) {
+		perror(index);
+		status = 1;
+	}
+	free_data(&iw.data);
+	unmap_index(&iw.old);
+	return status;
+}
+
+static int compare_paths(const void *a, const void *b)
+{
+	return strcmp(*(const char **)a, *(const char **)b);
+}
+
+/**
+ * find_in_index  -  list the files whose acls name a user or groups
+ * @user:	the user, or (uid_t)-1 for none
+ * @delim:	the character to terminate file names with
+ *
+ * The file names are listed in sorted order.
+ */
+int find_in_index(const char *index, uid_t user, const gid_t *groups,
+		  int n_groups, int delim)
+{
+	struct index_map map;
+	const char **paths;
+	uint32_t *files = NULL;
+	size_t n_files = 0, n;
+	int i;
+
+	if (map_index(index, &map)) {
+		perror(index);
+		return 1;
+	}
+	for (i = -1; i < n_groups; i++) {
+		const struct index_principal *p;
+
+		if (i == -1) {
+			if (user == (uid_t)-1)
+				continue;
+			p = lookup_principal(&map, user, 0);
+		} else
+			p = lookup_principal(&map, groups[i], INDEX_GROUP);
+		if (p)
+			n_files += p->p_count;
+	}
+	files = malloc(sizeof(*files) * (n_files + 1));
+	if (!files)
+		goto fail;
+	n_files = 0;
+	for (i = -1; i < n_groups; i++) {
+		const struct index_principal *p;
+
+		if (i == -1) {
+			if (user == (uid_t)-1)
+				continue;
+			p = lookup_principal(&map, user, 0);
+		} else
+			p = lookup_principal(&map, groups[i], INDEX_GROUP);
+		if (!p)
+			continue;
+		memcpy(files + n_files, map.refs + p->p_refs,
+		       sizeof(*files) * p->p_count);
+		n_files += p->p_count;
+	}
+
+	paths = malloc(sizeof(*paths) * (n_files + 1));
+	if (!paths)
+		goto fail;
+	for (n = 0; n < n_files; n++)
+		paths[n] = map.paths + map.files[files[n]].f_path;
+	qsort(paths, n_files, sizeof(*paths), compare_paths);
+	for (n = 0; n < n_files; n++) {
+		if (n && paths[n] == paths[n - 1])
+			continue;
+		printf("%s%c", paths[n], delim);
+	}
+	free(paths);
+	free(files);
+	unmap_index(&map);
+	return 0;
+
+fail:
+	perror(basename(progname));
+	free(files);
+	unmap_index(&map);
+	return 1;
+}
@@ -0,0 +1,37 @@
+/*
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; either version 2, or (at your option) any
+  later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along
+  with this library; if not, write to the Free Software Foundation, Inc.,
+  59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+#ifndef __INDEX_H
+#define __INDEX_H
+
+#include <sys/types.h>
+
+/*
+ * Principal index: for each user and group named in an acl entry, the
+ * files whose acls name them.  The index is a file which is mapped into
+ * memory for lookups.
+ *
+ * The index also records the ctime of each file.  When the index is
+ * updated, the acls of files whose ctime has not changed are not read
+ * again.
+ */
+
+extern int update_index(const char *index, char **paths, int n_paths,
+			unsigned int jobs);
+extern int find_in_index(const char *index, uid_t user, const gid_t *groups,
+			 int n_groups, int delim);
+
+#endif  /* __INDEX_H */
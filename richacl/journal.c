@@ -0,0 +1,210 @@
+/*
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; either version 2, or (at your option) any
+  later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along
+  with this library; if not, write to the Free Software Foundation, Inc.,
+  59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+/*
+ * The journal file contains one record per completed directory: its path
+ * as passed to auto_inherit() or built by it, terminated by a null byte.
+ * A record cut short by a crash is ignored, and removed before new records
+ * are appended.  Records are flushed to the file as they are written, and
+ * synced to disk every JOURNAL_SYNC_RECORDS records.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "journal.h"
+
+#define JOURNAL_SYNC_RECORDS 1024
+
+static FILE *journal;
+static unsigned int unsynced;
+static pthread_mutex_t journal_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* The directories recorded in the journal when resuming */
+static char **table;
+static size_t table_size, table_count;
+
+static unsigned long hash_path(const char *path)
+{
+	unsigned long hash = 5381;
+
+	while (*path)
+		hash = hash * 33 + (unsigned char)*path++;
+	return hash;
+}
+
+static int table_grow(void)
+{
+	size_t size = table_size ? table_size * 2 : 1024, n;
+	char **t;
+
+	t = calloc(size, sizeof(*t));
+	if (!t)
+		return -1;
+	for (n = 0; n < table_size; n++) {
+		size_t i;
+
+		if (!table[n])
+			continue;
+		i = hash_path(table[n]) & (size - 1);
+		while (t[i])
+			i = (i + 1) & (size - 1);
+		t[i] = table[n];
+	}
+	free(table);
+	table = t;
+	table_size = size;
+	return 0;
+}
+
+static int table_add(char *path)
+{
+	size_t i;
+
+	if (table_count * 2 >= table_size && table_grow())
+		return -1;
+	i = hash_path(path) & (table_size - 1);
+	while (table[i]) {
+		if (!strcmp(table[i], path)) {
+			free(path);
+			return 0;
+		}
+		i = (i + 1) & (table_size - 1);
+	}
+	table[i] = path;
+	table_count++;
+	return 0;
+}
+
+static int journal_load(FILE *file)
+{
+	char *line = NULL;
+	size_t size = 0;
+	ssize_t len;
+	off_t end = 0;
+
+	while ((len = getdelim(&line, &size, 0, file)) > 0) {
+		char *path;
+
+		if (line[len - 1] != 0)
+			break;  /* incomplete record */
+		path = strdup(line);
+		if (!path || table_add(path)) {
+			free(path);
+			free(line);
+			return -1;
+		}
+		end += len;
+	}
+	free(line);
+	if (ferror(file))
+		return -1;
+
+	/*
+	 * Cut off an incomplete record: the next record would otherwise be
+	 * appended to it, and both would be lost.
+	 */
+	if (fflush(file) || ftruncate(fileno(file), end) ||
+	    fseeko(file, 0, SEEK_END))
+		return -1;
+	return 0;
+}
+
+/**
+ * journal_open  -  start recording completed directories in a journal
+ * @resume:	skip the directories already recorded in the journal;
+ *		otherwise, start with an empty journal
+ */
+int journal_open(const char *path, int resume)
+{
+	journal = fopen(path, resume ? "a+" : "w");
+	if (!journal)
+		return -1;
+	if (resume) {
+		if (journal_load(journal)) {
+			fclose(journal);
+			journal = NULL;
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * journal_contains  -  check if a directory was completed before resuming
+ */
+int journal_contains(const char *path)
+{
+	size_t i;
+
+	if (!table_count)
+		return 0;
+	i = hash_path(path) & (table_size - 1);
+	while (table[i]) {
+		if (!strcmp(table[i], path))
+			return 1;
+		i = (i + 1) & (table_size - 1);
+	}
+	return 0;
+}
+
+/**
+ * journal_record  -  record that the entire subtree of a directory is done
+ *
+ * May be called from several threads at once.
+ */
+int journal_record(const char *path)
+{
+	int ret = 0;
+
+	if (!journal)
+		return 0;
+	pthread_mutex_lock(&journal_lock);
+	if (fwrite(path, strlen(path) + 1, 1, journal) != 1 ||
+	    fflush(journal))
+		ret = -1;
+	else if (++unsynced == JOURNAL_SYNC_RECORDS) {
+		unsynced = 0;
+		if (fdatasync(fileno(journal)))
+			ret = -1;
+	}
+	pthread_mutex_unlock(&journal_lock);
+	return ret;
+}
+
+int journal_close(void)
+{
+	size_t n;
+	int ret = 0;
+
+	if (journal) {
+		if (fflush(journal) || fdatasync(fileno(journal)))
+			ret = -1;
+		if (fclose(journal))
+			ret = -1;
+		journal = NULL;
+	}
+	for (n = 0; n < table_size; n++)
+		free(table[n]);
+	free(table);
+	table = NULL;
+	table_size = table_count = 0;
+	return ret;
+}
@@ -0,0 +1,31 @@
+/*
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; either version 2, or (at your option) any
+  later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along
+  with this library; if not, write to the Free Software Foundation, Inc.,
+  59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+#ifndef __JOURNAL_H
+#define __JOURNAL_H
+
+/*
+ * Propagation journal: records the directories whose entire subtree
+ * auto_inherit() has completed, so that an interrupted propagation can be
+ * resumed without visiting those subtrees again.
+ */
+
+extern int journal_open(const char *, int resume);
+extern int journal_contains(const char *);
+extern int journal_record(const char *);
+extern int journal_close(void);
+
+#endif  /* __JOURNAL_H */
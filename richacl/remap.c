@@ -0,0 +1,386 @@
+/*
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; either version 2, or (at your option) any
+  later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along
+  with this library; if not, write to the Free Software Foundation, Inc.,
+  59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <pwd.h>
+#include <grp.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "richacl.h"
+#include "remap.h"
+#include "scan.h"
+#include "walk.h"
+
+struct id_pair {
+	id_t from, to;
+	unsigned int lineno;	/* in the table */
+};
+
+/* Sorted by from, so that lookups can use binary search. */
+struct id_map {
+	struct id_pair *users, *groups;
+	size_t n_users, n_groups;
+};
+
+static int compare_from(const void *a, const void *b)
+{
+	const struct id_pair *x = a, *y = b;
+
+	return (x->from > y->from) - (x->from < y->from);
+}
+
+/* Duplicates are sorted in table order, for reporting them. */
+static int compare_pairs(const void *a, const void *b)
+{
+	const struct id_pair *x = a, *y = b;
+
+	if (x->from != y->from)
+		return compare_from(a, b);
+	return (x->lineno > y->lineno) - (x->lineno < y->lineno);
+}
+
+static int parse_id(const char *text, int group, id_t *id)
+{
+	char *end;
+
+	*id = strtoul(text, &end, 10);
+	if (*end || end == text) {
+		if (group) {
+			struct group *gr = getgrnam(text);
+
+			if (!gr)
+				return -1;
+			*id = gr->gr_gid;
+		} else {
+			struct passwd *pw = getpwnam(text);
+
+			if (!pw)
+				return -1;
+			*id = pw->pw_uid;
+		}
+	}
+	return 0;
+}
+
+static int add_pair(struct id_pair **pairs, size_t *count, id_t from, id_t to,
+		    unsigned int lineno)
+{
+	struct id_pair *p;
+
+	p = realloc(*pairs, sizeof(*p) * (*count + 1));
+	if (!p)
+		return -1;
+	*pairs = p;
+	p[*count].from = from;
+	p[*count].to = to;
+	p[*count].lineno = lineno;
+	(*count)++;
+	return 0;
+}
+
+/*
+ * Report ids which are mapped more than once in the sorted @pairs.
+ * Returns the number of duplicates.
+ */
+static int check_duplicates(const char *path, const struct id_pair *pairs,
+			    size_t count, const char *what)
+{
+	int duplicates = 0;
+	size_t n;
+
+	for (n = 1; n < count; n++) {
+		if (pairs[n].from != pairs[n - 1].from)
+			continue;
+		fprintf(stderr, "%s:%u: %s %lu already mapped on line %u\n",
+			path, pairs[n].lineno, what,
+			(unsigned long)pairs[n].from, pairs[n - 1].lineno);
+		duplicates++;
+	}
+	return duplicates;
+}
+
+/**
+ * read_id_map  -  read a uid and gid mapping table
+ * @path:	the table, or `-' for standard input
+ *
+ * Each line of the table is either empty, a comment starting with `#', or
+ * of the form "u old new" or "g old new" for a user or group id.  Ids can
+ * be numbers or names, and each old id can only be mapped once.  Errors
+ * are reported to standard error.
+ */
+struct id_map *read_id_map(const char *path)
+{
+	struct id_map *map;
+	FILE *file = stdin;
+	char *line = NULL;
+	size_t size = 0;
+	unsigned int lineno = 0;
+	int error = 0;
+
+	map = calloc(1, sizeof(*map));
+	if (!map) {
+		perror(basename(progname));
+		return NULL;
+	}
+	if (strcmp(path, "-")) {
+		file = fopen(path, "r");
+		if (!file) {
+			perror(path);
+			free(map);
+			return NULL;
+		}
+	}
+	while (getline(&line, &size, file) != -1) {
+		char type[2], from[256], to[256], extra;
+		id_t from_id, to_id;
+		int n, group;
+
+		lineno++;
+		n = sscanf(line, " %1s %255s %255s %c", type, from, to, &extra);
+		if (n <= 0 || type[0] == '#')
+			continue;
+		group = (type[0] == 'g');
+		if (n != 3 || (type[0] != 'u' && type[0] != 'g')) {
+			fprintf(stderr, "%s:%u: expected `u old new' or "
+				"`g old new'\n", path, lineno);
+			error = 1;
+			continue;
+		}
+		if (parse_id(from, group, &from_id) ||
+		    parse_id(to, group, &to_id)) {
+			fprintf(stderr, "%s:%u: No such %s\n", path, lineno,
+				group ? "group" : "user");
+			error = 1;
+			continue;
+		}
+		if (group ? add_pair(&map->groups, &map->n_groups,
+				     from_id, to_id, lineno) :
+			    add_pair(&map->users, &map->n_users,
+				     from_id, to_id, lineno)) {
+			perror(basename(progname));
+			error = 1;
+			break;
+		}
+	}
+	if (ferror(file)) {
+		perror(path);
+		error = 1;
+	}
+	if (file != stdin)
+		fclose(file);
+	free(line);
+	if (!error) {
+		qsort(map->users, map->n_users, sizeof(*map->users),
+		      compare_pairs);
+		qsort(map->groups, map->n_groups, sizeof(*map->groups),
+		      compare_pairs);
+		if (check_duplicates(path, map->users, map->n_users, "user") |
+		    check_duplicates(path, map->groups, map->n_groups, "group"))
+			error = 1;
+	}
+	if (error) {
+		free_id_map(map);
+		return NULL;
+	}
+	return map;
+}
+
+void free_id_map(struct id_map *map)
+{
+	if (!map)
+		return;
+	free(map->users);
+	free(map->groups);
+	free(map);
+}
+
+static const struct id_pair *lookup_id(const struct id_pair *pairs,
+				       size_t count, id_t from)
+{
+	struct id_pair key = { .from = from };
+
+	return bsearch(&key, pairs, count, sizeof(*pairs), compare_from);
+}
+
+/*
+ * Inodes with several hard links which have been remapped already.  A
+ * second visit through another link must not map the ids again.
+ */
+struct inode_set {
+	pthread_mutex_t lock;
+	struct { dev_t dev; ino_t ino; } *inodes;
+	size_t count, size;	/* size is a power of two */
+};
+
+static size_t inode_hash(dev_t dev, ino_t ino)
+{
+	uint64_t x = ino ^ ((uint64_t)dev << 32);
+
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdULL;
+	x ^= x >> 33;
+	return x;
+}
+
+/* Returns 1 if the inode was added, 0 if it was there already. */
+static int inode_set_add(struct inode_set *set, dev_t dev, ino_t ino)
+{
+	size_t n, mask;
+	int ret = -1;
+
+	pthread_mutex_lock(&set->lock);
+	if (2 * (set->count + 1) > set->size) {
+		size_t size = set->size ? set->size * 2 : 256;
+		typeof(set->inodes) inodes;
+
+		inodes = calloc(size, sizeof(*inodes));
+		if (!inodes)
+			goto out;
+		for (n = 0; n < set->size; n++) {
+			size_t m;
+
+			if (!set->inodes[n].ino)
+				continue;
+			m = inode_hash(set->inodes[n].dev, set->inodes[n].ino);
+			while (inodes[m & (size - 1)].ino)
+				m++;
+			inodes[m & (size - 1)] = set->inodes[n];
+		}
+		free(set->inodes);
+		set->inodes = inodes;
+		set->size = size;
+	}
+	mask = set->size - 1;
+	for (n = inode_hash(dev, ino); set->inodes[n & mask].ino; n++) {
+		if (set->inodes[n & mask].dev == dev &&
+		    set->inodes[n & mask].ino == ino) {
+			ret = 0;
+			goto out;
+		}
+	}
+	set->inodes[n & mask].dev = dev;
+	set->inodes[n & mask].ino = ino;
+	set->count++;
+	ret = 1;
+out:
+	pthread_mutex_unlock(&set->lock);
+	return ret;
+}
+
+struct remap_walk {
+	struct tree_walk walk;
+	const struct id_map *map;
+	int dry_run;
+	struct inode_set linked;
+};
+
+static pthread_mutex_t output_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void *remap_start(struct tree_walk *walk)
+{
+	/* No per-thread state; any non-NULL pointer will do. */
+	return walk;
+}
+
+static void remap_finish(struct tree_walk *walk, void *state)
+{
+}
+
+/*
+ * Map the ids in the acl of @path.  Files without acls, and files whose
+ * acls do not name any of the mapped ids, are not written.
+ */
+static int remap_file(struct tree_walk *walk, void *state, const char *path,
+		      const struct stat *st)
+{
+	struct remap_walk *rw = (struct remap_walk *)walk;
+	const struct id_map *map = rw->map;
+	struct richacl *acl;
+	struct richace *ace;
+	int changed = 0, ret = 0;
+
+	acl = richacl_get_file(path);
+	if (!acl) {
+		if (errno == ENODATA || errno == ENOTSUP || errno == ENOSYS)
+			return 0;
+		return -1;
+	}
+	richacl_for_each_entry(ace, acl) {
+		const struct id_pair *pair;
+
+		if (!richace_is_unix_id(ace))
+			continue;
+		if (ace->e_flags & ACE4_IDENTIFIER_GROUP)
+			pair = lookup_id(map->groups, map->n_groups,
+					 ace->e_id);
+		else
+			pair = lookup_id(map->users, map->n_users, ace->e_id);
+		if (pair && pair->to != ace->e_id) {
+			ace->e_id = pair->to;
+			changed = 1;
+		}
+	}
+	if (!changed)
+		goto out;
+
+	if (!S_ISDIR(st->st_mode) && st->st_nlink > 1) {
+		ret = inode_set_add(&rw->linked, st->st_dev, st->st_ino);
+		if (ret <= 0)
+			goto out;
+		ret = 0;
+	}
+	if (rw->dry_run) {
+		pthread_mutex_lock(&output_lock);
+		printf("%s\n", path);
+		pthread_mutex_unlock(&output_lock);
+	} else
+		ret = richacl_set_file(path, acl);
+
+out:
+	richacl_free(acl);
+	return ret;
+}
+
+/**
+ * remap  -  map the ids in the acls of files and everything below directories
+ * @dry_run:	only list the files which would change
+ */
+int remap(char **paths, int n_paths, const struct id_map *map,
+	  unsigned int jobs, int dry_run)
+{
+	struct remap_walk rw;
+	int status;
+
+	memset(&rw, 0, sizeof(rw));
+	rw.walk.jobs = jobs;
+	rw.walk.attrs = STAT_MODE | STAT_NLINK;
+	rw.walk.start = remap_start;
+	rw.walk.visit = remap_file;
+	rw.walk.finish = remap_finish;
+	rw.map = map;
+	rw.dry_run = dry_run;
+	pthread_mutex_init(&rw.linked.lock, NULL);
+	status = walk_tree(&rw.walk, paths, n_paths);
+	pthread_mutex_destroy(&rw.linked.lock);
+	free(rw.linked.inodes);
+	return status;
+}
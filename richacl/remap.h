@@ -0,0 +1,32 @@
+/*
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; either version 2, or (at your option) any
+  later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along
+  with this library; if not, write to the Free Software Foundation, Inc.,
+  59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+#ifndef __REMAP_H
+#define __REMAP_H
+
+/*
+ * Remapping of the user and group ids in acl entries, for example after
+ * moving to a different identity domain.
+ */
+
+struct id_map;
+
+extern struct id_map *read_id_map(const char *);
+extern void free_id_map(struct id_map *);
+extern int remap(char **paths, int n_paths, const struct id_map *,
+		 unsigned int jobs, int dry_run);
+
+#endif  /* __REMAP_H */
@@ -0,0 +1,193 @@
+/*
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; either version 2, or (at your option) any
+  later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along
+  with this library; if not, write to the Free Software Foundation, Inc.,
+  59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "richacl.h"
+#include "report.h"
+#include "scan.h"
+#include "walk.h"
+
+/* The number of files which grant each permission to a principal */
+struct summary {
+	unsigned long long granted[32];
+};
+
+struct report_walk {
+	struct tree_walk walk;
+	const struct report_options *options;
+	unsigned long long files;
+	struct summary *summaries;	/* one per principal */
+};
+
+/* The results of one thread */
+struct report_state {
+	unsigned long long files;
+	struct summary *summaries;
+	unsigned int *masks;
+};
+
+static pthread_mutex_t output_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void *report_start(struct tree_walk *walk)
+{
+	const struct report_options *options =
+		((struct report_walk *)walk)->options;
+	struct report_state *state;
+
+	state = calloc(1, sizeof(*state));
+	if (!state)
+		return NULL;
+	state->summaries = calloc(options->count, sizeof(*state->summaries));
+	state->masks = calloc(options->count, sizeof(*state->masks));
+	if (!state->summaries || !state->masks) {
+		free(state->summaries);
+		free(state->masks);
+		free(state);
+		return NULL;
+	}
+	return state;
+}
+
+/*
+ * Evaluate the acl of @path for all principals, and add the result to
+ * the summaries of the thread.  The acl is read once.
+ */
+static int report_file(struct tree_walk *walk, void *arg, const char *path,
+		       const struct stat *st)
+{
+	const struct report_options *options =
+		((struct report_walk *)walk)->options;
+	struct report_state *state = arg;
+	unsigned int *masks = state->masks;
+	struct richacl *acl;
+	unsigned int n, bit;
+
+	acl = richacl_get_file(path);
+	if (!acl) {
+		if (errno != ENODATA && errno != ENOTSUP && errno != ENOSYS)
+			return -1;
+		acl = richacl_from_mode(st->st_mode);
+		if (!acl)
+			return -1;
+	}
+	if (richacl_permissions(acl, st, options->principals,
+				options->count, masks)) {
+		richacl_free(acl);
+		return -1;
+	}
+	richacl_free(acl);
+
+	state->files++;
+	for (n = 0; n < options->count; n++) {
+		for (bit = 0; bit < 32; bit++)
+			if (masks[n] & (1U << bit))
+				state->summaries[n].granted[bit]++;
+	}
+
+	if (options->per_file) {
+		int format = options->format |
+			     (S_ISDIR(st->st_mode) ?
+			      RICHACL_TEXT_DIRECTORY_CONTEXT :
+			      RICHACL_TEXT_FILE_CONTEXT);
+
+		pthread_mutex_lock(&output_lock);
+		for (n = 0; n < options->count; n++) {
+			if (richacl_fprint_mask_text(masks[n], format, stdout))
+				break;
+			printf("  %s  %s\n", options->names[n], path);
+		}
+		pthread_mutex_unlock(&output_lock);
+		if (n < options->count)
+			return -1;
+	}
+	return 0;
+}
+
+static void report_finish(struct tree_walk *walk, void *arg)
+{
+	struct report_walk *report = (struct report_walk *)walk;
+	struct report_state *state = arg;
+	unsigned int n, bit;
+
+	report->files += state->files;
+	for (n = 0; n < report->options->count; n++)
+		for (bit = 0; bit < 32; bit++)
+			report->summaries[n].granted[bit] +=
+				state->summaries[n].granted[bit];
+	free(state->summaries);
+	free(state->masks);
+	free(state);
+}
+
+static void print_summaries(const struct report_walk *report)
+{
+	const struct report_options *options = report->options;
+	unsigned int n, bit;
+
+	for (n = 0; n < options->count; n++) {
+		printf("%s: %llu files\n", options->names[n], report->files);
+		for (bit = 0; bit < 32; bit++) {
+			unsigned long long granted =
+				report->summaries[n].granted[bit];
+			char *text;
+
+			if (!granted)
+				continue;
+			text = richacl_mask_to_text(1U << bit,
+						    RICHACL_TEXT_LONG);
+			if (!text)
+				continue;
+			printf("  %-28s %llu\n", text, granted);
+			free(text);
+		}
+	}
+}
+
+/**
+ * report  -  report the permissions of principals on files
+ * @paths:	files, and directories to report on recursively
+ *
+ * The files below the directories are processed by @options->jobs
+ * threads in no particular order.  When all files are done, print the
+ * number of files which grant each permission to each principal.
+ */
+int report(char **paths, int n_paths, const struct report_options *options)
+{
+	struct report_walk report;
+	int status;
+
+	memset(&report, 0, sizeof(report));
+	report.walk.jobs = options->jobs;
+	report.walk.attrs = STAT_MODE | STAT_OWNER;
+	report.walk.start = report_start;
+	report.walk.visit = report_file;
+	report.walk.finish = report_finish;
+	report.options = options;
+	report.summaries = calloc(options->count, sizeof(*report.summaries));
+	if (!report.summaries) {
+		perror(basename(progname));
+		return 1;
+	}
+	status = walk_tree(&report.walk, paths, n_paths);
+	print_summaries(&report);
+	free(report.summaries);
+	return status;
+}
@@ -0,0 +1,38 @@
+/*
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; either version 2, or (at your option) any
+  later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along
+  with this library; if not, write to the Free Software Foundation, Inc.,
+  59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+#ifndef __REPORT_H
+#define __REPORT_H
+
+struct richacl_principal;
+
+/*
+ * Effective permission report: the permissions of a set of principals on
+ * all files below some directories.
+ */
+
+struct report_options {
+	const char **names;		/* of the principals, for the output */
+	const struct richacl_principal *principals;
+	unsigned int count;		/* number of principals */
+	unsigned int jobs;		/* number of threads */
+	int per_file;			/* print the permissions of each file */
+	int format;			/* for richacl_mask_to_text() */
+};
+
+extern int report(char **paths, int n_paths, const struct report_options *);
+
+#endif  /* __REPORT_H */
@@ -39,12 +39,19 @@
 #include <ctype.h>
 #include <pwd.h>
 #include <grp.h>
+#include <pthread.h>
 
 #include "richacl.h"
 #include "string_buffer.h"
+#include "auto_inherit.h"
+#include "index.h"
+#include "journal.h"
+#include "remap.h"
+#include "report.h"
+#include "scan.h"
+#include "walk.h"
 
-static const char *progname;
-int opt_repropagate;
+const char *progname;
 
 void printf_stderr(const char *fmt, ...)
 {
@@ -55,275 +62,6 @@ void printf_stderr(const char *fmt, ...)
 	va_end(ap);
 }
 
-#define richacl_for_each_entry_continue(_ace, _acl) \
-	for ((_ace)++; \
-	     (_ace) != (_acl)->a_entries + (_acl)->a_count; \
-	     (_ace)++)
-
-static inline int richace_is_inherited(const struct richace *ace)
-{
-	return ace->e_flags & ACE4_INHERITED_ACE;
-}
-
-static void compute_masks(struct richacl *acl, int acl_has)
-{
-	unsigned int owner_mask = acl->a_owner_mask;
-	unsigned int group_mask = acl->a_group_mask;
-	unsigned int other_mask = acl->a_other_mask;
-
-	if ((acl_has & RICHACL_TEXT_OWNER_MASK) &&
-	    (acl_has & RICHACL_TEXT_GROUP_MASK) &&
-	    (acl_has & RICHACL_TEXT_OTHER_MASK) &&
-	    (acl_has & RICHACL_TEXT_FLAGS))
-		return;
-
-	if (!(acl_has & RICHACL_TEXT_FLAGS))
-		acl->a_flags &= ~ACL4_MASKED;
-	richacl_compute_max_masks(acl);
-	if (acl_has & RICHACL_TEXT_OWNER_MASK) {
-		if (!(acl_has & RICHACL_TEXT_FLAGS) &&
-		    (acl->a_owner_mask & ~owner_mask))
-			acl->a_flags |= ACL4_MASKED;
-		acl->a_owner_mask = owner_mask;
-	}
-	if (acl_has & RICHACL_TEXT_GROUP_MASK) {
-		if (!(acl_has & RICHACL_TEXT_FLAGS) &&
-		    (acl->a_group_mask & ~group_mask))
-			acl->a_flags |= ACL4_MASKED;
-		acl->a_group_mask = group_mask;
-	}
-	if (acl_has & RICHACL_TEXT_OTHER_MASK) {
-		if (!(acl_has & RICHACL_TEXT_FLAGS) &&
-		    (acl->a_other_mask & ~other_mask))
-			acl->a_flags |= ACL4_MASKED;
-		acl->a_other_mask = other_mask;
-	}
-}
-
-int modify_richacl(struct richacl **acl2, struct richacl *acl, int acl_has)
-{
-	struct richace *ace2, *ace;
-
-	if (richacl_apply_masks(acl2))
-		return -1;
-
-	richacl_for_each_entry(ace, acl) {
-		struct richacl *acl3;
-		struct richace *ace3;
-
-		richacl_for_each_entry(ace2, *acl2) {
-			if (ace2->e_type == ace->e_type &&
-			    richace_is_inherited(ace2) == richace_is_inherited(ace) &&
-			    richace_is_same_identifier(ace, ace2)) {
-				ace2->e_mask = ace->e_mask;
-				ace2->e_flags = ace->e_flags;
-				goto next_change;
-			}
-		}
-
-		acl3 = richacl_alloc((*acl2)->a_count + 1);
-		if (!acl3)
-			return -1;
-		acl3->a_flags = (*acl2)->a_flags;
-		ace3 = acl3->a_entries;
-		if (!(ace->e_flags & ACE4_INHERITED_ACE)) {
-			if (richace_is_deny(ace)) {
-				/*
-				 * Insert the new deny entry after the existing
-				 * initial non-inherited deny entries.
-				 */
-				richacl_for_each_entry(ace2, *acl2) {
-					if (!richace_is_deny(ace2) ||
-					    richace_is_inherited(ace2))
-						break;
-					richace_copy(ace3++, ace2);
-				}
-			} else {
-				/*
-				 * Append the new allow entry at the end of the
-				 * non-inherited aces.
-				 */
-				richacl_for_each_entry(ace2, *acl2) {
-					if (richace_is_inherited(ace2))
-						break;
-					richace_copy(ace3++, ace2);
-				}
-			}
-			richace_copy(ace3++, ace);
-			ace2--;
-			richacl_for_each_entry_continue(ace2, *acl2)
-				richace_copy(ace3++, ace2);
-		} else {
-			struct richace *last_inherited;
-
-			last_inherited = (*acl2)->a_entries + (*acl2)->a_count;
-			while (last_inherited > (*acl2)->a_entries &&
-			       richace_is_inherited(last_inherited - 1))
-				last_inherited--;
-
-			richacl_for_each_entry(ace2, *acl2) {
-				if (ace2 == last_inherited)
-					break;
-				richace_copy(ace3++, ace2);
-			}
-			if (richace_is_deny(ace)) {
-				/*
-				 * Insert the new deny entry after the existing
-				 * initial inherited deny entries.
-				 */
-				ace2--;
-				richacl_for_each_entry_continue(ace2, *acl2) {
-					if (!richace_is_deny(ace2))
-						break;
-					richace_copy(ace3++, ace2);
-				}
-			} else {
-				/*
-				 * Append the new allow entry at the end of the
-				 * inherited aces.
-				 */
-				ace2--;
-				richacl_for_each_entry_continue(ace2, *acl2)
-					richace_copy(ace3++, ace2);
-			}
-			richace_copy(ace3++, ace);
-			ace2--;
-			richacl_for_each_entry_continue(ace2, *acl2)
-				richace_copy(ace3++, ace2);
-		}
-
-		richacl_free(*acl2);
-		*acl2 = acl3;
-
-	next_change:
-		/* gcc is unhappy without a statement behind the label ... */ ;
-	}
-
-	if (acl_has & RICHACL_TEXT_FLAGS)
-		(*acl2)->a_flags = acl->a_flags;
-	if (acl_has & RICHACL_TEXT_OWNER_MASK)
-		(*acl2)->a_owner_mask = acl->a_owner_mask;
-	if (acl_has & RICHACL_TEXT_GROUP_MASK)
-		(*acl2)->a_group_mask = acl->a_group_mask;
-	if (acl_has & RICHACL_TEXT_OTHER_MASK)
-		(*acl2)->a_other_mask = acl->a_other_mask;
-	compute_masks(*acl2, acl_has);
-
-	return 0;
-}
-
-static int auto_inherit(const char *dirname, struct richacl *dir_acl)
-{
-	DIR *dir;
-	struct richacl *dir_inheritable, *file_inheritable;
-	struct dirent *dirent;
-	char *path = NULL;
-	size_t dirname_len;
-	int status = 0;
-
-	dir = opendir(dirname);
-	if (!dir) {
-		if (errno == ENOTDIR)
-			return 0;
-		return -1;
-	}
-
-	dirname_len = strlen(dirname);
-	path = malloc(dirname_len + 2);
-	if (!path)
-		goto fail;
-	sprintf(path, "%s/", dirname);
-
-	errno = 0;
-	file_inheritable = richacl_inherit(dir_acl, 0);
-	if (!file_inheritable && errno != 0)
-		goto fail;
-	dir_inheritable = richacl_inherit(dir_acl, 1);
-	if (!dir_inheritable && errno != 0)
-		goto fail;
-
-	while ((errno = 0, dirent = readdir(dir))) {
-		struct richacl *old_acl = NULL, *new_acl = NULL;
-		int isdir;
-		char *p;
-
-		if (!strcmp(dirent->d_name, ".") ||
-		    !strcmp(dirent->d_name, ".."))
-			continue;
-
-		p = realloc(path, strlen(dirname) + strlen(dirent->d_name) + 2);
-		if (!p)
-			goto fail;
-		path = p;
-		strcpy(path + dirname_len + 1, dirent->d_name);
-
-		if (dirent->d_type == DT_UNKNOWN) {
-			struct stat st;
-
-			if (lstat(path, &st))
-				goto fail2;
-			dirent->d_type = IFTODT(st.st_mode);
-		}
-		if (dirent->d_type == DT_LNK)
-			continue;
-		isdir = (dirent->d_type == DT_DIR);
-
-		old_acl = richacl_get_file(path);
-		if (!old_acl) {
-			if (errno == ENODATA || errno == ENOTSUP || errno == ENOSYS)
-				goto next;
-			goto fail2;
-		}
-		if (!richacl_is_auto_inherit(old_acl))
-			goto next;
-		if (old_acl->a_flags & ACL4_PROTECTED) {
-			if (!opt_repropagate)
-				goto next;
-			new_acl = old_acl;
-			old_acl = NULL;
-		} else {
-			int equal;
-			new_acl = richacl_auto_inherit(old_acl,
-					isdir ? dir_inheritable :
-						file_inheritable);
-			equal = !richacl_compare(old_acl, new_acl);
-			if (equal && !opt_repropagate)
-				goto next;
-			if (!equal && richacl_set_file(path, new_acl))
-				goto fail2;
-		}
-
-		if (isdir)
-			if (auto_inherit(path, new_acl))
-				goto fail2;
-
-	next:
-		free(old_acl);
-		free(new_acl);
-		continue;
-
-	fail2:
-		perror(path);
-		free(old_acl);
-		free(new_acl);
-		free(path);
-		status = -1;
-	}
-	if (errno != 0) {
-		perror(dirname);
-		status = -1;
-	}
-	free(path);
-	closedir(dir);
-	return status;
-
-fail:
-	perror(basename(progname));
-	free(path);
-	closedir(dir);
-	return -1;
-}
-
 static struct richacl *get_richacl(const char *file, mode_t mode)
 {
 	struct richacl *acl;
@@ -348,7 +86,7 @@ static int set_richacl(const char *path, struct richacl *acl)
 	if (richacl_set_file(path, acl)) {
 		struct stat st;
 
-		if (stat(path, &st))
+		if (stat_file(path, &st, STAT_MODE))
 			return -1;
 		if (!richacl_equiv_mode(acl, &st.st_mode))
 			return chmod(path, st.st_mode);
@@ -372,24 +110,77 @@ int format_for_mode(mode_t mode)
 		return RICHACL_TEXT_FILE_CONTEXT;
 }
 
+/*
+ * The text of recently printed acls.  In recursive listings, many files
+ * usually have the same acl, so the masks need not be applied and the acl
+ * need not be converted to text again.  Protected by output_lock.
+ */
+#define TEXT_CACHE_SIZE 256
+
+struct text_cache_entry {
+	uint64_t hash;
+	int fmt;
+	struct richacl *acl;	/* before applying the masks */
+	char *text;
+};
+
+static struct text_cache_entry text_cache[TEXT_CACHE_SIZE];
+
+static void free_text_cache(void)
+{
+	unsigned int n;
+
+	for (n = 0; n < TEXT_CACHE_SIZE; n++) {
+		richacl_free(text_cache[n].acl);
+		free(text_cache[n].text);
+	}
+	memset(text_cache, 0, sizeof(text_cache));
+}
+
 static int print_richacl(const char *file, struct richacl **acl,
 			 struct stat *st, int fmt)
 {
+	struct text_cache_entry *entry;
+	struct richacl *key;
+	uint64_t hash;
 	char *text;
 
+	fmt |= format_for_mode(st->st_mode);
+	hash = richacl_hash(*acl);
+	entry = text_cache + (hash ^ fmt) % TEXT_CACHE_SIZE;
+	if (entry->text && entry->hash == hash && entry->fmt == fmt &&
+	    !richacl_compare(entry->acl, *acl)) {
+		text = entry->text;
+		goto print;
+	}
+
+	/* The acl as read is the key; applying the masks changes it. */
+	key = richacl_clone(*acl);
 	if (!(fmt & RICHACL_TEXT_SHOW_MASKS)) {
 		if (richacl_apply_masks(acl))
 			goto fail;
 	}
-	text = richacl_to_text(*acl, fmt | format_for_mode(st->st_mode));
+	text = richacl_to_text(*acl, fmt);
 	if (!text)
 		goto fail;
+	if (key) {
+		richacl_free(entry->acl);
+		free(entry->text);
+		entry->hash = hash;
+		entry->fmt = fmt;
+		entry->acl = key;
+		entry->text = text;
+	}
+
+print:
 	printf("%s:\n", file);
 	puts(text);
-	free(text);
+	if (text != entry->text)
+		free(text);
 	return 0;
 
 fail:
+	richacl_free(key);
 	return -1;
 }
 
@@ -415,6 +206,55 @@ void remove_filename(struct string_buffer *buffer)
 	}
 }
 
+/* The performance counters of the --jobs worker threads which are done */
+static struct richacl_stats worker_stats;
+static pthread_mutex_t worker_stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void add_stats(struct richacl_stats *sum,
+		      const struct richacl_stats *stats)
+{
+	/* All counters are unsigned long long. */
+	unsigned long long *s = (unsigned long long *)sum;
+	const unsigned long long *t = (const unsigned long long *)stats;
+	size_t n;
+
+	for (n = 0; n < sizeof(*sum) / sizeof(*s); n++)
+		s[n] += t[n];
+}
+
+static void print_stats(void)
+{
+	struct richacl_stats stats;
+
+	richacl_stats_get(&stats);
+	add_stats(&stats, &worker_stats);
+	fprintf(stderr,
+		"xattr gets:          %llu\n"
+		"xattr sets:          %llu\n"
+		"xattr removes:       %llu\n"
+		"xattr bytes read:    %llu\n"
+		"xattr bytes written: %llu\n"
+		"decodes:             %llu\n"
+		"encodes:             %llu\n"
+		"access checks:       %llu\n"
+		"aces scanned:        %llu\n"
+		"max masks computed:  %llu\n"
+		"entry reallocs:      %llu\n"
+		"id lookups:          %llu\n"
+		"access cache hits:   %llu\n"
+		"access cache misses: %llu\n"
+		"shared cache hits:   %llu\n"
+		"shared cache misses: %llu\n",
+		stats.xattr_gets, stats.xattr_sets, stats.xattr_removes,
+		stats.xattr_bytes_read, stats.xattr_bytes_written,
+		stats.decodes, stats.encodes,
+		stats.access_checks, stats.aces_scanned,
+		stats.max_masks, stats.entry_reallocs,
+		stats.id_lookups, stats.access_cache_hits,
+		stats.access_cache_misses, stats.shared_cache_hits,
+		stats.shared_cache_misses);
+}
+
 static struct option long_options[] = {
 	{"access",		2, 0, 'a'},
 	{"get",			0, 0, 'g'},
@@ -429,6 +269,24 @@ static struct option long_options[] = {
 	{"full",                0, 0,  3 },
 	{"unaligned",		0, 0,  4 },
 	{"numeric-ids",		0, 0,  5 },
+	{"backend",		1, 0,  6 },
+	{"stats",		0, 0,  7 },
+	{"journal",		1, 0,  8 },
+	{"resume",		0, 0,  9 },
+	{"repropagate",		0, 0, 10 },
+	{"incremental",		0, 0, 11 },
+	{"batch",		0, 0, 12 },
+	{"null",		0, 0, '0'},
+	{"files-from",		1, 0, 13 },
+	{"jobs",		1, 0, 14 },
+	{"shared-cache",	1, 0, 15 },
+	{"report",		1, 0, 16 },
+	{"report-files",	0, 0, 17 },
+	{"index",		1, 0, 18 },
+	{"update-index",	0, 0, 19 },
+	{"find",		1, 0, 20 },
+	{"remap",		1, 0, 21 },
+	{"simplify",		0, 0, 22 },
 	{"version",		0, 0, 'v'},
 	{"help",		0, 0, 'h'},
 	{ NULL,			0, 0,  0 }
@@ -463,17 +321,62 @@ static void synopsis(int help)
 "              instead. If the file is `-', read from standard input.\n"
 "  --remove, -r\n"
 "              Remove the ACL of file(s).\n"
+"  --simplify  Remove redundant entries from the ACL of file(s) without\n"
+"              changing the permissions it grants, and merge adjacent\n"
+"              entries which only differ in their permissions.  With\n"
+"              --dry-run, show the resulting ACL instead.\n"
+"  --batch     Read operations from standard input, one per line:\n"
+"              get, set, modify, remove, simplify, or\n"
+"              access[=user[:group:...]], followed by a tab, the ACL and\n"
+"              another tab for set and modify, and the file name.  For each\n"
+"              operation, write ok or error, a tab, the resulting ACL,\n"
+"              permissions or error message, another tab, and the file name\n"
+"              on a line.\n"
 "  --access[=user[:group:...]}, -a[user[:group:...]}\n"
 "              Show which permissions the caller or a specified user has for\n"
 "              file(s).  When a list of groups is given, this overrides the\n"
 "              groups the user is in.\n"
 "              capabilities. \n"
+"  --report=user[:group:...], --report=:group[:group:...]\n"
+"              Report the permissions of the user, or of a member of the\n"
+"              groups, on the files and everything below the directories\n"
+"              given: for each permission, the number of files which grant\n"
+"              it.  Repeat to report on several users and groups at once.\n"
+"  --update-index\n"
+"              Record in the --index file which users and groups the ACLs\n"
+"              of the files and everything below the directories name.\n"
+"              ACLs of files whose ctime has not changed since the previous\n"
+"              update are not read again.\n"
+"  --find=user[:group:...], --find=:group[:group:...]\n"
+"              List the files in the --index file whose ACLs name the user\n"
+"              or any of its groups, or any of the groups.\n"
+"  --remap=file\n"
+"              Change the user and group IDs in the ACLs of the files and\n"
+"              everything below the directories as listed in file: one\n"
+"              `u old new' or `g old new' per line.  ACLs which do not\n"
+"              name any of the old IDs are not written.  With --dry-run,\n"
+"              list the files which would change instead.\n"
 "  --version, -v\n"
 "              Display the version of %s and exit.\n"
 "  --help, -h  This help text.\n"
 "\n"
 "Options:\n"
 "  --long, -l  Display access masks and flags in their long form.\n"
+"  --files-from=file\n"
+"              Also process the files listed in file, one per line.  If\n"
+"              file is `-', read the list from standard input.\n"
+"  --null, -0  With --files-from, file names are terminated by null\n"
+"              characters instead of newlines, as written by find -print0.\n"
+"              With --batch, operations and results are null terminated.\n"
+"  --jobs=n    Process n files in parallel.  The output for different\n"
+"              files is not in any particular order then.\n"
+"  --index=file\n"
+"              The index for --update-index and --find.  Use absolute file\n"
+"              names with --update-index to make the index independent of\n"
+"              the working directory.\n"
+"  --report-files\n"
+"              With --report, also show the permissions of each user and\n"
+"              group on each file.\n"
 "  --full      Also show permissions which are always implicitly allowed.\n"
 "  --raw       Show acls as stored on the file system including the file masks.\n"
 "              Implies --full.\n"
@@ -482,6 +385,31 @@ static void synopsis(int help)
 "              missing permissions with '-'.\n"
 "  --numeric-ids\n"
 "              Display numeric user and group IDs instead of names.\n"
+"  --backend=xattr|user|emulated[:latency]\n"
+"              Where to store ACLs: in the system.richacl attribute (the\n"
+"              default), in the user.richacl attribute, or in memory for\n"
+"              the lifetime of the command, delaying each operation by\n"
+"              latency microseconds.\n"
+"  --shared-cache=file\n"
+"              Keep the ACLs read in the cache file (for example, in\n"
+"              /dev/shm), and reuse the ACLs cached there by other\n"
+"              processes when the files have not changed since.\n"
+"  --journal=file\n"
+"              When propagating inheritable permissions to files below a\n"
+"              directory, record the subdirectories completed in file.\n"
+"  --resume    Resume an interrupted propagation: skip the subdirectories\n"
+"              recorded in the --journal file.  Repeat the interrupted\n"
+"              command from the same working directory.\n"
+"  --repropagate\n"
+"              Propagate inheritable permissions into all subdirectories,\n"
+"              including protected ones, even when their ACLs do not change.\n"
+"  --incremental\n"
+"              Remember which inheritable permissions were propagated into\n"
+"              each directory (in the user.richacl.propagated attribute),\n"
+"              and skip directories for which they have not changed since.\n"
+"  --stats     When done, print how often the library accessed the ACL\n"
+"              storage, evaluated ACL entries, looked up user and group\n"
+"              names, and so on to standard error.\n"
 "\n"
 "ACL entries are represented by colon separated <who>:<mask>:<flags>:<type>\n"
 "fields. The <who> field may be \"owner@\", \"group@\", \"everyone@\", a user\n"
@@ -508,10 +436,640 @@ static void synopsis(int help)
 	exit(0);
 }
 
+enum {
+	CMD_GET,
+	CMD_SET,
+	CMD_MODIFY,
+	CMD_REMOVE,
+	CMD_ACCESS,
+	CMD_SIMPLIFY,
+};
+
+struct command {
+	int cmd;
+	int dry_run;
+	int format;
+	struct richacl *acl;
+	int acl_has;
+	uid_t user;
+	gid_t *groups;
+	int n_groups;
+};
+
+/*
+ * Parse a user[:group:...] specification.  When no groups are given, use
+ * the groups the user is in.  On error, errno is set, or zero when the
+ * error has already been reported.
+ */
+static int parse_user(char *spec, uid_t *user, gid_t **groups, int *n_groups)
+{
+	int n_groups_alloc;
+	char *opt_groups;
+	struct passwd *passwd = NULL;
+	char *endp;
+
+	*groups = NULL;
+	opt_groups = strchr(spec, ':');
+	if (opt_groups)
+		*opt_groups++ = 0;
+
+	*user = strtoul(spec, &endp, 10);
+	if (!*spec && opt_groups)
+		*user = -1;  /* only the groups */
+	else if (*endp) {
+		passwd = getpwnam(spec);
+		if (passwd == NULL) {
+			fprintf(stderr, "%s: No such user\n", spec);
+			errno = 0;
+			return -1;
+		}
+		*user = passwd->pw_uid;
+	}
+
+	n_groups_alloc = 32;
+	*groups = malloc(sizeof(gid_t) * n_groups_alloc);
+	if (!*groups)
+		return -1;
+	if (opt_groups) {
+		char *tok;
+		*n_groups = 0;
+		tok = strtok(opt_groups, ":");
+		while (tok) {
+			struct group *group;
+
+			if (*n_groups == n_groups_alloc) {
+				gid_t *new_groups;
+				n_groups_alloc *= 2;
+				new_groups = realloc(*groups, sizeof(gid_t) * n_groups_alloc);
+				if (!new_groups)
+					goto fail;
+				*groups = new_groups;
+			}
+
+			(*groups)[*n_groups] = strtoul(tok, &endp, 10);
+			if (*endp) {
+				group = getgrnam(tok);
+				if (!group) {
+					fprintf(stderr, "%s: No such group\n", tok);
+					errno = 0;
+					goto fail;
+				}
+				(*groups)[*n_groups] = group->gr_gid;
+			}
+			(*n_groups)++;
+
+			tok = strtok(NULL, ":");
+		}
+	} else {
+		if (!passwd)
+			passwd = getpwuid(*user);
+		if (passwd) {
+			*n_groups = n_groups_alloc;
+			if (getgrouplist(passwd->pw_name, passwd->pw_gid,
+				         *groups, n_groups) < 0) {
+				free(*groups);
+				*groups = malloc(sizeof(gid_t) * *n_groups);
+				if (!*groups)
+					return -1;
+				if (getgrouplist(passwd->pw_name, passwd->pw_gid,
+						 *groups, n_groups) < 0)
+					goto fail;
+			}
+		} else
+			*n_groups = 0;
+	}
+	return 0;
+
+fail:
+	free(*groups);
+	*groups = NULL;
+	return -1;
+}
+
+/* Add a --report principal. */
+static int add_principal(struct richacl_principal **principals,
+			 const char ***names, unsigned int *count, char *spec)
+{
+	struct richacl_principal *p;
+	const char **n;
+	gid_t *groups;
+
+	p = realloc(*principals, sizeof(*p) * (*count + 1));
+	if (!p)
+		return -1;
+	*principals = p;
+	n = realloc(*names, sizeof(*n) * (*count + 1));
+	if (!n)
+		return -1;
+	*names = n;
+	n[*count] = strdup(spec);
+	if (!n[*count])
+		return -1;
+	p += *count;
+	if (parse_user(spec, &p->user, &groups, &p->n_groups)) {
+		free((char *)n[*count]);
+		return -1;
+	}
+	p->groups = groups;
+	(*count)++;
+	return 0;
+}
+
+/*
+ * Run @cmd on @file.  For --get and --dry-run, the acl to display is
+ * returned in @acl2; for --access, the permissions are returned in @mask.
+ * On error, errno is set, or zero when the error has already been
+ * reported.
+ */
+static int run_command(const struct command *cmd, const char *file,
+		       struct stat *st, struct richacl **acl2,
+		       unsigned int *mask)
+{
+	int ret;
+
+	*acl2 = NULL;
+	if (cmd->cmd == CMD_GET || cmd->cmd == CMD_MODIFY ||
+	    cmd->cmd == CMD_ACCESS || cmd->dry_run) {
+		if (stat_file(file, st, cmd->cmd == CMD_ACCESS ?
+				STAT_MODE | STAT_OWNER : STAT_MODE))
+			return -1;
+	} else
+		memset(st, 0, sizeof(*st));
+
+	switch (cmd->cmd) {
+	case CMD_SET:
+		if (cmd->dry_run) {
+			*acl2 = richacl_clone(cmd->acl);
+			if (!*acl2)
+				return -1;
+		} else {
+			if (set_richacl(file, cmd->acl))
+				return -1;
+		}
+		break;
+
+	case CMD_MODIFY:
+		*acl2 = get_richacl(file, st->st_mode);
+		if (!*acl2)
+			return -1;
+		if (richacl_modify(acl2, cmd->acl, cmd->acl_has))
+			goto fail;
+		if (!cmd->dry_run) {
+			if (set_richacl(file, *acl2))
+				goto fail;
+			richacl_free(*acl2);
+			*acl2 = NULL;
+		}
+		break;
+
+	case CMD_SIMPLIFY:
+		*acl2 = richacl_get_file(file);
+		if (!*acl2) {
+			/* Without an acl, there is nothing to simplify. */
+			if (errno == ENODATA)
+				return 0;
+			return -1;
+		}
+		ret = richacl_simplify(*acl2);
+		if (ret < 0)
+			goto fail;
+		if (!cmd->dry_run) {
+			if (ret && set_richacl(file, *acl2))
+				goto fail;
+			richacl_free(*acl2);
+			*acl2 = NULL;
+		}
+		break;
+
+	case CMD_REMOVE:
+		if (richacl_remove_file(file)) {
+			if (errno != ENODATA)
+				return -1;
+		}
+		break;
+
+	case CMD_ACCESS:
+		ret = richacl_access(file, st, cmd->user, cmd->groups,
+				     cmd->n_groups);
+		if (ret < 0)
+			return -1;
+		*mask = ret;
+		break;
+
+	default:  /* CMD_GET */
+		*acl2 = get_richacl(file, st->st_mode);
+		if (!*acl2)
+			return -1;
+		break;
+	}
+	return 0;
+
+fail:
+	ret = errno;
+	richacl_free(*acl2);
+	*acl2 = NULL;
+	errno = ret;
+	return -1;
+}
+
+/*
+ * Batch mode state: consecutive operations usually use the same acl or
+ * user, so remember the last one parsed.
+ */
+struct batch_cache {
+	int cmd;
+	char *acl_text;
+	struct richacl *acl;
+	int acl_has;
+	char *user_spec;
+	uid_t user;
+	gid_t *groups;
+	int n_groups;
+};
+
+static void batch_result(const char *status, const char *result,
+			 const char *path, int delim)
+{
+	printf("%s\t%s\t%s%c", status, result, path, delim);
+	fflush(stdout);
+}
+
+static int batch_acl(struct batch_cache *cache, int cmd, const char *text)
+{
+	struct richacl *acl;
+	char *dup;
+	int acl_has;
+
+	if (cache->acl_text && cache->cmd == cmd &&
+	    !strcmp(cache->acl_text, text))
+		return 0;
+	errno = 0;
+	acl = richacl_from_text(text, &acl_has, printf_stderr);
+	if (!acl) {
+		if (!errno)
+			errno = EINVAL;
+		return -1;
+	}
+	dup = strdup(text);
+	if (!dup) {
+		richacl_free(acl);
+		return -1;
+	}
+	/* Compute all masks which haven't been set explicitly. */
+	if (cmd == CMD_SET)
+		richacl_compute_masks(acl, acl_has);
+	free(cache->acl_text);
+	richacl_free(cache->acl);
+	cache->cmd = cmd;
+	cache->acl_text = dup;
+	cache->acl = acl;
+	cache->acl_has = acl_has;
+	return 0;
+}
+
+static int batch_user(struct batch_cache *cache, const char *spec)
+{
+	char *dup, *key;
+	gid_t *groups;
+	int n_groups;
+	uid_t user;
+
+	if (cache->user_spec && !strcmp(cache->user_spec, spec))
+		return 0;
+	key = strdup(spec);
+	dup = strdup(spec);
+	if (!key || !dup)
+		goto fail;
+	if (parse_user(dup, &user, &groups, &n_groups)) {
+		if (!errno)
+			errno = EINVAL;
+		goto fail;
+	}
+	free(dup);
+	free(cache->user_spec);
+	free(cache->groups);
+	cache->user_spec = key;
+	cache->user = user;
+	cache->groups = groups;
+	cache->n_groups = n_groups;
+	return 0;
+
+fail:
+	free(key);
+	free(dup);
+	return -1;
+}
+
+/*
+ * Execute one batch record of the form command<TAB>[acl<TAB>]path and
+ * write its result record.
+ */
+static int batch_command(struct batch_cache *cache,
+			 const struct command *defaults,
+			 char *record, int delim)
+{
+	struct command cmd = *defaults;
+	int format = cmd.format & ~RICHACL_TEXT_ALIGN;
+	char *arg, *path, *text = NULL, *c;
+	struct richacl *acl2;
+	unsigned int mask;
+	struct stat st;
+
+	path = strchr(record, '\t');
+	if (!path) {
+		path = "";
+		goto fail_einval;
+	}
+	*path++ = 0;
+	arg = strchr(record, '=');
+	if (arg)
+		*arg++ = 0;
+
+	if (!strcmp(record, "get"))
+		cmd.cmd = CMD_GET;
+	else if (!strcmp(record, "set"))
+		cmd.cmd = CMD_SET;
+	else if (!strcmp(record, "modify"))
+		cmd.cmd = CMD_MODIFY;
+	else if (!strcmp(record, "remove"))
+		cmd.cmd = CMD_REMOVE;
+	else if (!strcmp(record, "simplify"))
+		cmd.cmd = CMD_SIMPLIFY;
+	else if (!strcmp(record, "access"))
+		cmd.cmd = CMD_ACCESS;
+	else
+		goto fail_einval;
+	if (arg && cmd.cmd != CMD_ACCESS)
+		goto fail_einval;
+
+	if (cmd.cmd == CMD_SET || cmd.cmd == CMD_MODIFY) {
+		text = path;
+		path = strchr(text, '\t');
+		if (!path) {
+			path = "";
+			goto fail_einval;
+		}
+		*path++ = 0;
+		if (batch_acl(cache, cmd.cmd, text))
+			goto fail;
+		cmd.acl = cache->acl;
+		cmd.acl_has = cache->acl_has;
+	} else if (cmd.cmd == CMD_ACCESS && arg) {
+		if (batch_user(cache, arg))
+			goto fail;
+		cmd.user = cache->user;
+		cmd.groups = cache->groups;
+		cmd.n_groups = cache->n_groups;
+	}
+
+	if (run_command(&cmd, path, &st, &acl2, &mask)) {
+		if (!errno)
+			errno = EINVAL;
+		goto fail;
+	}
+	if (acl2) {
+		if (!(cmd.format & RICHACL_TEXT_SHOW_MASKS) &&
+		    richacl_apply_masks(&acl2)) {
+			richacl_free(acl2);
+			goto fail;
+		}
+		text = richacl_to_text(acl2, format |
+					     format_for_mode(st.st_mode));
+		richacl_free(acl2);
+	} else if (cmd.cmd == CMD_ACCESS)
+		text = richacl_mask_to_text(mask, format |
+						  format_for_mode(st.st_mode));
+	else
+		text = strdup("");
+	if (!text)
+		goto fail;
+	/* Put the acl entries on a single line. */
+	for (c = text; *c; c++) {
+		if (*c == '\n')
+			*c = c[1] ? ',' : 0;
+	}
+	batch_result("ok", text, path, delim);
+	free(text);
+	return 0;
+
+fail_einval:
+	errno = EINVAL;
+fail:
+	batch_result("error", strerror(errno), path, delim);
+	return -1;
+}
+
+static int run_batch(const struct command *defaults, int delim)
+{
+	struct batch_cache cache;
+	char *record = NULL;
+	size_t size = 0;
+	ssize_t len;
+	int status = 0;
+
+	memset(&cache, 0, sizeof(cache));
+	while ((len = getdelim(&record, &size, delim, stdin)) != -1) {
+		if (len && record[len - 1] == delim)
+			record[--len] = 0;
+		if (!len)
+			continue;
+		if (batch_command(&cache, defaults, record, delim))
+			status = 1;
+	}
+	if (ferror(stdin)) {
+		perror(basename(progname));
+		status = 1;
+	}
+	free(record);
+	free(cache.acl_text);
+	richacl_free(cache.acl);
+	free(cache.user_spec);
+	free(cache.groups);
+	return status;
+}
+
+/*
+ * Serializes the output of the --jobs worker threads, so that the lines
+ * printed for different files do not interleave.  Also protects the text
+ * cache.
+ */
+static pthread_mutex_t output_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int process_file(const struct command *cmd, const char *file)
+{
+	struct richacl *acl2;
+	unsigned int mask;
+	struct stat st;
+	int status = 0;
+
+	if (run_command(cmd, file, &st, &acl2, &mask)) {
+		if (errno)
+			perror(file);
+		return 1;
+	}
+	pthread_mutex_lock(&output_lock);
+	if (acl2) {
+		if (print_richacl(file, &acl2, &st, cmd->format)) {
+			perror(file);
+			status = 1;
+		}
+	} else if (cmd->cmd == CMD_ACCESS) {
+		richacl_fprint_mask_text(mask,
+				cmd->format | format_for_mode(st.st_mode),
+				stdout);
+		printf("  %s\n", file);
+	}
+	pthread_mutex_unlock(&output_lock);
+	richacl_free(acl2);
+	return status;
+}
+
+/*
+ * The files to process: the file name arguments, followed by the names
+ * read from the --files-from file.  Shared by all worker threads.
+ */
+struct file_list {
+	pthread_mutex_t lock;
+	char **argv;
+	int argc, next;
+	FILE *file;
+	const char *name;
+	int delim;
+	char *record;
+	size_t size;
+	int error;
+};
+
+static char *next_file(struct file_list *list)
+{
+	char *file = NULL;
+	ssize_t len;
+
+	pthread_mutex_lock(&list->lock);
+	if (list->next < list->argc) {
+		file = strdup(list->argv[list->next++]);
+		if (!file)
+			goto fail;
+	} else if (list->file && !list->error) {
+		while ((len = getdelim(&list->record, &list->size,
+				       list->delim, list->file)) != -1) {
+			if (len && list->record[len - 1] == list->delim)
+				list->record[--len] = 0;
+			if (len)
+				break;
+		}
+		if (len == -1) {
+			if (ferror(list->file)) {
+				perror(list->name);
+				list->error = 1;
+			}
+		} else {
+			file = strdup(list->record);
+			if (!file)
+				goto fail;
+		}
+	}
+	pthread_mutex_unlock(&list->lock);
+	return file;
+
+fail:
+	perror(basename(progname));
+	list->error = 1;
+	pthread_mutex_unlock(&list->lock);
+	return NULL;
+}
+
+static int process_list(const struct command *cmd, struct file_list *list)
+{
+	char *file;
+	int status = 0;
+
+	while ((file = next_file(list))) {
+		if (process_file(cmd, file))
+			status = 1;
+		free(file);
+	}
+	return status;
+}
+
+struct worker {
+	pthread_t thread;
+	const struct command *cmd;
+	struct file_list *list;
+	int status;
+};
+
+void collect_worker_stats(void)
+{
+	struct richacl_stats stats;
+
+	richacl_stats_get(&stats);
+	pthread_mutex_lock(&worker_stats_lock);
+	add_stats(&worker_stats, &stats);
+	pthread_mutex_unlock(&worker_stats_lock);
+}
+
+static void *worker_main(void *arg)
+{
+	struct worker *worker = arg;
+
+	worker->status = process_list(worker->cmd, worker->list);
+	collect_worker_stats();
+	return NULL;
+}
+
+/*
+ * Process all files in @list with @jobs threads.  With a single job, the
+ * files are processed in the calling thread, in order.
+ */
+static int process_files(const struct command *cmd, struct file_list *list,
+			 unsigned int jobs)
+{
+	struct worker *workers;
+	unsigned int n, started;
+	int status = 0;
+
+	if (jobs > 1) {
+		workers = calloc(jobs, sizeof(*workers));
+		if (!workers) {
+			perror(basename(progname));
+			return 1;
+		}
+		for (started = 0; started < jobs; started++) {
+			workers[started].cmd = cmd;
+			workers[started].list = list;
+			if (pthread_create(&workers[started].thread, NULL,
+					   worker_main, workers + started))
+				break;
+		}
+		for (n = 0; n < started; n++) {
+			pthread_join(workers[n].thread, NULL);
+			status |= workers[n].status;
+		}
+		free(workers);
+		/* Without any threads, process the files here. */
+		if (started)
+			return status | list->error;
+	}
+	return process_list(cmd, list) | list->error;
+}
+
 int main(int argc, char *argv[])
 {
 	int opt_get = 0, opt_remove = 0, opt_access = 0, opt_dry_run = 0;
-	int opt_modify = 0, opt_set = 0;
+	int opt_simplify = 0;
+	int opt_modify = 0, opt_set = 0, opt_resume = 0;
+	int opt_batch = 0, opt_null = 0, opt_report_files = 0;
+	struct report_options report_options;
+	struct richacl_principal *principals = NULL;
+	const char **principal_names = NULL;
+	unsigned int n_principals = 0;
+	char *opt_index = NULL, *opt_find = NULL, *opt_remap = NULL;
+	struct id_map *id_map;
+	int opt_update_index = 0;
+	char *opt_files_from = NULL;
+	unsigned int opt_jobs = 1;
+	char *opt_journal = NULL;
 	char *opt_user = NULL;
 	char *acl_text = NULL, *acl_file = NULL;
 	int format = RICHACL_TEXT_SIMPLIFY | RICHACL_TEXT_ALIGN;
@@ -522,11 +1080,13 @@ int main(int argc, char *argv[])
 	int c;
 
 	struct richacl *acl = NULL;
-	int acl_has;
+	struct richacl_backend *backend = NULL;
+	struct command cmd;
+	int acl_has = 0;
 
 	progname = argv[0];
 
-	while ((c = getopt_long(argc, argv, "gm:M:s:S:a::rlvh",
+	while ((c = getopt_long(argc, argv, "gm:M:s:S:a::rl0vh",
 				long_options, NULL)) != -1) {
 		switch(c) {
 			case 'g':
@@ -564,6 +1124,10 @@ int main(int argc, char *argv[])
 				format |= RICHACL_TEXT_LONG;
 				break;
 
+			case '0':
+				opt_null = 1;
+				break;
+
 			case 'v':
 				printf("%s %s\n", basename(progname), VERSION);
 				exit(0);
@@ -593,15 +1157,121 @@ int main(int argc, char *argv[])
 				format |= RICHACL_TEXT_NUMERIC_IDS;
 				break;
 
+			case 6:  /* --backend */
+				/* The last --backend option wins. */
+				richacl_set_backend(NULL);
+				richacl_free_backend(backend);
+				backend = richacl_backend_by_name(optarg);
+				if (!backend) {
+					fprintf(stderr, "%s: unknown backend `%s'\n",
+						basename(progname), optarg);
+					exit(1);
+				}
+				richacl_set_backend(backend);
+				break;
+
+			case 7:  /* --stats */
+				if (!richacl_stats_enable(1))
+					atexit(print_stats);
+				break;
+
+			case 8:  /* --journal */
+				opt_journal = optarg;
+				break;
+
+			case 9:  /* --resume */
+				opt_resume = 1;
+				break;
+
+			case 10:  /* --repropagate */
+				opt_repropagate = 1;
+				break;
+
+			case 11:  /* --incremental */
+				opt_incremental = 1;
+				break;
+
+			case 12:  /* --batch */
+				opt_batch = 1;
+				break;
+
+			case 13:  /* --files-from */
+				opt_files_from = optarg;
+				break;
+
+			case 14:  /* --jobs */
+				opt_jobs = strtoul(optarg, NULL, 0);
+				if (!opt_jobs)
+					opt_jobs = 1;
+				break;
+
+			case 15:  /* --shared-cache */
+				if (richacl_shared_cache_open(optarg, 16384)) {
+					perror(optarg);
+					exit(1);
+				}
+				break;
+
+			case 16:  /* --report */
+				if (add_principal(&principals,
+						  &principal_names,
+						  &n_principals, optarg)) {
+					if (errno)
+						goto fail;
+					exit(1);
+				}
+				break;
+
+			case 17:  /* --report-files */
+				opt_report_files = 1;
+				break;
+
+			case 18:  /* --index */
+				opt_index = optarg;
+				break;
+
+			case 19:  /* --update-index */
+				opt_update_index = 1;
+				break;
+
+			case 20:  /* --find */
+				opt_find = optarg;
+				break;
+
+			case 21:  /* --remap */
+				opt_remap = optarg;
+				break;
+
+			case 22:  /* --simplify */
+				opt_simplify = 1;
+				break;
+
 			default:
 				synopsis(0);
 				break;
 		}
 	}
-	if (opt_get + opt_remove + opt_modify + opt_set + opt_access != 1 ||
+	if (opt_get + opt_remove + opt_modify + opt_set + opt_access +
+	    opt_simplify +
+	    opt_batch + (n_principals ? 1 : 0) + opt_update_index +
+	    (opt_find ? 1 : 0) + (opt_remap ? 1 : 0) != 1 ||
+	    (opt_index ? 1 : 0) != opt_update_index + (opt_find ? 1 : 0) ||
+	    (opt_report_files && !n_principals) ||
+	    ((n_principals || opt_update_index || opt_find || opt_remap) &&
+	     opt_files_from) ||
 	    (acl_text ? 1 : 0) + (acl_file ? 1 : 0) > 1 ||
-	    optind == argc)
-		synopsis(optind != argc);
+	    (opt_resume && !opt_journal) ||
+	    (opt_null && !opt_batch && !opt_files_from && !opt_find) ||
+	    (opt_batch ? optind != argc || opt_files_from || opt_jobs > 1 :
+	     opt_find ? optind != argc :
+			optind == argc && !opt_files_from))
+		synopsis(opt_batch || opt_files_from || opt_find ?
+			 optind == argc : optind != argc);
+
+	if (opt_journal && journal_open(opt_journal, opt_resume)) {
+		perror(opt_journal);
+		return 1;
+	}
 
 	if (acl_text) {
 		acl = richacl_from_text(acl_text, &acl_has, printf_stderr);
@@ -649,153 +1319,98 @@ int main(int argc, char *argv[])
 	/* Compute all masks which haven't been set explicitly. */
 	/* FIXME: how about --modify? */
 	if (opt_set && acl)
-		compute_masks(acl, acl_has);
+		richacl_compute_masks(acl, acl_has);
 
 	if (opt_user) {
-		int n_groups_alloc;
-		char *opt_groups;
-		struct passwd *passwd = NULL;
-		char *endp;
-
-		opt_groups = strchr(opt_user, ':');
-		if (opt_groups)
-			*opt_groups++ = 0;
-
-		user = strtoul(opt_user, &endp, 10);
-		if (*endp) {
-			passwd = getpwnam(opt_user);
-			if (passwd == NULL) {
-				fprintf(stderr, "%s: No such user\n", opt_user);
-				exit(1);
-			}
-			user = passwd->pw_uid;
-		} else
-			user = -1;
-
-		n_groups_alloc = 32;
-		groups = malloc(sizeof(gid_t) * n_groups_alloc);
-		if (!groups)
-			goto fail;
-		if (opt_groups) {
-			char *tok;
-			n_groups = 0;
-			tok = strtok(opt_groups, ":");
-			while (tok) {
-				struct group *group;
-
-				if (n_groups == n_groups_alloc) {
-					gid_t *new_groups;
-					n_groups_alloc *= 2;
-					new_groups = realloc(groups, sizeof(gid_t) * n_groups_alloc);
-					if (!new_groups)
-						goto fail;
-				}
-
-				groups[n_groups] = strtoul(tok, &endp, 10);
-				if (*endp) {
-					group = getgrnam(tok);
-					if (!group) {
-						fprintf(stderr, "%s: No such group\n", tok);
-						exit(1);
-					}
-					groups[n_groups] = group->gr_gid;
-				}
-				n_groups++;
-
-				tok = strtok(NULL, ":");
-			}
-		} else {
-			if (!passwd)
-				passwd = getpwuid(user);
-			if (passwd) {
-				n_groups = n_groups_alloc;
-				if (getgrouplist(passwd->pw_name, passwd->pw_gid,
-					         groups, &n_groups) < 0) {
-					free(groups);
-					groups = malloc(sizeof(gid_t) * n_groups);
-					if (getgrouplist(passwd->pw_name, passwd->pw_gid,
-							 groups, &n_groups) < 0)
-						goto fail;
-				}
-			} else
-				n_groups = 0;
+		if (parse_user(opt_user, &user, &groups, &n_groups)) {
+			if (errno)
+				goto fail;
+			exit(1);
 		}
 	} else
 		user = geteuid();
 
-	for (; optind < argc; optind++) {
-		const char *file = argv[optind];
-		struct richacl *acl2 = NULL;
-		struct stat st;
-
-		if (opt_get || opt_modify || opt_access || opt_dry_run) {
-			if (stat(file, &st))
-				goto fail2;
-		} else
-			memset(&st, 0, sizeof(st));
-
-		if (opt_set) {
-			if (opt_dry_run) {
-				if (print_richacl(file, &acl, &st, format))
-					goto fail2;
-			} else {
-				if (set_richacl(file, acl))
-					goto fail2;
-			}
-		} else if (opt_modify) {
-			acl2 = get_richacl(file, st.st_mode);
-			if (!acl2) {
-				if (!errno)
-					goto fail3;
-				goto fail2;
-			}
-			if (modify_richacl(&acl2, acl, acl_has))
-				goto fail2;
-			if (opt_dry_run) {
-				if (print_richacl(file, &acl2, &st, format))
-					goto fail2;
-			} else {
-				if (set_richacl(file, acl2))
-					goto fail2;
-			}
-		} else if (opt_remove) {
-			if (removexattr(file, "system.richacl")) {
-				if (errno != ENODATA)
-					goto fail2;
-			}
-		} else if (opt_access) {
-			unsigned int mask;
-			char *mask_text;
-
-			mask = richacl_access(file, &st, user, groups, n_groups);
-			if (mask < 0)
-				goto fail2;
-
-			mask_text = richacl_mask_to_text(mask,
-					format | format_for_mode(st.st_mode));
-			printf("%s  %s\n", mask_text, file);
-			free(mask_text);
-		} else /* opt_get */ {
-			acl2 = get_richacl(file, st.st_mode);
-			if (!acl2) {
-				if (!errno)
-					goto fail3;
-				goto fail2;
+	memset(&cmd, 0, sizeof(cmd));
+	cmd.cmd = opt_set ? CMD_SET : opt_modify ? CMD_MODIFY :
+		  opt_remove ? CMD_REMOVE : opt_access ? CMD_ACCESS :
+		  opt_simplify ? CMD_SIMPLIFY : CMD_GET;
+	cmd.dry_run = opt_dry_run;
+	cmd.format = format;
+	cmd.acl = acl;
+	cmd.acl_has = acl_has;
+	cmd.user = user;
+	cmd.groups = groups;
+	cmd.n_groups = n_groups;
+
+	if (opt_batch)
+		status = run_batch(&cmd, opt_null ? 0 : '\n');
+	else if (opt_update_index)
+		status = update_index(opt_index, argv + optind, argc - optind,
+				      opt_jobs);
+	else if (opt_find) {
+		if (parse_user(opt_find, &user, &groups, &n_groups)) {
+			if (errno)
+				goto fail;
+			exit(1);
+		}
+		status = find_in_index(opt_index, user, groups, n_groups,
+				       opt_null ? 0 : '\n');
+	} else if (opt_remap) {
+		id_map = read_id_map(opt_remap);
+		if (!id_map)
+			exit(1);
+		status = remap(argv + optind, argc - optind, id_map, opt_jobs,
+			       opt_dry_run);
+		free_id_map(id_map);
+	} else if (n_principals) {
+		memset(&report_options, 0, sizeof(report_options));
+		report_options.names = principal_names;
+		report_options.principals = principals;
+		report_options.count = n_principals;
+		report_options.jobs = opt_jobs;
+		report_options.per_file = opt_report_files;
+		report_options.format = format;
+		status = report(argv + optind, argc - optind, &report_options);
+	} else {
+		struct file_list list;
+
+		memset(&list, 0, sizeof(list));
+		pthread_mutex_init(&list.lock, NULL);
+		list.argv = argv;
+		list.argc = argc;
+		list.next = optind;
+		if (opt_files_from) {
+			list.name = opt_files_from;
+			list.delim = opt_null ? 0 : '\n';
+			list.file = stdin;
+			if (strcmp(opt_files_from, "-")) {
+				list.file = fopen(opt_files_from, "r");
+				if (!list.file) {
+					perror(opt_files_from);
+					return 1;
+				}
 			}
-			if (print_richacl(file, &acl2, &st, format))
-				goto fail2;
 		}
-		richacl_free(acl2);
-		continue;
+		status = process_files(&cmd, &list, opt_jobs);
+		if (list.file && list.file != stdin)
+			fclose(list.file);
+		free(list.record);
+		pthread_mutex_destroy(&list.lock);
+	}
 
-	fail2:
-		richacl_free(acl2);
-		perror(file);
-	fail3:
+	if (journal_close()) {
+		perror(opt_journal);
 		status = 1;
 	}
-
+	while (n_principals--) {
+		free((gid_t *)principals[n_principals].groups);
+		free((char *)principal_names[n_principals]);
+	}
+	free(principals);
+	free(principal_names);
+	free_text_cache();
 	richacl_free(acl);
+	richacl_free_backend(backend);
 	return status;
 
 fail:
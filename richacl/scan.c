@@ -0,0 +1,224 @@
+/*
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; either version 2, or (at your option) any
+  later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along
+  with this library; if not, write to the Free Software Foundation, Inc.,
+  59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/sysmacros.h>
+
+#include "scan.h"
+
+/* Size of the getdents64 buffer */
+#define SCAN_BUFFER_SIZE 65536
+
+#ifdef STATX_TYPE
+/* Cleared when the kernel does not support statx(); shared by the walk
+   threads. */
+static int have_statx = 1;
+
+static void statx_to_stat(const struct statx *stx, struct stat *st)
+{
+	st->st_mode = stx->stx_mode;
+	st->st_uid = stx->stx_uid;
+	st->st_gid = stx->stx_gid;
+	st->st_ino = stx->stx_ino;
+	st->st_dev = makedev(stx->stx_dev_major, stx->stx_dev_minor);
+	st->st_ctim.tv_sec = stx->stx_ctime.tv_sec;
+	st->st_ctim.tv_nsec = stx->stx_ctime.tv_nsec;
+	st->st_nlink = stx->stx_nlink;
+}
+#endif
+
+/**
+ * stat_file  -  get some attributes of a file
+ * @attrs:	%STAT_MODE, %STAT_OWNER, %STAT_CTIME, and/or %STAT_NLINK
+ *
+ * Only the requested attributes and st_ino and st_dev are valid in @st on
+ * return.  Uses statx() with a minimal mask when available, and stat()
+ * when the file system does not return all the requested attributes.
+ */
+int stat_file(const char *path, struct stat *st, int attrs)
+{
+#ifdef STATX_TYPE
+	if (__atomic_load_n(&have_statx, __ATOMIC_RELAXED)) {
+		unsigned int mask = STATX_TYPE | STATX_MODE | STATX_INO;
+		struct statx stx;
+
+		if (attrs & STAT_OWNER)
+			mask |= STATX_UID | STATX_GID;
+		if (attrs & STAT_CTIME)
+			mask |= STATX_CTIME;
+		if (attrs & STAT_NLINK)
+			mask |= STATX_NLINK;
+		memset(st, 0, sizeof(*st));
+		if (statx(AT_FDCWD, path, 0, mask, &stx) == 0) {
+			if ((stx.stx_mask & mask) == mask) {
+				statx_to_stat(&stx, st);
+				return 0;
+			}
+		} else if (errno == ENOSYS)
+			__atomic_store_n(&have_statx, 0, __ATOMIC_RELAXED);
+		else
+			return -1;
+	}
+#endif
+	return stat(path, st);
+}
+
+#ifdef SYS_getdents64
+
+/* Layout of the records returned by getdents64 */
+struct linux_dirent64 {
+	ino64_t d_ino;
+	off64_t d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[];
+};
+
+/**
+ * dir_scan_open  -  start reading a directory
+ *
+ * Fails with %ENOTDIR if @path is not a directory.
+ */
+int dir_scan_open(struct dir_scan *scan, const char *path)
+{
+	scan->fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (scan->fd < 0)
+		return -1;
+	scan->size = SCAN_BUFFER_SIZE;
+	scan->buffer = malloc(scan->size);
+	if (!scan->buffer) {
+		close(scan->fd);
+		return -1;
+	}
+	scan->pos = scan->len = 0;
+	return 0;
+}
+
+/**
+ * dir_scan_next  -  get the next directory entry
+ *
+ * Skips "." and "..".  The entry remains valid until the next call.
+ * Returns 1 for an entry, 0 at the end of the directory, and -1 on error.
+ */
+int dir_scan_next(struct dir_scan *scan, struct dir_entry *entry)
+{
+	for (;;) {
+		struct linux_dirent64 *d;
+
+		if (scan->pos == scan->len) {
+			long len;
+
+			len = syscall(SYS_getdents64, scan->fd, scan->buffer,
+				      scan->size);
+			if (len <= 0)
+				return len;
+			scan->pos = 0;
+			scan->len = len;
+		}
+		d = (struct linux_dirent64 *)(scan->buffer + scan->pos);
+		scan->pos += d->d_reclen;
+		if (d->d_name[0] == '.' &&
+		    (d->d_name[1] == 0 ||
+		     (d->d_name[1] == '.' && d->d_name[2] == 0)))
+			continue;
+		entry->name = d->d_name;
+		entry->type = d->d_type;
+		return 1;
+	}
+}
+
+void dir_scan_close(struct dir_scan *scan)
+{
+	free(scan->buffer);
+	close(scan->fd);
+}
+
+#else  /* SYS_getdents64 */
+
+int dir_scan_open(struct dir_scan *scan, const char *path)
+{
+	scan->dir = opendir(path);
+	if (!scan->dir)
+		return -1;
+	scan->fd = dirfd(scan->dir);
+	return 0;
+}
+
+int dir_scan_next(struct dir_scan *scan, struct dir_entry *entry)
+{
+	struct dirent *dirent;
+
+	for (;;) {
+		errno = 0;
+		dirent = readdir(scan->dir);
+		if (!dirent)
+			return errno ? -1 : 0;
+		if (!strcmp(dirent->d_name, ".") ||
+		    !strcmp(dirent->d_name, ".."))
+			continue;
+		entry->name = dirent->d_name;
+		entry->type = dirent->d_type;
+		return 1;
+	}
+}
+
+void dir_scan_close(struct dir_scan *scan)
+{
+	closedir(scan->dir);
+}
+
+#endif  /* SYS_getdents64 */
+
+/**
+ * dir_scan_type  -  determine the type of an entry of unknown type
+ *
+ * Some file systems do not report file types in directory entries
+ * (%DT_UNKNOWN).  Look the type up without following symlinks, and without
+ * forcing a network file system to synchronize attributes.
+ */
+int dir_scan_type(struct dir_scan *scan, struct dir_entry *entry)
+{
+	struct stat st;
+
+	if (entry->type != DT_UNKNOWN)
+		return 0;
+#ifdef STATX_TYPE
+	if (__atomic_load_n(&have_statx, __ATOMIC_RELAXED)) {
+		struct statx stx;
+
+		if (statx(scan->fd, entry->name,
+			  AT_SYMLINK_NOFOLLOW | AT_STATX_DONT_SYNC,
+			  STATX_TYPE, &stx) == 0) {
+			if (stx.stx_mask & STATX_TYPE) {
+				entry->type = IFTODT(stx.stx_mode);
+				return 0;
+			}
+		} else if (errno == ENOSYS)
+			__atomic_store_n(&have_statx, 0, __ATOMIC_RELAXED);
+		else
+			return -1;
+	}
+#endif
+	if (fstatat(scan->fd, entry->name, &st, AT_SYMLINK_NOFOLLOW))
+		return -1;
+	entry->type = IFTODT(st.st_mode);
+	return 0;
+}
@@ -0,0 +1,58 @@
+/*
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; either version 2, or (at your option) any
+  later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along
+  with this library; if not, write to the Free Software Foundation, Inc.,
+  59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+#ifndef __SCAN_H
+#define __SCAN_H
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <dirent.h>
+
+/*
+ * Directory scanning: read directory entries in large batches, and look
+ * up file types and attributes with the fewest and cheapest system calls
+ * available.
+ */
+
+struct dir_scan {
+	int fd;
+	char *buffer;
+	size_t size, pos, len;
+#ifndef SYS_getdents64
+	DIR *dir;
+#endif
+};
+
+struct dir_entry {
+	const char *name;
+	unsigned char type;		/* DT_* */
+};
+
+extern int dir_scan_open(struct dir_scan *, const char *);
+extern int dir_scan_next(struct dir_scan *, struct dir_entry *);
+extern int dir_scan_type(struct dir_scan *, struct dir_entry *);
+extern void dir_scan_close(struct dir_scan *);
+
+/* stat_file() attributes */
+#define STAT_MODE	1	/* st_mode */
+#define STAT_OWNER	2	/* st_uid and st_gid */
+#define STAT_CTIME	4	/* st_ctim */
+#define STAT_NLINK	8	/* st_nlink */
+
+extern int stat_file(const char *, struct stat *, int);
+
+#endif  /* __SCAN_H */
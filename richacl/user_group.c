@@ -23,37 +23,87 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <errno.h>
 #include "user_group.h"
 
 
-const char *
-user_name(uid_t uid, int numeric)
+/*
+ * Both functions store the name or number in @buf and return it, so that
+ * they can be used from several threads.  They return "?" if @buf is too
+ * small.
+ */
+
+/*
+ * Look up the name of a user or group in @buf.  The scratch space for
+ * the lookup is grown until the entry fits.  Returns 0 if there is no
+ * such user or group, and -1 if the name does not fit into @buf.
+ */
+static int
+lookup_name(id_t id, int is_group, char *buf, size_t size)
 {
-	struct passwd *passwd = numeric ? NULL : getpwuid(uid);
-	static char uid_str[22];
-	int ret;
-
-	if (passwd != NULL)
-		return passwd->pw_name;
-	ret = snprintf(uid_str, sizeof(uid_str), "%ld", (long)uid);
-	if (ret < 1 || (size_t)ret >= sizeof(uid_str))
-		return "?";
-	return uid_str;
+	char space[1024], *scratch = space, *new_scratch;
+	size_t scratch_size = sizeof(space);
+	const char *name = NULL;
+	int err, ret;
+
+	for (;;) {
+		if (is_group) {
+			struct group group, *result;
+
+			err = getgrgid_r(id, &group, scratch, scratch_size,
+					 &result);
+			if (!err && result)
+				name = result->gr_name;
+		} else {
+			struct passwd passwd, *result;
+
+			err = getpwuid_r(id, &passwd, scratch, scratch_size,
+					 &result);
+			if (!err && result)
+				name = result->pw_name;
+		}
+		if (err != ERANGE)
+			break;
+		scratch_size *= 2;
+		new_scratch = realloc(scratch == space ? NULL : scratch,
+				      scratch_size);
+		if (!new_scratch)
+			break;
+		scratch = new_scratch;
+	}
+	ret = 0;
+	if (name) {
+		ret = snprintf(buf, size, "%s", name);
+		if ((size_t)ret >= size)
+			ret = -1;
+	}
+	if (scratch != space)
+		free(scratch);
+	return ret;
 }
 
+static const char *
+id_name(id_t id, int is_group, int numeric, char *buf, size_t size)
+{
+	int ret = 0;
+
+	if (!numeric)
+		ret = lookup_name(id, is_group, buf, size);
+	if (ret == 0)
+		ret = snprintf(buf, size, "%ld", (long)id);
+	if (ret < 1 || (size_t)ret >= size)
+		return "?";
+	return buf;
+}
 
 const char *
-group_name(gid_t gid, int numeric)
+user_name(uid_t uid, int numeric, char *buf, size_t size)
 {
-	struct group *group = numeric ? NULL : getgrgid(gid);
-	static char gid_str[22];
-	int ret;
-
-	if (group != NULL)
-		return group->gr_name;
-	ret = snprintf(gid_str, sizeof(gid_str), "%ld", (long)gid);
-	if (ret < 1 || (size_t)ret >= sizeof(gid_str))
-		return "?";
-	return gid_str;
+	return id_name(uid, 0, numeric, buf, size);
 }
 
+const char *
+group_name(gid_t gid, int numeric, char *buf, size_t size)
+{
+	return id_name(gid, 1, numeric, buf, size);
+}
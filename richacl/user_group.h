@@ -25,7 +25,7 @@
 #include <grp.h>
 
 const char *
-user_name(uid_t uid, int numeric);
+user_name(uid_t uid, int numeric, char *buf, size_t size);
 const char *
-group_name(gid_t uid, int numeric);
+group_name(gid_t uid, int numeric, char *buf, size_t size);
 
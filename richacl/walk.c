@@ -0,0 +1,256 @@
+/*
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; either version 2, or (at your option) any
+  later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along
+  with this library; if not, write to the Free Software Foundation, Inc.,
+  59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "walk.h"
+#include "scan.h"
+
+/*
+ * The directories still to be scanned, shared by all threads.  The walk
+ * is over when the stack is empty and no thread is scanning a directory,
+ * which could add more.
+ */
+struct walk_queue {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	char **dirs;
+	size_t n_dirs, size;
+	unsigned int busy;
+	struct tree_walk *walk;
+	int status;
+};
+
+/* Called with queue->lock held.  Takes over @dir. */
+static int push_dir(struct walk_queue *queue, char *dir)
+{
+	if (queue->n_dirs == queue->size) {
+		size_t size = queue->size ? queue->size * 2 : 64;
+		char **dirs;
+
+		dirs = realloc(queue->dirs, sizeof(*dirs) * size);
+		if (!dirs) {
+			free(dir);
+			return -1;
+		}
+		queue->dirs = dirs;
+		queue->size = size;
+	}
+	queue->dirs[queue->n_dirs++] = dir;
+	pthread_cond_signal(&queue->cond);
+	return 0;
+}
+
+static int visit(struct walk_queue *queue, void *state, const char *path,
+		 struct stat *st)
+{
+	struct tree_walk *walk = queue->walk;
+
+	if (stat_file(path, st, walk->attrs) ||
+	    walk->visit(walk, state, path, st)) {
+		if (errno)
+			perror(path);
+		return -1;
+	}
+	return 0;
+}
+
+/* Visit the files in @dirname, and queue its subdirectories. */
+static int walk_dir(struct walk_queue *queue, void *state,
+		    const char *dirname)
+{
+	size_t dirname_len = strlen(dirname);
+	struct dir_scan scan;
+	struct dir_entry dirent;
+	struct stat st;
+	int status = 0, ret;
+
+	if (dir_scan_open(&scan, dirname)) {
+		perror(dirname);
+		return -1;
+	}
+	while ((ret = dir_scan_next(&scan, &dirent)) > 0) {
+		char *path;
+
+		path = malloc(dirname_len + strlen(dirent.name) + 2);
+		if (!path) {
+			perror(basename(progname));
+			status = -1;
+			break;
+		}
+		sprintf(path, "%s/%s", dirname, dirent.name);
+		if (dir_scan_type(&scan, &dirent)) {
+			perror(path);
+			free(path);
+			status = -1;
+			continue;
+		}
+		if (dirent.type == DT_LNK) {
+			free(path);
+			continue;
+		}
+		if (visit(queue, state, path, &st)) {
+			free(path);
+			status = -1;
+			continue;
+		}
+		if (dirent.type == DT_DIR) {
+			pthread_mutex_lock(&queue->lock);
+			ret = push_dir(queue, path);
+			pthread_mutex_unlock(&queue->lock);
+			if (ret) {
+				perror(basename(progname));
+				status = -1;
+				break;
+			}
+		} else
+			free(path);
+	}
+	if (ret < 0) {
+		perror(dirname);
+		status = -1;
+	}
+	dir_scan_close(&scan);
+	return status;
+}
+
+/* Take directories off the stack until the walk is over. */
+static void walk_dirs(struct walk_queue *queue, void *state)
+{
+	int status = 0;
+
+	pthread_mutex_lock(&queue->lock);
+	for (;;) {
+		char *dir;
+
+		while (!queue->n_dirs && queue->busy)
+			pthread_cond_wait(&queue->cond, &queue->lock);
+		if (!queue->n_dirs)
+			break;
+		dir = queue->dirs[--queue->n_dirs];
+		queue->busy++;
+		pthread_mutex_unlock(&queue->lock);
+
+		if (walk_dir(queue, state, dir))
+			status = 1;
+		free(dir);
+
+		pthread_mutex_lock(&queue->lock);
+		queue->busy--;
+	}
+	/* Wake up the threads waiting for more directories. */
+	pthread_cond_broadcast(&queue->cond);
+	queue->status |= status;
+	queue->walk->finish(queue->walk, state);
+	pthread_mutex_unlock(&queue->lock);
+}
+
+static void *walk_thread(void *arg)
+{
+	struct walk_queue *queue = arg;
+	void *state;
+
+	state = queue->walk->start(queue->walk);
+	if (state)
+		walk_dirs(queue, state);
+	else {
+		perror(basename(progname));
+		pthread_mutex_lock(&queue->lock);
+		queue->status = 1;
+		pthread_mutex_unlock(&queue->lock);
+	}
+	collect_worker_stats();
+	return NULL;
+}
+
+/**
+ * walk_tree  -  visit files and everything below directories
+ * @paths:	the starting points
+ *
+ * The starting points are visited in order, by the calling thread.  The
+ * files below them are visited by @walk->jobs threads.
+ */
+int walk_tree(struct tree_walk *walk, char **paths, int n_paths)
+{
+	struct walk_queue queue;
+	pthread_t *threads = NULL;
+	unsigned int started = 0, n;
+	struct stat st;
+	void *state;
+	int i;
+
+	memset(&queue, 0, sizeof(queue));
+	pthread_mutex_init(&queue.lock, NULL);
+	pthread_cond_init(&queue.cond, NULL);
+	queue.walk = walk;
+
+	state = walk->start(walk);
+	if (!state)
+		goto fail;
+	for (i = 0; i < n_paths; i++) {
+		char *dir;
+
+		if (visit(&queue, state, paths[i], &st)) {
+			queue.status = 1;
+			continue;
+		}
+		if (!S_ISDIR(st.st_mode))
+			continue;
+		dir = strdup(paths[i]);
+		if (!dir || push_dir(&queue, dir))
+			goto fail;
+	}
+
+	if (walk->jobs > 1) {
+		threads = malloc(sizeof(*threads) * walk->jobs);
+		if (threads) {
+			for (started = 0; started < walk->jobs; started++)
+				if (pthread_create(threads + started, NULL,
+						   walk_thread, &queue))
+					break;
+		}
+	}
+	if (started) {
+		pthread_mutex_lock(&queue.lock);
+		walk->finish(walk, state);
+		pthread_mutex_unlock(&queue.lock);
+		for (n = 0; n < started; n++)
+			pthread_join(threads[n], NULL);
+	} else {
+		/* Without any threads, walk the tree here. */
+		walk_dirs(&queue, state);
+	}
+
+out:
+	while (queue.n_dirs)
+		free(queue.dirs[--queue.n_dirs]);
+	free(queue.dirs);
+	free(threads);
+	pthread_cond_destroy(&queue.cond);
+	pthread_mutex_destroy(&queue.lock);
+	return queue.status;
+
+fail:
+	perror(basename(progname));
+	if (state)
+		walk->finish(walk, state);
+	queue.status = 1;
+	goto out;
+}
@@ -0,0 +1,55 @@
+/*
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; either version 2, or (at your option) any
+  later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along
+  with this library; if not, write to the Free Software Foundation, Inc.,
+  59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+#ifndef __WALK_H
+#define __WALK_H
+
+struct stat;
+
+extern const char *progname;
+
+/*
+ * Parallel tree walk: visit files, and everything below directories, with
+ * several threads and in no particular order.  Symbolic links below the
+ * starting points are skipped.
+ */
+struct tree_walk {
+	unsigned int jobs;		/* number of threads */
+	int attrs;			/* for stat_file() */
+
+	/* Allocate the state of a thread; returns NULL on error. */
+	void *(*start)(struct tree_walk *);
+
+	/*
+	 * Visit a file.  Returns 0, or -1 with errno set, or with errno
+	 * zero when the error has already been reported.
+	 */
+	int (*visit)(struct tree_walk *, void *state, const char *path,
+		     const struct stat *);
+
+	/*
+	 * Collect the results of a thread and free @state.  Called with
+	 * the walk locked, so this is never called by two threads at once.
+	 */
+	void (*finish)(struct tree_walk *, void *state);
+};
+
+extern int walk_tree(struct tree_walk *, char **paths, int n_paths);
+
+/* Add the performance counters of a thread which is done; in richacl.c. */
+extern void collect_worker_stats(void);
+
+#endif  /* __WALK_H */
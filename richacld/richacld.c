@@ -0,0 +1,1141 @@
+/*
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; either version 2, or (at your option) any
+  later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along
+  with this library; if not, write to the Free Software Foundation, Inc.,
+  59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+/*
+ * richacld serves richacl_client_get_file(), richacl_client_access(), and
+ * richacl_client_inherit() requests for local clients (see richacld.h),
+ * so that all of them share one set of caches:
+ *
+ *   - decoded acls by device and inode number,
+ *   - the last few access decisions for each of those files, and
+ *   - the groups each user is in.
+ *
+ * Each request opens the file with O_PATH and stats it, and cached acls
+ * and decisions are only used while the file's ctime is unchanged.  Acls
+ * are read through the same file descriptor (as /proc/self/fd/N), so that
+ * they are cached for the file they were read from.  Files whose ctime is
+ * less than RACY_SECONDS old are not cached: the ctime might not change on
+ * a further change within the same timestamp granularity.  Group
+ * memberships are cached for IDENTITY_SECONDS.
+ *
+ * When running as root, the daemon resolves the paths of each client with
+ * the file system uid, gid, and groups of the client, so clients can only
+ * ask about files they can reach themselves.  Otherwise, it only serves
+ * clients running as root or as its own user.  Only regular files and
+ * directories are served.  Only clients running as root can check the
+ * permissions of other users.
+ *
+ * Client sockets are non-blocking.  Replies are queued, and sent when the
+ * client is ready to receive them; a client which does not read its
+ * replies only stalls its own requests.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <getopt.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <pwd.h>
+#include <grp.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/fsuid.h>
+#include <sys/un.h>
+
+#include "richacl.h"
+#include "richacld.h"
+
+#define RACY_SECONDS 1
+#define IDENTITY_SECONDS 60
+#define MAX_IDENTITIES 4096
+
+/* Access decisions remembered per file */
+#define DECISIONS 4
+
+/* Stop handling the requests of a client with more replies pending. */
+#define MAX_PENDING_OUTPUT (1 << 20)
+
+const char *progname;
+
+struct decision {
+	uid_t uid;
+	uint64_t cred_hash;	/* of uid and groups */
+	unsigned int mask;
+};
+
+struct file_entry {
+	struct file_entry *hash_next;
+	struct file_entry *lru_prev, *lru_next;
+	dev_t dev;
+	ino_t ino;
+	struct timespec ctime;
+	struct richacl *acl;
+	unsigned int n_decisions, next_decision;
+	struct decision decisions[DECISIONS];
+};
+
+struct identity {
+	struct identity *next;
+	uid_t uid;
+	time_t expires;
+	int n_groups;
+	gid_t *groups;
+};
+
+struct client {
+	int fd;
+	uid_t uid;			/* of the peer */
+	gid_t gid;
+	gid_t *groups;
+	int n_groups;
+	unsigned char *buffer;		/* requests received */
+	size_t len, size;
+	int eof;			/* no more requests will come */
+	unsigned char *output;		/* replies not sent yet */
+	size_t output_len, output_size;
+};
+
+static struct {
+	unsigned long long requests;
+	unsigned long long acl_hits, acl_misses;
+	unsigned long long decision_hits, decision_misses;
+	unsigned long long identity_hits, identity_misses;
+} stats;
+
+static struct file_entry **file_table;
+static size_t file_table_size, file_count, max_files = 16384;
+static struct file_entry lru = { .lru_prev = &lru, .lru_next = &lru };
+
+static struct identity *identities[256];
+static unsigned int identity_count;
+
+static volatile sig_atomic_t terminate;
+
+/* Switch to the credentials of each client (when running as root). */
+static int switch_credentials;
+static gid_t *daemon_groups;
+static int daemon_n_groups;
+
+static unsigned long hash_file(dev_t dev, ino_t ino)
+{
+	unsigned long long x = ino ^ ((unsigned long long)dev << 32);
+
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdULL;
+	x ^= x >> 33;
+	return x;
+}
+
+static void lru_unlink(struct file_entry *entry)
+{
+	entry->lru_prev->lru_next = entry->lru_next;
+	entry->lru_next->lru_prev = entry->lru_prev;
+}
+
+static void lru_add(struct file_entry *entry)
+{
+	entry->lru_next = lru.lru_next;
+	entry->lru_prev = &lru;
+	lru.lru_next->lru_prev = entry;
+	lru.lru_next = entry;
+}
+
+static struct file_entry **file_lookup(dev_t dev, ino_t ino)
+{
+	struct file_entry **pos;
+
+	pos = &file_table[hash_file(dev, ino) & (file_table_size - 1)];
+	while (*pos) {
+		if ((*pos)->dev == dev && (*pos)->ino == ino)
+			break;
+		pos = &(*pos)->hash_next;
+	}
+	return pos;
+}
+
+static void file_remove(struct file_entry **pos)
+{
+	struct file_entry *entry = *pos;
+
+	*pos = entry->hash_next;
+	lru_unlink(entry);
+	richacl_free(entry->acl);
+	free(entry);
+	file_count--;
+}
+
+static int is_racy(const struct stat *st)
+{
+	return time(NULL) - st->st_ctim.tv_sec < RACY_SECONDS;
+}
+
+/*
+ * Look up the acl of the O_PATH file descriptor @fd in the cache, or load
+ * it.  @st is the status of @fd.  Files without an acl get the acl
+ * equivalent to their file mode.  Returns a cache entry which is only
+ * valid until the next call; it is not in the cache when its file is racy.
+ */
+static struct file_entry *get_file(int fd, const struct stat *st)
+{
+	static struct file_entry uncached;
+	struct file_entry **pos, *entry;
+	char proc_path[32];
+	struct richacl *acl;
+
+	pos = file_lookup(st->st_dev, st->st_ino);
+	entry = *pos;
+	if (entry) {
+		if (entry->ctime.tv_sec == st->st_ctim.tv_sec &&
+		    entry->ctime.tv_nsec == st->st_ctim.tv_nsec) {
+			stats.acl_hits++;
+			lru_unlink(entry);
+			lru_add(entry);
+			return entry;
+		}
+		file_remove(pos);
+	}
+	stats.acl_misses++;
+
+	/* The xattr calls do not accept O_PATH file descriptors. */
+	snprintf(proc_path, sizeof(proc_path), "/proc/self/fd/%d", fd);
+	acl = richacl_get_file(proc_path);
+	if (!acl) {
+		if (errno != ENODATA && errno != ENOTSUP && errno != ENOSYS)
+			return NULL;
+		acl = richacl_from_mode(st->st_mode);
+		if (!acl)
+			return NULL;
+	}
+
+	if (is_racy(st) || !(entry = malloc(sizeof(*entry)))) {
+		richacl_free(uncached.acl);
+		entry = &uncached;
+		memset(entry, 0, sizeof(*entry));
+		entry->acl = acl;
+		return entry;
+	}
+	memset(entry, 0, sizeof(*entry));
+	entry->dev = st->st_dev;
+	entry->ino = st->st_ino;
+	entry->ctime = st->st_ctim;
+	entry->acl = acl;
+	pos = file_lookup(st->st_dev, st->st_ino);
+	entry->hash_next = *pos;
+	*pos = entry;
+	lru_add(entry);
+	if (++file_count > max_files) {
+		struct file_entry *oldest = lru.lru_prev;
+
+		file_remove(file_lookup(oldest->dev, oldest->ino));
+	}
+	return entry;
+}
+
+/* The groups @uid is in, from the identity cache. */
+static struct identity *get_identity(uid_t uid)
+{
+	struct identity **pos, *identity;
+	struct passwd *passwd;
+	time_t now = time(NULL);
+	int n_groups = 32;
+
+	pos = &identities[uid % 256];
+	for (; *pos; pos = &(*pos)->next) {
+		identity = *pos;
+		if (identity->uid != uid)
+			continue;
+		if (identity->expires > now) {
+			stats.identity_hits++;
+			return identity;
+		}
+		*pos = identity->next;
+		free(identity->groups);
+		free(identity);
+		identity_count--;
+		break;
+	}
+	stats.identity_misses++;
+
+	if (identity_count >= MAX_IDENTITIES) {
+		unsigned int n;
+
+		for (n = 0; n < 256; n++) {
+			while (identities[n]) {
+				identity = identities[n];
+				identities[n] = identity->next;
+				free(identity->groups);
+				free(identity);
+			}
+		}
+		identity_count = 0;
+	}
+
+	identity = malloc(sizeof(*identity));
+	if (!identity)
+		return NULL;
+	identity->uid = uid;
+	identity->expires = now + IDENTITY_SECONDS;
+	identity->groups = NULL;
+	identity->n_groups = 0;
+	passwd = getpwuid(uid);
+	if (passwd) {
+		for (;;) {
+			gid_t *groups;
+
+			groups = realloc(identity->groups,
+					 n_groups * sizeof(gid_t));
+			if (!groups) {
+				free(identity->groups);
+				free(identity);
+				return NULL;
+			}
+			identity->groups = groups;
+			if (getgrouplist(passwd->pw_name, passwd->pw_gid,
+					 groups, &n_groups) >= 0)
+				break;
+		}
+		identity->n_groups = n_groups;
+	}
+	identity->next = identities[uid % 256];
+	identities[uid % 256] = identity;
+	identity_count++;
+	return identity;
+}
+
+static uint64_t hash_credentials(uid_t uid, const gid_t *groups, int n_groups)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	int n;
+
+	hash = (hash ^ uid) * 0x100000001b3ULL;
+	hash = (hash ^ n_groups) * 0x100000001b3ULL;
+	for (n = 0; n < n_groups; n++)
+		hash = (hash ^ groups[n]) * 0x100000001b3ULL;
+	return hash;
+}
+
+static int check_access(struct file_entry *entry, const struct stat *st,
+			uid_t uid, const gid_t *groups, int n_groups)
+{
+	uint64_t cred_hash = hash_credentials(uid, groups, n_groups);
+	struct decision *decision;
+	unsigned int n;
+	int mask;
+
+	for (n = 0; n < entry->n_decisions; n++) {
+		decision = entry->decisions + n;
+		if (decision->uid == uid && decision->cred_hash == cred_hash) {
+			stats.decision_hits++;
+			return decision->mask;
+		}
+	}
+	stats.decision_misses++;
+	mask = richacl_permission(entry->acl, st, uid, groups, n_groups);
+	if (mask < 0)
+		return -1;
+	decision = entry->decisions + entry->next_decision;
+	decision->uid = uid;
+	decision->cred_hash = cred_hash;
+	decision->mask = mask;
+	entry->next_decision = (entry->next_decision + 1) % DECISIONS;
+	if (entry->n_decisions < DECISIONS)
+		entry->n_decisions++;
+	return mask;
+}
+
+/* The supplementary groups of the peer of @client. */
+static int get_peer_groups(struct client *client)
+{
+	struct identity *identity;
+
+#ifdef SO_PEERGROUPS
+	socklen_t len = 32 * sizeof(gid_t);
+
+	for (;;) {
+		gid_t *groups = realloc(client->groups, len);
+
+		if (!groups)
+			return -1;
+		client->groups = groups;
+		if (getsockopt(client->fd, SOL_SOCKET, SO_PEERGROUPS,
+			       groups, &len) == 0) {
+			client->n_groups = len / sizeof(gid_t);
+			return 0;
+		}
+		if (errno != ERANGE)
+			break;
+	}
+	if (errno != ENOPROTOOPT)
+		return -1;
+#endif
+	/* Older kernels: the groups the peer's user is in. */
+	identity = get_identity(client->uid);
+	if (!identity)
+		return -1;
+	free(client->groups);
+	client->groups = malloc(identity->n_groups * sizeof(gid_t) + 1);
+	if (!client->groups)
+		return -1;
+	memcpy(client->groups, identity->groups,
+	       identity->n_groups * sizeof(gid_t));
+	client->n_groups = identity->n_groups;
+	return 0;
+}
+
+static void restore_credentials(void)
+{
+	if (!switch_credentials)
+		return;
+	setfsuid(geteuid());
+	setfsgid(getegid());
+	setgroups(daemon_n_groups, daemon_groups);
+}
+
+/* Resolve paths with the credentials of @client from now on. */
+static int become_client(const struct client *client)
+{
+	if (!switch_credentials)
+		return 0;
+	if (setgroups(client->n_groups, client->groups))
+		return -1;
+	setfsgid(client->gid);
+	setfsuid(client->uid);
+	/* setfsuid() and setfsgid() return the previous ids, not errors. */
+	if ((uid_t)setfsuid(-1) != client->uid ||
+	    (gid_t)setfsgid(-1) != client->gid) {
+		restore_credentials();
+		errno = EPERM;
+		return -1;
+	}
+	return 0;
+}
+
+/* Queue a reply; it is sent by client_output(). */
+static int send_reply(struct client *client, int error, unsigned int mask,
+		      const struct richacl *acl)
+{
+	struct richacld_reply *reply;
+	size_t size = sizeof(*reply);
+
+	if (acl && !error)
+		size += richacl_xattr_size(acl);
+	if (client->output_size - client->output_len < size) {
+		size_t output_size = client->output_size ?
+				     client->output_size : 8192;
+		unsigned char *output;
+
+		while (output_size - client->output_len < size)
+			output_size *= 2;
+		output = realloc(client->output, output_size);
+		if (!output)
+			return -1;
+		client->output = output;
+		client->output_size = output_size;
+	}
+	reply = (struct richacld_reply *)(client->output + client->output_len);
+	memset(reply, 0, sizeof(*reply));
+	reply->r_size = size;
+	reply->r_error = error;
+	reply->r_mask = mask;
+	if (size > sizeof(*reply))
+		richacl_to_xattr(acl, reply + 1);
+	client->output_len += size;
+	return 0;
+}
+
+/*
+ * Handle one complete request.  Returns -1 when the client should be
+ * disconnected.
+ */
+static int handle_request(struct client *client,
+			  struct richacld_request *request)
+{
+	gid_t *groups = NULL;
+	int n_groups = request->r_ngroups, n;
+	struct richacl *inherited = NULL;
+	struct file_entry *entry;
+	const char *path;
+	size_t path_offset;
+	struct stat st;
+	int mask = 0, ret, fd, saved_errno;
+
+	stats.requests++;
+	if (n_groups < -1 ||
+	    (size_t)(n_groups > 0 ? n_groups : 0) >
+	    (request->r_size - sizeof(*request)) / sizeof(uint32_t))
+		return -1;
+	path_offset = sizeof(*request) +
+		      (n_groups > 0 ? n_groups : 0) * sizeof(uint32_t);
+	path = (const char *)request + path_offset;
+	if (path_offset >= request->r_size ||
+	    memchr(path, 0, request->r_size - path_offset) == NULL)
+		return -1;
+
+	if (path[0] != '/') {
+		errno = EINVAL;
+		goto fail;
+	}
+	if (request->r_op == RICHACLD_ACCESS &&
+	    client->uid != 0 && request->r_uid != client->uid) {
+		errno = EPERM;
+		goto fail;
+	}
+	/* O_PATH does not open devices, and needs no read permission. */
+	if (become_client(client))
+		goto fail;
+	fd = open(path, O_PATH | O_CLOEXEC);
+	saved_errno = errno;
+	restore_credentials();
+	errno = saved_errno;
+	if (fd < 0)
+		goto fail;
+	entry = NULL;
+	if (fstat(fd, &st) == 0) {
+		if (S_ISREG(st.st_mode) || S_ISDIR(st.st_mode))
+			entry = get_file(fd, &st);
+		else
+			errno = EINVAL;
+	}
+	saved_errno = errno;
+	close(fd);
+	errno = saved_errno;
+	if (!entry)
+		goto fail;
+
+	switch (request->r_op) {
+	case RICHACLD_GET:
+		return send_reply(client, 0, 0, entry->acl);
+
+	case RICHACLD_ACCESS:
+		if (n_groups < 0) {
+			struct identity *identity;
+
+			identity = get_identity(request->r_uid);
+			if (!identity)
+				goto fail;
+			mask = check_access(entry, &st, request->r_uid,
+					    identity->groups,
+					    identity->n_groups);
+		} else {
+			groups = malloc((n_groups + 1) * sizeof(gid_t));
+			if (!groups)
+				goto fail;
+			for (n = 0; n < n_groups; n++)
+				groups[n] = ((uint32_t *)(request + 1))[n];
+			mask = check_access(entry, &st, request->r_uid,
+					    groups, n_groups);
+			free(groups);
+		}
+		if (mask < 0)
+			goto fail;
+		return send_reply(client, 0, mask, NULL);
+
+	case RICHACLD_INHERIT:
+		if (!S_ISDIR(st.st_mode)) {
+			errno = ENOTDIR;
+			goto fail;
+		}
+		errno = 0;
+		inherited = richacl_inherit(entry->acl,
+				!!(request->r_flags & RICHACLD_ISDIR));
+		if (!inherited && errno)
+			goto fail;
+		ret = send_reply(client, 0, 0, inherited);
+		richacl_free(inherited);
+		return ret;
+
+	default:
+		errno = EINVAL;
+		break;
+	}
+
+fail:
+	return send_reply(client, errno ? errno : EIO, 0, NULL);
+}
+
+static int request_complete(const struct client *client)
+{
+	const struct richacld_request *request =
+		(const struct richacld_request *)client->buffer;
+
+	return client->len >= sizeof(*request) &&
+	       client->len >= request->r_size;
+}
+
+/*
+ * Handle the complete requests of a client until too many replies are
+ * pending.  Returns -1 when the client should be disconnected.
+ */
+static int handle_requests(struct client *client)
+{
+	struct richacld_request *request;
+
+	while (client->len >= sizeof(*request) &&
+	       client->output_len < MAX_PENDING_OUTPUT) {
+		uint32_t size;
+
+		request = (struct richacld_request *)client->buffer;
+		size = request->r_size;
+		if (size <= sizeof(*request) || size > RICHACLD_MAX_REQUEST)
+			return -1;
+		if (client->len < size)
+			break;
+		if (handle_request(client, request))
+			return -1;
+		client->len -= size;
+		memmove(client->buffer, client->buffer + size, client->len);
+	}
+	return 0;
+}
+
+/*
+ * Read from a client.  Returns -1 when the client should be disconnected.
+ * The replies to the requests before the end of input are still sent.
+ */
+static int client_input(struct client *client)
+{
+	ssize_t ret;
+
+	if (client->size - client->len < 4096) {
+		size_t size = client->size ? client->size * 2 : 8192;
+		unsigned char *buffer;
+
+		if (size > 2 * RICHACLD_MAX_REQUEST)
+			return -1;
+		buffer = realloc(client->buffer, size);
+		if (!buffer)
+			return -1;
+		client->buffer = buffer;
+		client->size = size;
+	}
+	ret = read(client->fd, client->buffer + client->len,
+		   client->size - client->len);
+	if (ret < 0)
+		return (errno == EINTR || errno == EAGAIN) ? 0 : -1;
+	if (ret == 0)
+		client->eof = 1;
+	client->len += ret;
+	return 0;
+}
+
+/*
+ * Send as many of the pending replies as the client can take without
+ * blocking.  Returns -1 when the client should be disconnected.
+ */
+static int client_output(struct client *client)
+{
+	size_t sent = 0;
+
+	while (sent < client->output_len) {
+		ssize_t ret = send(client->fd, client->output + sent,
+				   client->output_len - sent, MSG_NOSIGNAL);
+
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN)
+				break;
+			return -1;
+		}
+		sent += ret;
+	}
+	client->output_len -= sent;
+	memmove(client->output, client->output + sent, client->output_len);
+	return 0;
+}
+
+/*
+ * Handle the poll events of a client.  Returns -1 when the client should
+ * be disconnected.
+ */
+static int client_event(struct client *client, short revents)
+{
+	if ((revents & POLLERR) ||
+	    ((revents & (POLLIN | POLLHUP)) && !client->eof &&
+	     client_input(client)))
+		return -1;
+	for (;;) {
+		if (handle_requests(client) || client_output(client))
+			return -1;
+		/* Go on with requests held back while replies were pending. */
+		if (client->output_len || !request_complete(client))
+			break;
+	}
+	return (client->eof && !client->output_len) ? -1 : 0;
+}
+
+static void free_client(struct client *client)
+{
+	close(client->fd);
+	free(client->groups);
+	free(client->buffer);
+	free(client->output);
+}
+
+static int open_socket(const char *path, mode_t mode)
+{
+	struct sockaddr_un addr;
+	int fd, retried = 0;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -1;
+	while (bind(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+		int probe;
+
+		if (errno != EADDRINUSE || retried)
+			goto fail;
+		/* Remove the socket of a daemon which is no longer running. */
+		probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if (probe < 0)
+			goto fail;
+		if (connect(probe, (struct sockaddr *)&addr,
+			    sizeof(addr)) == 0 || errno != ECONNREFUSED) {
+			close(probe);
+			errno = EADDRINUSE;
+			goto fail;
+		}
+		close(probe);
+		unlink(path);
+		retried = 1;
+	}
+	if (chmod(path, mode) || listen(fd, SOMAXCONN))
+		goto fail;
+	return fd;
+
+fail:
+	close(fd);
+	return -1;
+}
+
+static void serve(int listen_fd)
+{
+	struct client *clients = NULL;
+	struct pollfd *pfds = NULL;
+	unsigned int n_clients = 0, n;
+
+	while (!terminate) {
+		struct pollfd *p;
+
+		p = realloc(pfds, (n_clients + 1) * sizeof(*pfds));
+		if (!p)
+			break;
+		pfds = p;
+		pfds[0].fd = listen_fd;
+		pfds[0].events = POLLIN;
+		for (n = 0; n < n_clients; n++) {
+			struct client *client = clients + n;
+
+			pfds[n + 1].fd = client->fd;
+			pfds[n + 1].events = 0;
+			if (client->output_len < MAX_PENDING_OUTPUT &&
+			    !client->eof)
+				pfds[n + 1].events |= POLLIN;
+			if (client->output_len)
+				pfds[n + 1].events |= POLLOUT;
+		}
+		if (poll(pfds, n_clients + 1, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			perror(basename(progname));
+			break;
+		}
+
+		for (n = n_clients; n > 0; n--) {
+			struct client *client = clients + n - 1;
+
+			if (!pfds[n].revents)
+				continue;
+			if (client_event(client, pfds[n].revents)) {
+				free_client(client);
+				*client = clients[--n_clients];
+			}
+		}
+
+		if (pfds[0].revents & POLLIN) {
+			struct ucred cred;
+			socklen_t len = sizeof(cred);
+			struct client *c, *client;
+			int fd;
+
+			fd = accept4(listen_fd, NULL, NULL,
+				     SOCK_NONBLOCK | SOCK_CLOEXEC);
+			if (fd < 0)
+				continue;
+			if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED,
+				       &cred, &len) ||
+			    (!switch_credentials && cred.uid != 0 &&
+			     cred.uid != geteuid())) {
+				close(fd);
+				continue;
+			}
+			c = realloc(clients, (n_clients + 1) * sizeof(*c));
+			if (!c) {
+				close(fd);
+				continue;
+			}
+			clients = c;
+			client = clients + n_clients;
+			memset(client, 0, sizeof(*client));
+			client->fd = fd;
+			client->uid = cred.uid;
+			client->gid = cred.gid;
+			if (get_peer_groups(client)) {
+				free_client(client);
+				continue;
+			}
+			n_clients++;
+		}
+	}
+
+	for (n = 0; n < n_clients; n++)
+		free_client(clients + n);
+	free(clients);
+	free(pfds);
+}
+
+static void handle_signal(int sig)
+{
+	terminate = 1;
+}
+
+static void print_stats(void)
+{
+	fprintf(stderr,
+		"requests:          %llu\n"
+		"acl hits:          %llu\n"
+		"acl misses:        %llu\n"
+		"decision hits:     %llu\n"
+		"decision misses:   %llu\n"
+		"identity hits:     %llu\n"
+		"identity misses:   %llu\n",
+		stats.requests, stats.acl_hits, stats.acl_misses,
+		stats.decision_hits, stats.decision_misses,
+		stats.identity_hits, stats.identity_misses);
+}
+
+/* Parse uid[:gid:...]. */
+static int parse_who(char *who, uid_t *uid, gid_t **groups, int *n_groups)
+{
+	char *end;
+
+	*uid = strtoul(who, &end, 10);
+	if (end == who || (*end && *end != ':'))
+		return -1;
+	if (!*end)
+		return 0;
+	*groups = malloc(strlen(end) / 2 * sizeof(gid_t) + 1);
+	if (!*groups)
+		return -1;
+	*n_groups = 0;
+	while (*end) {
+		who = end + 1;
+		(*groups)[(*n_groups)++] = strtoul(who, &end, 10);
+		if (end == who || (*end && *end != ':'))
+			return -1;
+	}
+	return 0;
+}
+
+/*
+ * Send a request for each path to a running daemon, and print the
+ * results like richacl --get and richacl --access do.
+ */
+static int query(const char *socket_path, int op, int isdir, char *who,
+		 int argc, char *argv[])
+{
+	struct richacl_client *client;
+	uid_t uid = geteuid();
+	gid_t *groups = NULL;
+	int n_groups = -1, status = 0, n;
+
+	if (who && parse_who(who, &uid, &groups, &n_groups)) {
+		fprintf(stderr, "%s: invalid user or group `%s'\n",
+			basename(progname), who);
+		exit(1);
+	}
+	client = richacl_client_open(socket_path);
+	if (!client) {
+		perror(socket_path);
+		exit(1);
+	}
+	for (n = 0; n < argc; n++) {
+		int fmt = RICHACL_TEXT_SIMPLIFY | RICHACL_TEXT_ALIGN |
+			  RICHACL_TEXT_NUMERIC_IDS;
+		const char *path = argv[n];
+		struct richacl *acl = NULL;
+		struct stat st;
+		int mask = 0;
+
+		if (op == RICHACLD_INHERIT ? isdir :
+		    (stat(path, &st) == 0 && S_ISDIR(st.st_mode)))
+			fmt |= RICHACL_TEXT_DIRECTORY_CONTEXT;
+		else
+			fmt |= RICHACL_TEXT_FILE_CONTEXT;
+
+		errno = 0;
+		if (op == RICHACLD_GET)
+			acl = richacl_client_get_file(client, path);
+		else if (op == RICHACLD_INHERIT)
+			acl = richacl_client_inherit(client, path, isdir);
+		else
+			mask = richacl_client_access(client, path, uid,
+						     groups, n_groups);
+		if ((op == RICHACLD_ACCESS ? mask < 0 : !acl && errno) ||
+		    (acl && richacl_apply_masks(&acl))) {
+			perror(path);
+			status = 1;
+		} else if (acl) {
+			printf("%s:\n", path);
+			richacl_fprint_text(acl, fmt, stdout);
+			putchar('\n');
+		} else if (op == RICHACLD_ACCESS) {
+			richacl_fprint_mask_text(mask, fmt, stdout);
+			printf("  %s\n", path);
+		}
+		richacl_free(acl);
+	}
+	richacl_client_close(client);
+	free(groups);
+	return status;
+}
+
+static struct option long_options[] = {
+	{"socket",		1, 0, 's'},
+	{"mode",		1, 0, 'm'},
+	{"cache-size",		1, 0, 'c'},
+	{"backend",		1, 0,  1 },
+	{"daemon",		0, 0, 'd'},
+	{"stats",		0, 0,  2 },
+	{"get",			0, 0, 'g'},
+	{"access",		2, 0, 'a'},
+	{"inherit",		1, 0,  3 },
+	{"version",		0, 0, 'v'},
+	{"help",		0, 0, 'h'},
+	{ NULL,			0, 0,  0 }
+};
+
+static void synopsis(int help)
+{
+	FILE *file = help ? stdout : stderr;
+
+	fprintf(file, "SYNOPSIS: %s [options]\n"
+		      "          %s [--socket=path] {query} file ...\n",
+		basename(progname), basename(progname));
+	if (!help) {
+		fprintf(file, "Try `%s --help' for more information.\n",
+			basename(progname));
+		exit(1);
+	}
+	fprintf(file,
+"\n"
+"Serve ACL retrieval, access check, and inheritance requests of local\n"
+"clients with shared caches.\n"
+"\n"
+"Options:\n"
+"  --socket=path, -s path\n"
+"              Listen on, or send queries to, this UNIX domain socket\n"
+"              (%s).\n"
+"  --mode=mode, -m mode\n"
+"              Permissions of the socket (0660).  Everyone who can\n"
+"              connect can query the ACLs of the files they can reach,\n"
+"              and their own permissions.\n"
+"  --cache-size=n, -c n\n"
+"              Cache the ACLs of up to n files (16384).\n"
+"  --backend=xattr|user|emulated[:latency]\n"
+"              Where ACLs are stored; see richacl --help.\n"
+"  --daemon, -d\n"
+"              Detach from the terminal.\n"
+"  --stats     When terminated, print cache statistics to standard error.\n"
+"\n"
+"Queries, sent to a running daemon:\n"
+"  --get, -g   Display the ACL of file(s), like richacl --get.\n"
+"  --access[=uid[:gid:...]], -a[uid[:gid:...]]\n"
+"              Show which permissions the caller or the specified user has\n"
+"              for file(s).  A list of groups overrides the groups the user\n"
+"              is in.  Only root can ask for other users.\n"
+"  --inherit=file|dir\n"
+"              Display the ACL a new file or directory in directory(s)\n"
+"              would inherit.\n"
+"\n"
+"Other options:\n"
+"  --version, -v\n"
+"              Display the version of %s and exit.\n"
+"  --help, -h  This help text.\n",
+	RICHACLD_SOCKET, basename(progname));
+	exit(0);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *socket_path = RICHACLD_SOCKET;
+	struct richacl_backend *backend = NULL;
+	mode_t mode = 0660;
+	int opt_daemon = 0, opt_stats = 0, opt_query = 0, isdir = 0;
+	char *who = NULL;
+	struct sigaction sa;
+	int listen_fd, c;
+
+	progname = argv[0];
+
+	while ((c = getopt_long(argc, argv, "s:m:c:dga::vh",
+				long_options, NULL)) != -1) {
+		switch(c) {
+			case 's':
+				socket_path = optarg;
+				break;
+
+			case 'm':
+				mode = strtoul(optarg, NULL, 8);
+				break;
+
+			case 'c':
+				max_files = strtoul(optarg, NULL, 0);
+				if (!max_files)
+					max_files = 1;
+				break;
+
+			case 'd':
+				opt_daemon = 1;
+				break;
+
+			case 'g':
+				opt_query = RICHACLD_GET;
+				break;
+
+			case 'a':
+				opt_query = RICHACLD_ACCESS;
+				who = optarg;
+				break;
+
+			case 3:  /* --inherit */
+				opt_query = RICHACLD_INHERIT;
+				if (!strcmp(optarg, "dir"))
+					isdir = 1;
+				else if (strcmp(optarg, "file"))
+					synopsis(0);
+				break;
+
+			case 'v':
+				printf("%s %s\n", basename(progname), VERSION);
+				exit(0);
+
+			case 'h':
+				synopsis(1);
+				break;
+
+			case 1:  /* --backend */
+				richacl_set_backend(NULL);
+				richacl_free_backend(backend);
+				backend = richacl_backend_by_name(optarg);
+				if (!backend) {
+					fprintf(stderr, "%s: unknown backend `%s'\n",
+						basename(progname), optarg);
+					exit(1);
+				}
+				richacl_set_backend(backend);
+				break;
+
+			case 2:  /* --stats */
+				opt_stats = 1;
+				break;
+
+			default:
+				synopsis(0);
+				break;
+		}
+	}
+	if (opt_query) {
+		if (optind == argc)
+			synopsis(0);
+		return query(socket_path, opt_query, isdir, who,
+			     argc - optind, argv + optind);
+	}
+	if (optind != argc)
+		synopsis(0);
+
+	if (geteuid() == 0) {
+		daemon_n_groups = getgroups(0, NULL);
+		if (daemon_n_groups >= 0) {
+			daemon_groups = malloc(daemon_n_groups *
+					       sizeof(gid_t) + 1);
+			if (daemon_groups)
+				daemon_n_groups = getgroups(daemon_n_groups,
+							    daemon_groups);
+		}
+		if (!daemon_groups || daemon_n_groups < 0) {
+			perror(basename(progname));
+			return 1;
+		}
+		switch_credentials = 1;
+	}
+
+	for (file_table_size = 64; file_table_size < max_files;
+	     file_table_size *= 2)
+		;
+	file_table = calloc(file_table_size, sizeof(*file_table));
+	if (!file_table) {
+		perror(basename(progname));
+		return 1;
+	}
+
+	listen_fd = open_socket(socket_path, mode);
+	if (listen_fd < 0) {
+		perror(socket_path);
+		return 1;
+	}
+	if (opt_daemon && daemon(0, 0)) {
+		perror(basename(progname));
+		unlink(socket_path);
+		return 1;
+	}
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = handle_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	serve(listen_fd);
+
+	close(listen_fd);
+	unlink(socket_path);
+	if (opt_stats)
+		print_stats();
+	while (lru.lru_next != &lru) {
+		struct file_entry *entry = lru.lru_next;
+
+		file_remove(file_lookup(entry->dev, entry->ino));
+	}
+	free(file_table);
+	free(daemon_groups);
+	richacl_free_backend(backend);
+	return 0;
+}